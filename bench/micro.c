@@ -0,0 +1,408 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks of the client hot paths. Every benchmark prints a single line
+// with its name and the median time per operation, so the output of two
+// builds can be compared line by line. Pass a name to run only the
+// benchmarks containing it.
+
+// The event translation is static, so the benchmark is built with it
+#include "../src/input/evdev.c"
+
+#include "responses.h"
+#include "../src/audio.h"
+
+#include "sps.h"
+#include "xml.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <opus_multistream.h>
+
+#define RUNS 9
+
+#define EVENTS 4096
+
+#define FRAME_SIZE 240
+#define PACKETS 200
+#define MAX_PACKET_SIZE 1400
+
+#define IDLE_FDS 4
+
+static const char* filter;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int compare_double(const void* a, const void* b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return x < y ? -1 : x > y;
+}
+
+// Run the benchmark once to warm up caches, then report the median of the runs
+static void bench(const char* name, void (*run)(int ops), int ops) {
+  if (filter != NULL && strstr(name, filter) == NULL)
+    return;
+
+  double results[RUNS];
+  run(ops);
+  for (int i = 0; i < RUNS; i++) {
+    double start = now();
+    run(ops);
+    results[i] = (now() - start) * 1000000000.0 / ops;
+  }
+
+  qsort(results, RUNS, sizeof(results[0]), compare_double);
+  printf("%-24s %10.1f ns/op\n", name, results[RUNS / 2]);
+  fflush(stdout);
+}
+
+static void fail(const char* message) {
+  fprintf(stderr, "%s\n", message);
+  exit(1);
+}
+
+static LENTRY entry(const char* hex) {
+  LENTRY entry = { .length = strlen(hex) / 2 };
+  entry.data = malloc(entry.length);
+  if (entry.data == NULL)
+    fail("Not enough memory");
+
+  for (int i = 0; i < entry.length; i++)
+    sscanf(hex + i * 2, "%2hhx", (unsigned char*) &entry.data[i]);
+
+  return entry;
+}
+
+// Parameter sets as sent by GFE, cycled with different flags so every
+// call misses the cache of rewritten parameter sets
+static LENTRY h264_sps[3];
+static LENTRY hevc_sps[2];
+
+static void bench_sps_h264(int ops) {
+  static const int flags[] = { 0, GS_SPS_BITSTREAM_FIXUP };
+  for (int i = 0; i < ops; i++) {
+    if (gs_sps_fix(&h264_sps[i % 3], flags[i / 3 % 2]) == NULL)
+      fail("Can't fix SPS");
+  }
+}
+
+static void bench_sps_h264_cached(int ops) {
+  for (int i = 0; i < ops; i++) {
+    if (gs_sps_fix(&h264_sps[0], GS_SPS_BITSTREAM_FIXUP) == NULL)
+      fail("Can't fix SPS");
+  }
+}
+
+static void bench_sps_hevc(int ops) {
+  static const int flags[] = { GS_SPS_HEVC, GS_SPS_HEVC | GS_SPS_BITSTREAM_FIXUP, GS_SPS_HEVC | GS_SPS_BASELINE_HACK };
+  for (int i = 0; i < ops; i++) {
+    if (gs_sps_fix(&hevc_sps[i % 2], flags[i / 2 % 3]) == NULL)
+      fail("Can't fix SPS");
+  }
+}
+
+static void bench_xml_search(int ops) {
+  for (int i = 0; i < ops; i++) {
+    char* result;
+    if (xml_search((char*) serverinfo_xml, sizeof(serverinfo_xml) - 1, "currentgame", &result) != 0 || strcmp(result, "0") != 0)
+      fail("Can't find currentgame");
+
+    free(result);
+  }
+}
+
+// Nodes read from the serverinfo response by load_server_status
+static char* status_nodes[] = { "currentgame", "PairStatus", "appversion", "state", "Height", "ServerCodecModeSupport", "gputype", "GfeVersion" };
+#define STATUS_NODES (int) (sizeof(status_nodes) / sizeof(status_nodes[0]))
+
+static void bench_xml_search_nodes(int ops) {
+  for (int i = 0; i < ops; i++) {
+    char* results[STATUS_NODES];
+    bool found[STATUS_NODES];
+    if (xml_search_nodes((char*) serverinfo_xml, sizeof(serverinfo_xml) - 1, status_nodes, results, found, STATUS_NODES) != 0)
+      fail("Can't parse serverinfo");
+
+    for (int j = 0; j < STATUS_NODES; j++)
+      free(results[j]);
+  }
+}
+
+static void bench_xml_applist(int ops) {
+  for (int i = 0; i < ops; i++) {
+    PAPP_LIST list;
+    if (xml_applist((char*) applist_xml, sizeof(applist_xml) - 1, &list) != 0)
+      fail("Can't parse applist");
+
+    int apps = 0;
+    while (list != NULL) {
+      PAPP_LIST next = list->next;
+      free(list->name);
+      free(list);
+      list = next;
+      apps++;
+    }
+    if (apps != APPLIST_APPS)
+      fail("Wrong number of apps");
+  }
+}
+
+// Mapping of an Xbox 360 pad, as in mappings/xbox360.conf
+static const struct mapping xbox360 = {
+  .abs_x = ABS_X, .abs_y = ABS_Y, .abs_z = ABS_Z,
+  .abs_rx = ABS_RX, .abs_ry = ABS_RY, .abs_rz = ABS_RZ,
+  .reverse_y = true, .reverse_ry = true,
+  .abs_dpad_x = ABS_HAT0X, .abs_dpad_y = ABS_HAT0Y,
+  .btn_south = BTN_SOUTH, .btn_east = BTN_EAST, .btn_north = BTN_NORTH, .btn_west = BTN_WEST,
+  .btn_select = BTN_SELECT, .btn_start = BTN_START, .btn_mode = BTN_MODE,
+  .btn_thumbl = BTN_THUMBL, .btn_thumbr = BTN_THUMBR,
+  .btn_tl = BTN_TL, .btn_tr = BTN_TR, .btn_tl2 = BTN_TL2, .btn_tr2 = BTN_TR2,
+  .btn_dpad_up = -1, .btn_dpad_down = -1, .btn_dpad_left = -1, .btn_dpad_right = -1,
+};
+
+static struct input_device* device;
+static struct input_event keyboard_events[EVENTS], mouse_events[EVENTS], gamepad_events[EVENTS];
+
+static void enable_abs(struct libevdev* evdev, int code, int min, int max, int flat) {
+  struct input_absinfo info = { .minimum = min, .maximum = max, .flat = flat };
+  libevdev_enable_event_code(evdev, EV_ABS, code, &info);
+}
+
+// A device like evdev_create makes for a gamepad, without a file descriptor
+static void evdev_setup() {
+  struct libevdev* evdev = libevdev_new();
+  device = calloc(1, sizeof(struct input_device));
+  if (evdev == NULL || device == NULL)
+    fail("Not enough memory");
+
+  libevdev_enable_event_type(evdev, EV_ABS);
+  enable_abs(evdev, ABS_X, -32768, 32767, 128);
+  enable_abs(evdev, ABS_Y, -32768, 32767, 128);
+  enable_abs(evdev, ABS_RX, -32768, 32767, 128);
+  enable_abs(evdev, ABS_RY, -32768, 32767, 128);
+  enable_abs(evdev, ABS_Z, 0, 255, 0);
+  enable_abs(evdev, ABS_RZ, 0, 255, 0);
+  enable_abs(evdev, ABS_HAT0X, -1, 1, 0);
+  enable_abs(evdev, ABS_HAT0Y, -1, 1, 0);
+
+  device->dev = evdev;
+  device->fd = -1;
+  device->map = xbox360;
+  device->controllerId = -1;
+  device->sessionDevice = session_device("Microsoft X-Box 360 pad");
+  evdev_compile(device);
+
+  // Without a gamepad rate every change is sent, so timing doesn't matter
+  evdev_init(0);
+}
+
+static void event(struct input_event* ev, int type, int code, int value) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ev->input_event_sec = ts.tv_sec;
+  ev->input_event_usec = ts.tv_nsec / 1000;
+  ev->type = type;
+  ev->code = code;
+  ev->value = value;
+}
+
+// Synthetic event streams, each report is terminated by EV_SYN
+static void evdev_streams() {
+  static const int keys[] = { KEY_W, KEY_A, KEY_S, KEY_D, KEY_SPACE, KEY_E, KEY_R, KEY_LEFTSHIFT, KEY_1, KEY_2 };
+  srand(0);
+  for (int i = 0; i + 1 < EVENTS; i += 2) {
+    int key = keys[i / 4 % (sizeof(keys) / sizeof(keys[0]))];
+    event(&keyboard_events[i], EV_KEY, key, i / 2 % 2 == 0);
+    event(&keyboard_events[i + 1], EV_SYN, SYN_REPORT, 0);
+  }
+
+  for (int i = 0; i + 3 < EVENTS; i += 4) {
+    event(&mouse_events[i], EV_REL, REL_X, rand() % 21 - 10);
+    event(&mouse_events[i + 1], EV_REL, REL_Y, rand() % 21 - 10);
+    if (i % 64 == 0)
+      event(&mouse_events[i + 2], EV_KEY, BTN_LEFT, i % 128 == 0);
+    else
+      event(&mouse_events[i + 2], EV_REL, REL_WHEEL, i % 32 == 0);
+    event(&mouse_events[i + 3], EV_SYN, SYN_REPORT, 0);
+  }
+
+  int x = 0, y = 0;
+  for (int i = 0; i + 3 < EVENTS; i += 4) {
+    x = x + rand() % 2049 - 1024;
+    y = y + rand() % 2049 - 1024;
+    x = x > 32767 ? 32767 : x < -32768 ? -32768 : x;
+    y = y > 32767 ? 32767 : y < -32768 ? -32768 : y;
+    event(&gamepad_events[i], EV_ABS, ABS_X, x);
+    event(&gamepad_events[i + 1], EV_ABS, ABS_Y, y);
+    if (i % 32 == 0)
+      event(&gamepad_events[i + 2], EV_KEY, BTN_SOUTH, i % 64 == 0);
+    else
+      event(&gamepad_events[i + 2], EV_ABS, ABS_RZ, rand() % 256);
+    event(&gamepad_events[i + 3], EV_SYN, SYN_REPORT, 0);
+  }
+}
+
+static void run_events(struct input_event* events, int ops) {
+  for (int i = 0; i < ops; i++) {
+    if (!handler(&events[i % EVENTS], device))
+      fail("Quit combo in event stream");
+  }
+}
+
+static void bench_evdev_keyboard(int ops) {
+  run_events(keyboard_events, ops);
+}
+
+static void bench_evdev_mouse(int ops) {
+  run_events(mouse_events, ops);
+}
+
+static void bench_evdev_gamepad(int ops) {
+  run_events(gamepad_events, ops);
+}
+
+// Stream configurations of GameStream, the mapping is FL-FR-C-LFE-RL-RR
+static OPUS_MULTISTREAM_CONFIGURATION stereo = { .sampleRate = 48000, .channelCount = 2, .streams = 1, .coupledStreams = 1, .mapping = { 0, 1 } };
+static OPUS_MULTISTREAM_CONFIGURATION surround = { .sampleRate = 48000, .channelCount = 6, .streams = 4, .coupledStreams = 2, .mapping = { 0, 4, 1, 5, 2, 3 } };
+
+struct opus_stream {
+  OpusMSDecoder* decoder;
+  int lengths[PACKETS];
+  unsigned char packets[PACKETS][MAX_PACKET_SIZE];
+};
+
+static struct opus_stream stereo_stream, surround_stream;
+static short pcm[FRAME_SIZE * 6];
+
+// Encode tones on every channel and make a decoder for the channel order of ALSA
+static void opus_setup(POPUS_MULTISTREAM_CONFIGURATION config, struct opus_stream* stream) {
+  int error;
+  OpusMSEncoder* encoder = opus_multistream_encoder_create(config->sampleRate, config->channelCount, config->streams, config->coupledStreams, config->mapping, OPUS_APPLICATION_RESTRICTED_LOWDELAY, &error);
+  if (encoder == NULL)
+    fail("Can't create Opus encoder");
+
+  srand(0);
+  for (int i = 0; i < PACKETS; i++) {
+    for (int j = 0; j < FRAME_SIZE; j++) {
+      for (int c = 0; c < config->channelCount; c++)
+        pcm[j * config->channelCount + c] = ((i * FRAME_SIZE + j) * (c + 1) % 200 - 100) * 80 + rand() % 512;
+    }
+
+    stream->lengths[i] = opus_multistream_encode(encoder, pcm, FRAME_SIZE, stream->packets[i], MAX_PACKET_SIZE);
+    if (stream->lengths[i] < 0)
+      fail("Can't encode Opus packet");
+  }
+  opus_multistream_encoder_destroy(encoder);
+
+  // Same remapping as the ALSA and PulseAudio renderers
+  unsigned char mapping[6];
+  audio_alsa_mapping(config, mapping);
+
+  stream->decoder = opus_multistream_decoder_create(config->sampleRate, config->channelCount, config->streams, config->coupledStreams, mapping, &error);
+  if (stream->decoder == NULL)
+    fail("Can't create Opus decoder");
+}
+
+static void run_opus(struct opus_stream* stream, int ops) {
+  for (int i = 0; i < ops; i++) {
+    if (opus_multistream_decode(stream->decoder, stream->packets[i % PACKETS], stream->lengths[i % PACKETS], pcm, FRAME_SIZE, 0) != FRAME_SIZE)
+      fail("Can't decode Opus packet");
+  }
+}
+
+static void bench_opus_stereo(int ops) {
+  run_opus(&stereo_stream, ops);
+}
+
+static void bench_opus_surround(int ops) {
+  run_opus(&surround_stream, ops);
+}
+
+static int dispatched, dispatch_ops;
+
+// The event stays readable, so every poll dispatches it again
+static int loop_handler(int fd) {
+  return ++dispatched < dispatch_ops ? LOOP_OK : LOOP_RETURN;
+}
+
+static void loop_setup() {
+  int fd = eventfd(1, EFD_CLOEXEC);
+  if (fd < 0)
+    fail("Can't create eventfd");
+
+  // Handlers of input devices that are idle
+  for (int i = 0; i < IDLE_FDS; i++) {
+    int pipefd[2];
+    if (pipe(pipefd) < 0)
+      fail("Can't create pipe");
+
+    loop_add_fd(pipefd[0], loop_handler, POLLIN);
+  }
+  loop_add_fd(fd, loop_handler, POLLIN);
+}
+
+static void bench_loop_dispatch(int ops) {
+  dispatched = 0;
+  dispatch_ops = ops;
+  loop_main();
+}
+
+int main(int argc, char* argv[]) {
+  filter = argc > 1 ? argv[1] : NULL;
+
+  h264_sps[0] = entry("000000016764001facd9405005bb011000000300100000030300f183196000");
+  h264_sps[1] = entry("0000000167640028ac2b402802dd80880000030008000003014a00");
+  h264_sps[2] = entry("00000001674d401e9a6605817f2a1000003e90000bb800f162d960");
+  hevc_sps[0] = entry("0000000140010c01ffff016000000300900000030000030078959809");
+  hevc_sps[1] = entry("00000001420101016000000300900000030000030078a003c080100e5965659249b2b0a0202020a0");
+  gs_sps_init(1280, 720);
+
+  bench("sps_fix_h264", bench_sps_h264, 20000);
+  bench("sps_fix_h264_cached", bench_sps_h264_cached, 100000);
+  bench("sps_fix_hevc", bench_sps_hevc, 20000);
+
+  bench("xml_search", bench_xml_search, 2000);
+  bench("xml_search_nodes", bench_xml_search_nodes, 2000);
+  bench("xml_applist", bench_xml_applist, 2000);
+
+  evdev_setup();
+  evdev_streams();
+  bench("evdev_keyboard", bench_evdev_keyboard, EVENTS * 64);
+  bench("evdev_mouse", bench_evdev_mouse, EVENTS * 64);
+  bench("evdev_gamepad", bench_evdev_gamepad, EVENTS * 64);
+
+  opus_setup(&stereo, &stereo_stream);
+  opus_setup(&surround, &surround_stream);
+  bench("opus_decode_stereo", bench_opus_stereo, PACKETS * 5);
+  bench("opus_decode_51", bench_opus_surround, PACKETS * 5);
+
+  // The loop blocks the termination signals, so it runs last
+  loop_setup();
+  bench("loop_dispatch", bench_loop_dispatch, 100000);
+
+  return 0;
+}
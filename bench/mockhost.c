@@ -0,0 +1,701 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Stand-in for the HTTP and HTTPS services of a GameStream host, so the
+// client can be started without a GFE PC. It pairs with the PIN passed to
+// it and answers every endpoint after an optional delay, or fails it on
+// purpose. Only the HTTP part is emulated, streaming over RTSP isn't.
+
+#define _GNU_SOURCE
+
+#include "mkcert.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/sha.h>
+#include <openssl/aes.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+#define HTTP_PORT 47989
+#define HTTPS_PORT 47984
+
+#define MAX_REQUEST_SIZE 16384
+#define CERT_SIGNATURE_SIZE 256
+
+enum endpoint_id { SERVERINFO, PAIR, UNPAIR, APPLIST, APPASSET, LAUNCH, RESUME, CANCEL, ENDPOINTS };
+
+// Behaviour of an endpoint, a failing request is answered with the HTTP
+// status or the connection is closed without response for status 0
+struct endpoint {
+  const char* name;
+  int delay;
+  int status;
+  int percent;
+};
+
+static struct endpoint endpoints[ENDPOINTS] = {
+  [SERVERINFO] = { "serverinfo" },
+  [PAIR] = { "pair" },
+  [UNPAIR] = { "unpair" },
+  [APPLIST] = { "applist" },
+  [APPASSET] = { "appasset" },
+  [LAUNCH] = { "launch" },
+  [RESUME] = { "resume" },
+  [CANCEL] = { "cancel" },
+};
+
+static const char* app_names[] = {
+  "Steam", "Desktop", "Portal 2", "Shadow of the Tomb Raider", "Rocket League", "Stardew Valley",
+  "The Witcher 3: Wild Hunt", "Forza Horizon 4", "Celeste", "Hollow Knight", "Dark Souls III", "Cuphead"
+};
+#define APP_NAMES (int) (sizeof(app_names) / sizeof(app_names[0]))
+
+static const char* address = "127.0.0.1";
+static const char* pin = "0000";
+static const char* app_version = "7.1.431.-1";
+static int apps = APP_NAMES;
+static int asset_size = 64 * 1024;
+static bool verbose;
+
+static X509* cert;
+static EVP_PKEY* key;
+static char* cert_hex;
+static SSL_CTX* ssl_ctx;
+
+// Host state shared by all connections
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool paired;
+static int current_game;
+
+// Pairing state between the requests of gs_pair
+static struct {
+  AES_KEY enc_key, dec_key;
+  X509* client_cert;
+  unsigned char server_secret[16];
+  unsigned char server_challenge[16];
+  unsigned char client_hash[32];
+} pairing;
+
+struct connection {
+  int fd;
+  SSL* ssl;
+};
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static pthread_mutex_t* ssl_locks;
+
+static void ssl_lock(int mode, int n, const char* file, int line) {
+  if (mode & CRYPTO_LOCK)
+    pthread_mutex_lock(&ssl_locks[n]);
+  else
+    pthread_mutex_unlock(&ssl_locks[n]);
+}
+
+static unsigned long ssl_thread_id() {
+  return (unsigned long) pthread_self();
+}
+#endif
+
+static unsigned char* cert_signature(X509* x509) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  return x509->signature->data;
+#else
+  const ASN1_BIT_STRING* signature;
+  X509_get0_signature(&signature, NULL, x509);
+  return signature->data;
+#endif
+}
+
+static int hash_length() {
+  return atoi(app_version) >= 7 ? 32 : 20;
+}
+
+static void hash(const unsigned char* data, size_t length, unsigned char* out) {
+  if (hash_length() == 32)
+    SHA256(data, length, out);
+  else
+    SHA1(data, length, out);
+}
+
+static void bytes_to_hex(const unsigned char* in, char* out, size_t length) {
+  for (size_t i = 0; i < length; i++)
+    sprintf(out + i * 2, "%02x", in[i]);
+
+  out[length * 2] = 0;
+}
+
+static int hex_to_bytes(const char* in, unsigned char* out, size_t size) {
+  size_t length = strlen(in) / 2;
+  if (length > size)
+    return -1;
+
+  for (size_t i = 0; i < length; i++)
+    sscanf(&in[i * 2], "%2hhx", &out[i]);
+
+  return length;
+}
+
+// Copy the value of a query parameter, returns false if it's missing
+static bool query_param(const char* query, const char* name, char* value, size_t size) {
+  size_t length = strlen(name);
+  for (const char* p = query; p != NULL && *p != 0; p = strchr(p, '&'), p = p != NULL ? p + 1 : NULL) {
+    if (strncmp(p, name, length) == 0 && p[length] == '=') {
+      p += length + 1;
+      size_t end = strcspn(p, "&");
+      if (end >= size)
+        return false;
+
+      memcpy(value, p, end);
+      value[end] = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool verify_signature(const unsigned char* data, int length, const unsigned char* signature, int signatureLength, X509* x509) {
+  EVP_PKEY* pubKey = X509_get_pubkey(x509);
+  EVP_MD_CTX* ctx = EVP_MD_CTX_create();
+  EVP_DigestVerifyInit(ctx, NULL, EVP_sha256(), NULL, pubKey);
+  EVP_DigestVerifyUpdate(ctx, data, length);
+  int result = EVP_DigestVerifyFinal(ctx, (unsigned char*) signature, signatureLength);
+  EVP_MD_CTX_destroy(ctx);
+  EVP_PKEY_free(pubKey);
+  return result > 0;
+}
+
+static int sign(const unsigned char* data, int length, unsigned char* signature, size_t size) {
+  EVP_MD_CTX* ctx = EVP_MD_CTX_create();
+  int result = EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, key) == 1 &&
+    EVP_DigestSignUpdate(ctx, data, length) == 1 &&
+    EVP_DigestSignFinal(ctx, signature, &size) == 1;
+  EVP_MD_CTX_destroy(ctx);
+  return result ? (int) size : -1;
+}
+
+// The server side of the pairing handshake of gs_pair, every stage
+// answers with paired set to 0 when it can't continue
+static bool pair(const char* query, bool https, FILE* out) {
+  char value[8192];
+  unsigned char data[4096];
+  int length;
+
+  if (query_param(query, "phrase", value, sizeof(value)) && strcmp(value, "getservercert") == 0) {
+    unsigned char salt_pin[20];
+    unsigned char aes_key[32];
+    if (!query_param(query, "salt", value, sizeof(value)) || hex_to_bytes(value, salt_pin, 16) != 16)
+      return false;
+
+    memcpy(salt_pin + 16, pin, 4);
+    hash(salt_pin, sizeof(salt_pin), aes_key);
+    AES_set_encrypt_key(aes_key, 128, &pairing.enc_key);
+    AES_set_decrypt_key(aes_key, 128, &pairing.dec_key);
+
+    if (!query_param(query, "clientcert", value, sizeof(value)) || (length = hex_to_bytes(value, data, sizeof(data))) <= 0)
+      return false;
+
+    BIO* bio = BIO_new_mem_buf(data, length);
+    if (pairing.client_cert != NULL)
+      X509_free(pairing.client_cert);
+    pairing.client_cert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    if (pairing.client_cert == NULL)
+      return false;
+
+    paired = false;
+    fprintf(out, "<paired>1</paired>\n<plaincert>%s</plaincert>\n", cert_hex);
+  } else if (query_param(query, "clientchallenge", value, sizeof(value))) {
+    unsigned char challenge[16 + CERT_SIGNATURE_SIZE + 16];
+    unsigned char response[48] = {0};
+    unsigned char response_enc[48];
+    char response_hex[sizeof(response_enc) * 2 + 1];
+    if (hex_to_bytes(value, data, 16) != 16)
+      return false;
+
+    AES_decrypt(data, challenge, &pairing.dec_key);
+    RAND_bytes(pairing.server_secret, 16);
+    RAND_bytes(pairing.server_challenge, 16);
+    memcpy(challenge + 16, cert_signature(cert), CERT_SIGNATURE_SIZE);
+    memcpy(challenge + 16 + CERT_SIGNATURE_SIZE, pairing.server_secret, 16);
+    hash(challenge, sizeof(challenge), response);
+    memcpy(response + hash_length(), pairing.server_challenge, 16);
+    for (int i = 0; i < sizeof(response); i += 16)
+      AES_encrypt(response + i, response_enc + i, &pairing.enc_key);
+
+    bytes_to_hex(response_enc, response_hex, sizeof(response_enc));
+    fprintf(out, "<paired>1</paired>\n<challengeresponse>%s</challengeresponse>\n", response_hex);
+  } else if (query_param(query, "serverchallengeresp", value, sizeof(value))) {
+    unsigned char secret[16 + CERT_SIGNATURE_SIZE];
+    char secret_hex[sizeof(secret) * 2 + 1];
+    if (hex_to_bytes(value, data, 32) != 32)
+      return false;
+
+    for (int i = 0; i < 32; i += 16)
+      AES_decrypt(data + i, pairing.client_hash + i, &pairing.dec_key);
+
+    memcpy(secret, pairing.server_secret, 16);
+    if (sign(pairing.server_secret, 16, secret + 16, CERT_SIGNATURE_SIZE) != CERT_SIGNATURE_SIZE)
+      return false;
+
+    bytes_to_hex(secret, secret_hex, sizeof(secret));
+    fprintf(out, "<paired>1</paired>\n<pairingsecret>%s</pairingsecret>\n", secret_hex);
+  } else if (query_param(query, "clientpairingsecret", value, sizeof(value))) {
+    // The client hash only matches when the client used the same PIN
+    unsigned char response[16 + CERT_SIGNATURE_SIZE + 16];
+    unsigned char expected[32];
+    if (pairing.client_cert == NULL || hex_to_bytes(value, data, 16 + CERT_SIGNATURE_SIZE) != 16 + CERT_SIGNATURE_SIZE)
+      return false;
+
+    memcpy(response, pairing.server_challenge, 16);
+    memcpy(response + 16, cert_signature(pairing.client_cert), CERT_SIGNATURE_SIZE);
+    memcpy(response + 16 + CERT_SIGNATURE_SIZE, data, 16);
+    hash(response, sizeof(response), expected);
+    if (memcmp(expected, pairing.client_hash, hash_length()) != 0 || !verify_signature(data, 16, data + 16, CERT_SIGNATURE_SIZE, pairing.client_cert)) {
+      fprintf(stderr, "Pairing failed, wrong PIN\n");
+      return false;
+    }
+
+    paired = true;
+    fprintf(out, "<paired>1</paired>\n");
+  } else if (query_param(query, "phrase", value, sizeof(value)) && strcmp(value, "pairchallenge") == 0 && https && paired) {
+    fprintf(out, "<paired>1</paired>\n");
+  } else
+    return false;
+
+  return true;
+}
+
+static void serverinfo(bool https, FILE* out) {
+  int height = 0;
+  fprintf(out, "<hostname>MOCKHOST</hostname>\n<appversion>%s</appversion>\n<GfeVersion>3.20.5.70</GfeVersion>\n", app_version);
+  fprintf(out, "<uniqueid>00000000-0000-0000-0000-000000000000</uniqueid>\n<HttpsPort>%d</HttpsPort>\n<ExternalPort>%d</ExternalPort>\n", HTTPS_PORT, HTTP_PORT);
+  fprintf(out, "<mac>00:00:00:00:00:00</mac>\n<LocalIP>%s</LocalIP>\n<ServerCodecModeSupport>259</ServerCodecModeSupport>\n", address);
+  fprintf(out, "<SupportedDisplayMode>\n");
+  for (int i = 0; i < 3; i++) {
+    static const int modes[][3] = { { 3840, 2160, 60 }, { 1920, 1080, 60 }, { 1280, 720, 60 } };
+    fprintf(out, "<DisplayMode><Width>%d</Width><Height>%d</Height><RefreshRate>%d</RefreshRate></DisplayMode>\n", modes[i][0], modes[i][1], modes[i][2]);
+    height = height > modes[i][1] ? height : modes[i][1];
+  }
+  fprintf(out, "</SupportedDisplayMode>\n<Height>%d</Height>\n", height);
+
+  // Like GFE, only a request over HTTPS tells whether the client is paired
+  fprintf(out, "<PairStatus>%d</PairStatus>\n<currentgame>%d</currentgame>\n", https && paired, current_game);
+  fprintf(out, "<state>%s</state>\n<gputype>GeForce GTX 1080</gputype>\n", current_game != 0 ? "MJOLNIR_STATE_SERVER_BUSY" : "MJOLNIR_STATE_SERVER_AVAILABLE");
+}
+
+static int app_id(int index) {
+  return 100000 + index * 7919;
+}
+
+static void applist(FILE* out) {
+  for (int i = 0; i < apps; i++) {
+    if (i < APP_NAMES)
+      fprintf(out, "<App>\n<IsHdrSupported>0</IsHdrSupported>\n<AppTitle>%s</AppTitle>\n<ID>%d</ID>\n</App>\n", app_names[i], app_id(i));
+    else
+      fprintf(out, "<App>\n<IsHdrSupported>0</IsHdrSupported>\n<AppTitle>Game %d</AppTitle>\n<ID>%d</ID>\n</App>\n", i + 1, app_id(i));
+  }
+}
+
+static bool launch(const char* query, FILE* out) {
+  char value[32];
+  int id = query_param(query, "appid", value, sizeof(value)) ? atoi(value) : 0;
+  bool found = false;
+  for (int i = 0; i < apps && !found; i++)
+    found = app_id(i) == id;
+
+  if (found)
+    current_game = id;
+
+  fprintf(out, "<gamesession>%d</gamesession>\n", found);
+  return found;
+}
+
+static int conn_read(struct connection* conn, char* buffer, int size) {
+  return conn->ssl != NULL ? SSL_read(conn->ssl, buffer, size) : recv(conn->fd, buffer, size, 0);
+}
+
+static bool conn_write(struct connection* conn, const char* buffer, size_t size) {
+  while (size > 0) {
+    int ret = conn->ssl != NULL ? SSL_write(conn->ssl, buffer, size) : send(conn->fd, buffer, size, MSG_NOSIGNAL);
+    if (ret <= 0)
+      return false;
+
+    buffer += ret;
+    size -= ret;
+  }
+  return true;
+}
+
+// Read the header of a request, there is no body to a GET request
+static int read_request(struct connection* conn, char* request, int size) {
+  int length = 0;
+  while (length < size - 1) {
+    int ret = conn_read(conn, request + length, size - 1 - length);
+    if (ret <= 0)
+      return -1;
+
+    length += ret;
+    request[length] = 0;
+    if (strstr(request, "\r\n\r\n") != NULL)
+      return length;
+  }
+  return -1;
+}
+
+// Header and body are sent at once, a separate small write would be
+// delayed by Nagle's algorithm until the client acknowledges the header
+static bool respond(struct connection* conn, int status, const char* type, const char* body, size_t length) {
+  char header[256];
+  int header_length = snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n", status, status == 200 ? "OK" : "Error", type, length);
+  char* response = malloc(header_length + length);
+  if (response == NULL)
+    return false;
+
+  memcpy(response, header, header_length);
+  memcpy(response + header_length, body, length);
+  bool ret = conn_write(conn, response, header_length + length);
+  free(response);
+  return ret;
+}
+
+static bool handle(struct connection* conn, char* request, bool https) {
+  char* path = strchr(request, ' ');
+  if (strncmp(request, "GET ", 4) != 0 || path == NULL)
+    return false;
+
+  path++;
+  path[strcspn(path, " \r\n")] = 0;
+  char* query = strchr(path, '?');
+  if (query != NULL)
+    *query++ = 0;
+  else
+    query = "";
+
+  struct endpoint* endpoint = NULL;
+  for (int i = 0; i < ENDPOINTS && endpoint == NULL; i++) {
+    if (strcmp(path + 1, endpoints[i].name) == 0)
+      endpoint = &endpoints[i];
+  }
+
+  if (endpoint == NULL) {
+    respond(conn, 404, "text/plain", "", 0);
+    return true;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (endpoint->delay > 0)
+    usleep(endpoint->delay * 1000);
+
+  char* body = NULL;
+  size_t length = 0;
+  FILE* out = open_memstream(&body, &length);
+  if (out == NULL)
+    return false;
+
+  int status = 200;
+  const char* type = "application/xml";
+  pthread_mutex_lock(&lock);
+  if (endpoint->percent > 0 && rand() % 100 < endpoint->percent) {
+    status = endpoint->status;
+  } else if (endpoint == &endpoints[APPASSET]) {
+    // Box art of the size to measure throughput with
+    type = "image/png";
+    for (int i = 0; i < asset_size; i++)
+      fputc(rand(), out);
+  } else {
+    // Only paired clients may use HTTPS, except for pairing itself
+    int id = endpoint - endpoints;
+    bool allowed = id == SERVERINFO || id == PAIR || id == UNPAIR || (https && paired);
+    fprintf(out, "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?>\n");
+    fprintf(out, "<root protocol_version=\"0.1\" query=\"%s\" status_code=\"%d\">\n", endpoint->name, allowed ? 200 : 401);
+    if (!allowed)
+      status = 401;
+    else if (id == SERVERINFO && https && !paired)
+      status = 401;
+    else if (id == SERVERINFO)
+      serverinfo(https, out);
+    else if (id == PAIR && !pair(query, https, out))
+      fprintf(out, "<paired>0</paired>\n");
+    else if (id == UNPAIR)
+      paired = false;
+    else if (id == APPLIST)
+      applist(out);
+    else if (id == LAUNCH)
+      launch(query, out);
+    else if (id == RESUME)
+      fprintf(out, "<resume>%d</resume>\n<gamesession>%d</gamesession>\n", current_game != 0, current_game != 0);
+    else if (id == CANCEL) {
+      current_game = 0;
+      fprintf(out, "<cancel>1</cancel>\n");
+    }
+    fprintf(out, "</root>\n");
+  }
+  pthread_mutex_unlock(&lock);
+  fclose(out);
+
+  bool ret = status == 0 ? false : status == 200 ? respond(conn, status, type, body, length) : respond(conn, status, "text/plain", "", 0);
+  free(body);
+
+  if (verbose) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("%s /%s %d %.1f ms\n", https ? "HTTPS" : "HTTP", endpoint->name, status, (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+    fflush(stdout);
+  }
+  return ret;
+}
+
+// Serve the requests of a connection until the client closes it
+static void* serve(void* data) {
+  struct connection conn = *(struct connection*) data;
+  free(data);
+
+  bool https = conn.ssl != NULL;
+  char* request = malloc(MAX_REQUEST_SIZE);
+  if (request != NULL && (!https || SSL_accept(conn.ssl) == 1)) {
+    while (read_request(&conn, request, MAX_REQUEST_SIZE) > 0 && handle(&conn, request, https));
+  }
+
+  if (https) {
+    SSL_shutdown(conn.ssl);
+    SSL_free(conn.ssl);
+  }
+  close(conn.fd);
+  free(request);
+  return NULL;
+}
+
+static int listen_port(int port) {
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+  if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+    fprintf(stderr, "Invalid address: %s\n", address);
+    exit(1);
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+    fprintf(stderr, "Can't listen on %s:%d: %s\n", address, port, strerror(errno));
+    exit(1);
+  }
+  return fd;
+}
+
+static int verify_client(int ok, X509_STORE_CTX* ctx) {
+  // Client certificates are self signed and checked while pairing
+  return 1;
+}
+
+static void init_ssl() {
+  SSL_library_init();
+  SSL_load_error_strings();
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  ssl_locks = malloc(CRYPTO_num_locks() * sizeof(pthread_mutex_t));
+  for (int i = 0; i < CRYPTO_num_locks(); i++)
+    pthread_mutex_init(&ssl_locks[i], NULL);
+
+  CRYPTO_set_id_callback(ssl_thread_id);
+  CRYPTO_set_locking_callback(ssl_lock);
+#endif
+
+  CERT_KEY_PAIR pair = mkcert_generate();
+  cert = pair.x509;
+  key = pair.pkey;
+
+  char* pem;
+  BIO* bio = BIO_new(BIO_s_mem());
+  PEM_write_bio_X509(bio, cert);
+  long length = BIO_get_mem_data(bio, &pem);
+  cert_hex = malloc(length * 2 + 1);
+  bytes_to_hex((unsigned char*) pem, cert_hex, length);
+  BIO_free(bio);
+
+  ssl_ctx = SSL_CTX_new(SSLv23_server_method());
+  if (ssl_ctx == NULL || SSL_CTX_use_certificate(ssl_ctx, cert) != 1 || SSL_CTX_use_PrivateKey(ssl_ctx, key) != 1) {
+    ERR_print_errors_fp(stderr);
+    exit(1);
+  }
+  SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, verify_client);
+}
+
+// Parse <endpoint>=<value>[/<percent>], all applies to every endpoint
+static void parse_endpoint_option(const char* option, bool fail) {
+  char name[32];
+  int value, percent = 100;
+  if (sscanf(option, "%31[^=]=%d/%d", name, &value, &percent) < 2) {
+    fprintf(stderr, "Invalid option: %s\n", option);
+    exit(1);
+  }
+
+  bool found = false;
+  for (int i = 0; i < ENDPOINTS; i++) {
+    if (strcmp(name, "all") == 0 || strcmp(name, endpoints[i].name) == 0) {
+      if (fail) {
+        endpoints[i].status = value;
+        endpoints[i].percent = percent;
+      } else
+        endpoints[i].delay = value;
+      found = true;
+    }
+  }
+
+  if (!found) {
+    fprintf(stderr, "Unknown endpoint: %s\n", name);
+    exit(1);
+  }
+}
+
+static void help() {
+  printf("Usage: moonlight-mockhost [options]\n\n");
+  printf("\t-bind <address>\t\tAddress to listen on (default 127.0.0.1)\n");
+  printf("\t-pin <pin>\t\tPIN to pair with (default 0000)\n");
+  printf("\t-paired\t\t\tStart as already paired\n");
+  printf("\t-version <version>\tApp version to report (default 7.1.431.-1)\n");
+  printf("\t-apps <count>\t\tNumber of apps in the app list\n");
+  printf("\t-asset <bytes>\t\tSize of the box art of an app\n");
+  printf("\t-delay <endpoint>=<ms>\tDelay the responses of an endpoint\n");
+  printf("\t-fail <endpoint>=<status>[/<percent>]\tFail requests with the HTTP status, 0 closes the connection\n");
+  printf("\t-verbose\t\tPrint every request\n");
+  printf("\nEndpoints are serverinfo, pair, unpair, applist, appasset, launch, resume and cancel or all\n");
+}
+
+int main(int argc, char* argv[]) {
+  static struct option long_options[] = {
+    {"bind", required_argument, NULL, 'b'},
+    {"pin", required_argument, NULL, 'p'},
+    {"paired", no_argument, NULL, 'P'},
+    {"version", required_argument, NULL, 'v'},
+    {"apps", required_argument, NULL, 'a'},
+    {"asset", required_argument, NULL, 's'},
+    {"delay", required_argument, NULL, 'd'},
+    {"fail", required_argument, NULL, 'f'},
+    {"verbose", no_argument, NULL, 'V'},
+    {"help", no_argument, NULL, 'h'},
+    {0, 0, 0, 0},
+  };
+
+  int c;
+  while ((c = getopt_long_only(argc, argv, "b:p:Pv:a:s:d:f:Vh", long_options, NULL)) != -1) {
+    switch (c) {
+    case 'b':
+      address = optarg;
+      break;
+    case 'p':
+      if (strlen(optarg) != 4) {
+        fprintf(stderr, "PIN must have 4 digits\n");
+        return 1;
+      }
+      pin = optarg;
+      break;
+    case 'P':
+      paired = true;
+      break;
+    case 'v':
+      app_version = optarg;
+      break;
+    case 'a':
+      apps = atoi(optarg);
+      break;
+    case 's':
+      asset_size = atoi(optarg);
+      break;
+    case 'd':
+      parse_endpoint_option(optarg, false);
+      break;
+    case 'f':
+      parse_endpoint_option(optarg, true);
+      break;
+    case 'V':
+      verbose = true;
+      break;
+    default:
+      help();
+      return c == 'h' ? 0 : 1;
+    }
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  init_ssl();
+
+  struct pollfd fds[2] = {
+    { .fd = listen_port(HTTP_PORT), .events = POLLIN },
+    { .fd = listen_port(HTTPS_PORT), .events = POLLIN },
+  };
+  printf("GameStream host on %s, pair with PIN %s\n", address, pin);
+  fflush(stdout);
+
+  while (poll(fds, 2, -1) >= 0 || errno == EINTR) {
+    for (int i = 0; i < 2; i++) {
+      if ((fds[i].revents & POLLIN) == 0)
+        continue;
+
+      int fd = accept(fds[i].fd, NULL, NULL);
+      if (fd < 0)
+        continue;
+
+      // TLS sends session tickets separately, which would hold back the response
+      int nodelay = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+      struct connection* conn = malloc(sizeof(struct connection));
+      if (conn == NULL) {
+        close(fd);
+        continue;
+      }
+      conn->fd = fd;
+      conn->ssl = NULL;
+      if (i == 1) {
+        conn->ssl = SSL_new(ssl_ctx);
+        SSL_set_fd(conn->ssl, fd);
+      }
+
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, serve, conn) != 0) {
+        fprintf(stderr, "Can't start connection thread\n");
+        if (conn->ssl != NULL)
+          SSL_free(conn->ssl);
+        close(fd);
+        free(conn);
+      } else
+        pthread_detach(thread);
+    }
+  }
+
+  perror("poll");
+  return 1;
+}
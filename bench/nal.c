@@ -0,0 +1,147 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nal.h"
+
+#include "h264_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BUFFER_SIZE 4*1024*1024
+#define SLICE_SIZE 1400
+#define ITERATIONS 20
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void report(const char* name, double start, int bytes) {
+  double seconds = now() - start;
+  printf("%-24s %8.1f MB/s\n", name, bytes * (double) ITERATIONS / seconds / (1024 * 1024));
+}
+
+// Byte by byte scan, as done by find_nal_unit in h264bitstream
+static int find_start_code_bytewise(const uint8_t* data, int length) {
+  for (int i = 0; i + 2 < length; i++) {
+    if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+      return i;
+  }
+  return -1;
+}
+
+int main(int argc, char* argv[]) {
+  uint8_t* input = malloc(BUFFER_SIZE);
+  uint8_t* output = malloc(BUFFER_SIZE);
+  uint8_t* escaped = malloc(BUFFER_SIZE * 2);
+  if (input == NULL || output == NULL || escaped == NULL) {
+    fprintf(stderr, "Not enough memory\n");
+    return 1;
+  }
+
+  // Slices of random data with some escaped zero runs, like a coded frame
+  srand(0);
+  for (int i = 0; i < BUFFER_SIZE; i++)
+    input[i] = rand() % 256 ? rand() : 0;
+
+  for (int i = 0; i + SLICE_SIZE < BUFFER_SIZE; i += SLICE_SIZE) {
+    memcpy(input + i, "\x00\x00\x00\x01\x41", 5);
+    memcpy(input + i + SLICE_SIZE / 2, "\x00\x00\x03\x00", 4);
+  }
+
+  int count = 0;
+  double start = now();
+  for (int n = 0; n < ITERATIONS; n++) {
+    for (int i = 0, pos; (pos = find_start_code_bytewise(input + i, BUFFER_SIZE - i)) >= 0; i += pos + 3)
+      count++;
+  }
+  report("start code (bytewise)", start, BUFFER_SIZE);
+
+  start = now();
+  for (int n = 0; n < ITERATIONS; n++) {
+    for (int i = 0, pos; (pos = gs_nal_find_start_code((char*) input + i, BUFFER_SIZE - i)) >= 0; i += pos + 3)
+      count--;
+  }
+  report("start code", start, BUFFER_SIZE);
+
+  if (count != 0) {
+    fprintf(stderr, "Start code count mismatch\n");
+    return 1;
+  }
+
+  // Emulation prevention is handled per NAL unit, without the start code
+  int slices = BUFFER_SIZE / SLICE_SIZE;
+  int bytes = slices * (SLICE_SIZE - 4);
+  int lengths[BUFFER_SIZE / SLICE_SIZE];
+  start = now();
+  for (int n = 0; n < ITERATIONS; n++) {
+    for (int i = 0; i < slices; i++) {
+      int nal_size = SLICE_SIZE - 4, rbsp_size = SLICE_SIZE;
+      lengths[i] = nal_to_rbsp(input + i * SLICE_SIZE + 4, &nal_size, output + i * SLICE_SIZE, &rbsp_size);
+    }
+  }
+  report("unescape (h264bitstream)", start, bytes);
+
+  start = now();
+  for (int n = 0; n < ITERATIONS; n++) {
+    for (int i = 0; i < slices; i++)
+      lengths[i] = gs_nal_unescape((char*) input + i * SLICE_SIZE + 4, SLICE_SIZE - 4, (char*) output + i * SLICE_SIZE);
+  }
+  report("unescape", start, bytes);
+
+  start = now();
+  for (int n = 0; n < ITERATIONS; n++) {
+    for (int i = 0; i < slices; i++) {
+      int nal_size = SLICE_SIZE * 2;
+      rbsp_to_nal(output + i * SLICE_SIZE, &lengths[i], escaped + i * SLICE_SIZE * 2, &nal_size);
+    }
+  }
+  report("escape (h264bitstream)", start, bytes);
+
+  start = now();
+  for (int n = 0; n < ITERATIONS; n++) {
+    for (int i = 0; i < slices; i++)
+      gs_nal_escape((char*) output + i * SLICE_SIZE, lengths[i], (char*) escaped + i * SLICE_SIZE * 2, SLICE_SIZE * 2);
+  }
+  report("escape", start, bytes);
+
+  // Index a decode unit of a typical frame size for every slice entry
+  static LENTRY entries[GS_NAL_MAX_UNITS];
+  for (int i = 0; i < GS_NAL_MAX_UNITS; i++) {
+    entries[i].data = (char*) input + i * SLICE_SIZE;
+    entries[i].length = SLICE_SIZE;
+    entries[i].next = i + 1 < GS_NAL_MAX_UNITS ? &entries[i + 1] : NULL;
+  }
+
+  DECODE_UNIT decodeUnit = { .fullLength = GS_NAL_MAX_UNITS * SLICE_SIZE, .bufferList = entries };
+  NAL_INDEX index;
+  start = now();
+  for (int n = 0; n < ITERATIONS * 100; n++)
+    gs_nal_index(&decodeUnit, &index, false);
+  report("index", start, decodeUnit.fullLength * 100);
+
+  free(input);
+  free(output);
+  free(escaped);
+  return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Responses of a paired GFE 3.x host, with identifiers replaced
+
+static const char serverinfo_xml[] =
+  "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?>\n"
+  "<root protocol_version=\"0.1\" query=\"serverinfo\" status_code=\"200\" status_message=\"OK\">\n"
+  "<hostname>GAMING-PC</hostname>\n"
+  "<appversion>7.1.431.-1</appversion>\n"
+  "<GfeVersion>3.20.5.70</GfeVersion>\n"
+  "<uniqueid>00000000-0000-0000-0000-000000000000</uniqueid>\n"
+  "<HttpsPort>47984</HttpsPort>\n"
+  "<ExternalPort>47989</ExternalPort>\n"
+  "<MaxLumaPixelsHEVC>1869449984</MaxLumaPixelsHEVC>\n"
+  "<mac>00:00:00:00:00:00</mac>\n"
+  "<LocalIP>192.168.1.10</LocalIP>\n"
+  "<ServerCodecModeSupport>259</ServerCodecModeSupport>\n"
+  "<SupportedDisplayMode>\n"
+  "<DisplayMode><Width>3840</Width><Height>2160</Height><RefreshRate>60</RefreshRate></DisplayMode>\n"
+  "<DisplayMode><Width>2560</Width><Height>1440</Height><RefreshRate>144</RefreshRate></DisplayMode>\n"
+  "<DisplayMode><Width>1920</Width><Height>1080</Height><RefreshRate>60</RefreshRate></DisplayMode>\n"
+  "<DisplayMode><Width>1280</Width><Height>720</Height><RefreshRate>60</RefreshRate></DisplayMode>\n"
+  "</SupportedDisplayMode>\n"
+  "<PairStatus>1</PairStatus>\n"
+  "<currentgame>0</currentgame>\n"
+  "<state>MJOLNIR_STATE_SERVER_AVAILABLE</state>\n"
+  "<gputype>GeForce GTX 1080</gputype>\n"
+  "</root>\n";
+
+static const char applist_xml[] =
+  "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?>\n"
+  "<root status_code=\"200\">\n"
+  "<App><IsHdrSupported>0</IsHdrSupported><AppTitle>Steam</AppTitle><ID>1093255277</ID></App>\n"
+  "<App><IsHdrSupported>0</IsHdrSupported><AppTitle>Desktop</AppTitle><ID>1569458574</ID></App>\n"
+  "<App><IsHdrSupported>0</IsHdrSupported><AppTitle>Portal 2</AppTitle><ID>119813537</ID></App>\n"
+  "<App><IsHdrSupported>1</IsHdrSupported><AppTitle>Shadow of the Tomb Raider</AppTitle><ID>2082193437</ID></App>\n"
+  "<App><IsHdrSupported>0</IsHdrSupported><AppTitle>Rocket League</AppTitle><ID>1827406254</ID></App>\n"
+  "<App><IsHdrSupported>0</IsHdrSupported><AppTitle>Stardew Valley</AppTitle><ID>640911376</ID></App>\n"
+  "<App><IsHdrSupported>0</IsHdrSupported><AppTitle>The Witcher 3: Wild Hunt</AppTitle><ID>1311372946</ID></App>\n"
+  "<App><IsHdrSupported>1</IsHdrSupported><AppTitle>Forza Horizon 4</AppTitle><ID>354874620</ID></App>\n"
+  "<App><IsHdrSupported>0</IsHdrSupported><AppTitle>Celeste</AppTitle><ID>1756089521</ID></App>\n"
+  "<App><IsHdrSupported>0</IsHdrSupported><AppTitle>Hollow Knight</AppTitle><ID>925461373</ID></App>\n"
+  "<App><IsHdrSupported>0</IsHdrSupported><AppTitle>Dark Souls III</AppTitle><ID>1529834617</ID></App>\n"
+  "<App><IsHdrSupported>0</IsHdrSupported><AppTitle>Cuphead</AppTitle><ID>287114829</ID></App>\n"
+  "</root>\n";
+
+#define APPLIST_APPS 12
@@ -0,0 +1,238 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Times the requests the client makes before streaming, against a host
+// like moonlight-mockhost. Every run connects, pairs if needed, looks up
+// the app, launches it and quits it again. The phases are printed with
+// their median, minimum and maximum in ms and the number of failures.
+
+#include "client.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#define MAX_PHASES 16
+#define MAX_RUNS 1000
+
+struct phase {
+  const char* name;
+  int count, failures;
+  double durations[MAX_RUNS];
+  double start;
+};
+
+static struct phase phases[MAX_PHASES];
+static int numPhases;
+static int runs = 10;
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static struct phase* phase(const char* name) {
+  for (int i = 0; i < numPhases; i++) {
+    if (strcmp(phases[i].name, name) == 0)
+      return &phases[i];
+  }
+
+  if (numPhases == MAX_PHASES) {
+    fprintf(stderr, "Too many phases\n");
+    exit(1);
+  }
+
+  phases[numPhases].name = name;
+  return &phases[numPhases++];
+}
+
+static void phase_begin(const char* name) {
+  phase(name)->start = now_ms();
+}
+
+static void phase_end(const char* name) {
+  struct phase* p = phase(name);
+  if (p->count < MAX_RUNS)
+    p->durations[p->count++] = now_ms() - p->start;
+}
+
+// End a phase of the startup sequence, failures aren't part of the timings
+static bool phase_result(const char* name, int ret) {
+  if (ret == GS_OK) {
+    phase_end(name);
+    return true;
+  }
+
+  phase(name)->failures++;
+  fprintf(stderr, "%s failed: %s\n", name, gs_error != NULL ? gs_error : "unknown error");
+  return false;
+}
+
+static int compare_double(const void* a, const void* b) {
+  double x = *(const double*) a, y = *(const double*) b;
+  return x < y ? -1 : x > y;
+}
+
+static void report() {
+  printf("%-24s %10s %10s %10s %8s\n", "phase", "median", "min", "max", "failed");
+  for (int i = 0; i < numPhases; i++) {
+    struct phase* p = &phases[i];
+    if (p->count == 0) {
+      printf("%-24s %10s %10s %10s %8d\n", p->name, "-", "-", "-", p->failures);
+      continue;
+    }
+
+    qsort(p->durations, p->count, sizeof(double), compare_double);
+    printf("%-24s %10.2f %10.2f %10.2f %8d\n", p->name, p->durations[p->count / 2], p->durations[0], p->durations[p->count - 1], p->failures);
+  }
+}
+
+static int find_app(PSERVER_DATA server, const char* name, int* id) {
+  PAPP_LIST list = NULL;
+  int ret = gs_applist(server, &list);
+  *id = -1;
+  while (list != NULL) {
+    PAPP_LIST next = list->next;
+    if (*id < 0 && strcmp(list->name, name) == 0)
+      *id = list->id;
+
+    free(list->name);
+    free(list);
+    list = next;
+  }
+
+  if (ret == GS_OK && *id < 0) {
+    gs_error = "App not found";
+    ret = GS_FAILED;
+  }
+  return ret;
+}
+
+static void help() {
+  printf("Usage: moonlight-startupbench [options] <address>\n\n");
+  printf("\t-runs <count>\t\tNumber of startups to time (default 10)\n");
+  printf("\t-pin <pin>\t\tPIN the host pairs with (default 0000)\n");
+  printf("\t-app <app>\t\tName of the app to launch (default Steam)\n");
+  printf("\t-keydir <directory>\tDirectory with the client keys (default mockkeys)\n");
+  printf("\t-probe\t\t\tProbe the network like -auto\n");
+}
+
+int main(int argc, char* argv[]) {
+  static struct option long_options[] = {
+    {"runs", required_argument, NULL, 'r'},
+    {"pin", required_argument, NULL, 'p'},
+    {"app", required_argument, NULL, 'a'},
+    {"keydir", required_argument, NULL, 'k'},
+    {"probe", no_argument, NULL, 'P'},
+    {"help", no_argument, NULL, 'h'},
+    {0, 0, 0, 0},
+  };
+
+  char* pin = "0000";
+  const char* app = "Steam";
+  const char* keydir = "mockkeys";
+  bool probe = false;
+
+  int c;
+  while ((c = getopt_long_only(argc, argv, "r:p:a:k:Ph", long_options, NULL)) != -1) {
+    switch (c) {
+    case 'r':
+      runs = atoi(optarg);
+      if (runs < 1 || runs > MAX_RUNS) {
+        fprintf(stderr, "Runs must be between 1 and %d\n", MAX_RUNS);
+        return 1;
+      }
+      break;
+    case 'p':
+      pin = optarg;
+      break;
+    case 'a':
+      app = optarg;
+      break;
+    case 'k':
+      keydir = optarg;
+      break;
+    case 'P':
+      probe = true;
+      break;
+    default:
+      help();
+      return c == 'h' ? 0 : 1;
+    }
+  }
+
+  if (optind != argc - 1) {
+    help();
+    return 1;
+  }
+  char* address = argv[optind];
+
+  // The client library reports the phases of gs_init
+  gs_set_phase_callbacks(phase_begin, phase_end);
+  for (int i = 0; i < runs; i++) {
+    SERVER_DATA server;
+    double start = now_ms();
+    phase_begin("gs_init");
+    if (!phase_result("gs_init", gs_init(&server, address, keydir)))
+      continue;
+
+    if (!server.paired) {
+      phase_begin("gs_pair");
+      if (!phase_result("gs_pair", gs_pair(&server, pin)))
+        continue;
+    }
+
+    if (probe) {
+      NETWORK_PROBE result;
+      phase_begin("gs_probe_network");
+      if (!phase_result("gs_probe_network", gs_probe_network(&server, &result, 1000)))
+        continue;
+    }
+
+    int id;
+    phase_begin("gs_applist");
+    if (!phase_result("gs_applist", find_app(&server, app, &id)))
+      continue;
+
+    STREAM_CONFIGURATION config;
+    LiInitializeStreamConfiguration(&config);
+    config.width = 1280;
+    config.height = 720;
+    config.fps = 60;
+    config.audioConfiguration = AUDIO_CONFIGURATION_STEREO;
+    phase_begin("gs_start_app");
+    if (!phase_result("gs_start_app", gs_start_app(&server, &config, id, true, false)))
+      continue;
+
+    struct phase* total = phase("startup");
+    total->durations[total->count++] = now_ms() - start;
+
+    // Quit, so the next run launches the app again
+    phase_begin("gs_quit_app");
+    phase_result("gs_quit_app", gs_quit_app(&server));
+  }
+
+  report();
+  return 0;
+}
@@ -50,6 +50,14 @@
 #define CHANNEL_MASK_STEREO 0x3
 #define CHANNEL_MASK_51_SURROUND 0xFC
 
+#define PROBE_PINGS 8
+#define PROBE_DOWNLOADS 4
+// The slow start of the connections is excluded from the throughput, it
+// takes a few round trips and at least PROBE_WARMUP ms
+#define PROBE_WARMUP 250
+#define PROBE_WARMUP_RTTS 8
+#define PROBE_MEASURE 500
+
 static char unique_id[UNIQUEID_CHARS+1];
 static X509 *cert;
 static char cert_hex[4096];
@@ -57,6 +65,18 @@ static EVP_PKEY *privateKey;
 
 const char* gs_error;
 
+static GsPhaseCallback phase_begin, phase_end;
+
+static void gs_phase_begin(const char* phase) {
+  if (phase_begin != NULL)
+    phase_begin(phase);
+}
+
+static void gs_phase_end(const char* phase) {
+  if (phase_end != NULL)
+    phase_end(phase);
+}
+
 static int mkdirtree(const char* directory) {
   char buffer[1024];
   char* p = buffer;
@@ -120,7 +140,9 @@ static int load_cert(const char* keyDirectory) {
   FILE *fd = fopen(certificateFilePath, "r");
   if (fd == NULL) {
     printf("Generating certificate...");
+    gs_phase_begin("mkcert_generate");
     CERT_KEY_PAIR cert = mkcert_generate();
+    gs_phase_end("mkcert_generate");
     printf("done\n");
 
     char p12FilePath[4096];
@@ -165,115 +187,112 @@ static int load_cert(const char* keyDirectory) {
   return GS_OK;
 }
 
-static int load_server_status(PSERVER_DATA server) {
-
+enum status_node {
+  STATUS_CURRENT_GAME,
+  STATUS_PAIRED,
+  STATUS_APP_VERSION,
+  STATUS_STATE,
+  STATUS_HEIGHT,
+  STATUS_CODEC_MODE_SUPPORT,
+  STATUS_GPU_TYPE,
+  STATUS_GFE_VERSION,
+  STATUS_NODES
+};
+
+static char* status_nodes[STATUS_NODES] = {
+  "currentgame", "PairStatus", "appversion", "state", "Height", "ServerCodecModeSupport", "gputype", "GfeVersion"
+};
+
+static void status_url(char* url, const char* address, bool https) {
   uuid_t uuid;
   char uuid_str[37];
 
+  uuid_generate_random(uuid);
+  uuid_unparse(uuid, uuid_str);
+
+  sprintf(url, "%s://%s:%d/serverinfo?uniqueid=%s&uuid=%s",
+    https ? "https" : "http", address, https ? 47984 : 47989, unique_id, uuid_str);
+}
+
+static int parse_server_status(PSERVER_DATA server, PHTTP_DATA data) {
+  char* values[STATUS_NODES];
+  bool found[STATUS_NODES];
+
+  // All fields are collected in a single pass over the response
+  int ret = xml_search_nodes(data->memory, data->size, status_nodes, values, found, STATUS_NODES);
+  if (ret != GS_OK)
+    return ret;
+
+  // These fields are present on all version of GFE that this client supports
+  if (!found[STATUS_CURRENT_GAME] || !found[STATUS_PAIRED] || !found[STATUS_APP_VERSION] || !found[STATUS_STATE]) {
+    ret = GS_INVALID;
+    goto cleanup;
+  }
+
+  server->paired = strcmp(values[STATUS_PAIRED], "1") == 0;
+  server->currentGame = atoi(values[STATUS_CURRENT_GAME]);
+  server->supports4K = found[STATUS_CODEC_MODE_SUPPORT] && atoi(values[STATUS_HEIGHT]) >= 2160;
+  server->serverMajorVersion = atoi(values[STATUS_APP_VERSION]);
+  server->serverInfo.serverInfoAppVersion = values[STATUS_APP_VERSION];
+  server->serverInfo.serverInfoGfeVersion = values[STATUS_GFE_VERSION];
+  server->gpuType = values[STATUS_GPU_TYPE];
+  values[STATUS_APP_VERSION] = NULL;
+  values[STATUS_GFE_VERSION] = NULL;
+  values[STATUS_GPU_TYPE] = NULL;
+
+  if (strstr(values[STATUS_STATE], "_SERVER_AVAILABLE")) {
+    // After GFE 2.8, current game remains set even after streaming
+    // has ended. We emulate the old behavior by forcing it to zero
+    // if streaming is not active.
+    server->currentGame = 0;
+  }
+
+  cleanup:
+  for (int i = 0; i < STATUS_NODES; i++)
+    free(values[i]);
+
+  return ret;
+}
+
+static int check_server_version(PSERVER_DATA server) {
+  if (server->serverMajorVersion > MAX_SUPPORTED_GFE_VERSION) {
+    gs_error = "Ensure you're running the latest version of Moonlight Embedded or downgrade GeForce Experience and try again";
+    return GS_UNSUPPORTED_VERSION;
+  } else if (server->serverMajorVersion < MIN_SUPPORTED_GFE_VERSION) {
+    gs_error = "Moonlight Embedded requires a newer version of GeForce Experience. Please upgrade GFE on your PC and try again.";
+    return GS_UNSUPPORTED_VERSION;
+  }
+  return GS_OK;
+}
+
+static int load_server_status(PSERVER_DATA server) {
   int ret;
   char url[4096];
   int i;
 
   i = 0;
   do {
-    char *pairedText = NULL;
-    char *currentGameText = NULL;
-    char *stateText = NULL;
-    char *heightText = NULL;
-    char *serverCodecModeSupportText = NULL;
-
-    ret = GS_INVALID;
-
-    uuid_generate_random(uuid);
-    uuid_unparse(uuid, uuid_str);
-
     // Modern GFE versions don't allow serverinfo to be fetched over HTTPS if the client
     // is not already paired. Since we can't pair without knowing the server version, we
     // make another request over HTTP if the HTTPS request fails. We can't just use HTTP
     // for everything because it doesn't accurately tell us if we're paired.
-    sprintf(url, "%s://%s:%d/serverinfo?uniqueid=%s&uuid=%s",
-      i == 0 ? "https" : "http", server->serverInfo.address, i == 0 ? 47984 : 47989, unique_id, uuid_str);
+    status_url(url, server->serverInfo.address, i == 0);
 
     PHTTP_DATA data = http_create_data();
-    if (data == NULL) {
-      ret = GS_OUT_OF_MEMORY;
-      goto cleanup;
-    }
-    if (http_request(url, data) != GS_OK) {
-      ret = GS_IO_ERROR;
-      goto cleanup;
-    }
-
-    if (xml_search(data->memory, data->size, "currentgame", &currentGameText) != GS_OK) {
-      goto cleanup;
-    }
-
-    if (xml_search(data->memory, data->size, "PairStatus", &pairedText) != GS_OK)
-      goto cleanup;
-
-    if (xml_search(data->memory, data->size, "appversion", (char**) &server->serverInfo.serverInfoAppVersion) != GS_OK)
-      goto cleanup;
-
-    if (xml_search(data->memory, data->size, "state", &stateText) != GS_OK)
-      goto cleanup;
-
-    if (xml_search(data->memory, data->size, "Height", &heightText) != GS_OK)
-      goto cleanup;
+    if (data == NULL)
+      return GS_OUT_OF_MEMORY;
 
-    if (xml_search(data->memory, data->size, "ServerCodecModeSupport", &serverCodecModeSupportText) != GS_OK)
-      goto cleanup;
-
-    if (xml_search(data->memory, data->size, "gputype", &server->gpuType) != GS_OK)
-      goto cleanup;
-
-    if (xml_search(data->memory, data->size, "GfeVersion", (char**) &server->serverInfo.serverInfoGfeVersion) != GS_OK)
-      goto cleanup;
-
-    // These fields are present on all version of GFE that this client supports
-    if (!strlen(currentGameText) || !strlen(pairedText) || !strlen(server->serverInfo.serverInfoAppVersion) || !strlen(stateText))
-      goto cleanup;
-
-    server->paired = pairedText != NULL && strcmp(pairedText, "1") == 0;
-    server->currentGame = currentGameText == NULL ? 0 : atoi(currentGameText);
-    server->supports4K = heightText != NULL && serverCodecModeSupportText != NULL && atoi(heightText) >= 2160;
-    server->serverMajorVersion = atoi(server->serverInfo.serverInfoAppVersion);
-
-    if (strstr(stateText, "_SERVER_AVAILABLE")) {
-      // After GFE 2.8, current game remains set even after streaming
-      // has ended. We emulate the old behavior by forcing it to zero
-      // if streaming is not active.
-      server->currentGame = 0;
-    }
-    ret = GS_OK;
-
-    cleanup:
-    if (data != NULL)
-      http_free_data(data);
-
-    if (pairedText != NULL)
-      free(pairedText);
-
-    if (currentGameText != NULL)
-      free(currentGameText);
-
-    if (heightText != NULL)
-      free(heightText);
-
-    if (serverCodecModeSupportText != NULL)
-      free(serverCodecModeSupportText);
+    if (http_request(url, data) != GS_OK)
+      ret = GS_IO_ERROR;
+    else
+      ret = parse_server_status(server, data);
 
+    http_free_data(data);
     i++;
-  } while (ret != GS_OK && i < 2);
-
-  if (ret == GS_OK) {
-    if (server->serverMajorVersion > MAX_SUPPORTED_GFE_VERSION) {
-      gs_error = "Ensure you're running the latest version of Moonlight Embedded or downgrade GeForce Experience and try again";
-      ret = GS_UNSUPPORTED_VERSION;
-    } else if (server->serverMajorVersion < MIN_SUPPORTED_GFE_VERSION) {
-      gs_error = "Moonlight Embedded requires a newer version of GeForce Experience. Please upgrade GFE on your PC and try again.";
-      ret = GS_UNSUPPORTED_VERSION;
-    }
-  }
+  } while (ret != GS_OK && ret != GS_OUT_OF_MEMORY && i < 2);
+
+  if (ret == GS_OK)
+    ret = check_server_version(server);
 
   return ret;
 }
@@ -714,17 +733,191 @@ int gs_quit_app(PSERVER_DATA server) {
   return ret;
 }
 
-int gs_init(PSERVER_DATA server, char *address, const char *keyDirectory) {
+void gs_set_phase_callbacks(GsPhaseCallback begin, GsPhaseCallback end) {
+  phase_begin = begin;
+  phase_end = end;
+}
+
+static int init_client(const char *keyDirectory) {
   mkdirtree(keyDirectory);
   if (load_unique_id(keyDirectory) != GS_OK)
     return GS_FAILED;
 
-  if (load_cert(keyDirectory))
+  gs_phase_begin("load_cert");
+  int ret = load_cert(keyDirectory);
+  gs_phase_end("load_cert");
+  if (ret)
     return GS_FAILED;
 
   http_init(keyDirectory);
+  return GS_OK;
+}
+
+int gs_init(PSERVER_DATA server, char *address, const char *keyDirectory) {
+  if (init_client(keyDirectory) != GS_OK)
+    return GS_FAILED;
 
   LiInitializeServerInformation(&server->serverInfo);
   server->serverInfo.address = address;
-  return load_server_status(server);
+
+  gs_phase_begin("load_server_status");
+  int ret = load_server_status(server);
+  gs_phase_end("load_server_status");
+  return ret;
+}
+
+int gs_poll_servers(char** addresses, PSERVER_POLL servers, int count, const char *keyDirectory, long timeout) {
+  if (init_client(keyDirectory) != GS_OK)
+    return GS_FAILED;
+
+  // Request serverinfo over HTTPS and HTTP at the same time,
+  // only unpaired servers need the HTTP response
+  int requests = count * 2;
+  char** urls = calloc(requests, sizeof(char*));
+  PHTTP_DATA* data = calloc(requests, sizeof(PHTTP_DATA));
+  int* results = calloc(requests, sizeof(int));
+  PHTTP_TIMES times = calloc(requests, sizeof(HTTP_TIMES));
+  int ret = GS_OK;
+  if (urls == NULL || data == NULL || results == NULL || times == NULL) {
+    ret = GS_OUT_OF_MEMORY;
+    goto cleanup;
+  }
+
+  for (int i = 0; i < requests; i++) {
+    urls[i] = malloc(4096);
+    data[i] = http_create_data();
+    if (urls[i] == NULL || data[i] == NULL) {
+      ret = GS_OUT_OF_MEMORY;
+      goto cleanup;
+    }
+    status_url(urls[i], addresses[i % count], i < count);
+  }
+
+  if ((ret = http_request_multi(urls, data, results, times, requests, timeout)) != GS_OK)
+    goto cleanup;
+
+  for (int i = 0; i < count; i++) {
+    PSERVER_DATA server = &servers[i].server;
+    memset(server, 0, sizeof(SERVER_DATA));
+    LiInitializeServerInformation(&server->serverInfo);
+    server->address = addresses[i];
+    server->serverInfo.address = addresses[i];
+
+    servers[i].status = GS_IO_ERROR;
+    servers[i].latency = -1;
+    for (int j = i; j < requests; j += count) {
+      if (results[j] == GS_OK && (servers[i].status = parse_server_status(server, data[j])) == GS_OK) {
+        servers[i].status = check_server_version(server);
+        servers[i].latency = times[j].total / 1000;
+        break;
+      }
+    }
+  }
+
+  cleanup:
+  for (int i = 0; i < requests; i++) {
+    if (urls != NULL)
+      free(urls[i]);
+    if (data != NULL)
+      http_free_data(data[i]);
+  }
+  free(urls);
+  free(data);
+  free(results);
+  free(times);
+
+  return ret;
+}
+
+static int compare_long(const void* a, const void* b) {
+  long diff = *(const long*) a - *(const long*) b;
+  return diff < 0 ? -1 : diff > 0;
+}
+
+// Measure the path to the server before streaming. Every serverinfo request
+// opens a new connection, so the time to connect is a single round trip.
+// Throughput is measured by downloading the box art of a few apps at once
+// over and over, once the connections are past their slow start.
+int gs_probe_network(PSERVER_DATA server, PNETWORK_PROBE probe, long timeout) {
+  char* urls[PROBE_DOWNLOADS] = {0};
+  PHTTP_DATA data[PROBE_DOWNLOADS] = {0};
+  int results[PROBE_DOWNLOADS];
+  HTTP_TIMES times[PROBE_DOWNLOADS];
+  PAPP_LIST list = NULL;
+  int ret = GS_OK;
+
+  probe->rtt = -1;
+  probe->jitter = -1;
+  probe->throughput = 0;
+
+  for (int i = 0; i < PROBE_DOWNLOADS; i++) {
+    urls[i] = malloc(4096);
+    data[i] = http_create_data();
+    if (urls[i] == NULL || data[i] == NULL) {
+      ret = GS_OUT_OF_MEMORY;
+      goto cleanup;
+    }
+  }
+
+  long rtts[PROBE_PINGS];
+  int pings = 0;
+  for (int i = 0; i < PROBE_PINGS; i++) {
+    status_url(urls[0], server->serverInfo.address, false);
+    if (http_request_multi(urls, data, results, times, 1, timeout) == GS_OK && results[0] == GS_OK && times[0].connect >= 0)
+      rtts[pings++] = times[0].connect;
+  }
+
+  if (pings == 0) {
+    ret = GS_IO_ERROR;
+    goto cleanup;
+  }
+
+  long deviation = 0;
+  for (int i = 1; i < pings; i++)
+    deviation += labs(rtts[i] - rtts[i - 1]);
+
+  probe->jitter = pings > 1 ? deviation / (pings - 1) : 0;
+  qsort(rtts, pings, sizeof(long), compare_long);
+  probe->rtt = rtts[pings / 2];
+
+  if (gs_applist(server, &list) != GS_OK || list == NULL)
+    goto cleanup;
+
+  PAPP_LIST app = list;
+  for (int i = 0; i < PROBE_DOWNLOADS; i++) {
+    uuid_t uuid;
+    char uuid_str[37];
+    uuid_generate_random(uuid);
+    uuid_unparse(uuid, uuid_str);
+    sprintf(urls[i], "https://%s:47984/appasset?uniqueid=%s&uuid=%s&appid=%d&AssetType=2&AssetIdx=0", server->serverInfo.address, unique_id, uuid_str, app->id);
+    app = app->next != NULL ? app->next : list;
+  }
+
+  long warmup = probe->rtt * PROBE_WARMUP_RTTS / 1000;
+  if (warmup < PROBE_WARMUP)
+    warmup = PROBE_WARMUP;
+
+  long duration = warmup + PROBE_MEASURE;
+  if (duration > timeout) {
+    duration = timeout;
+    warmup = duration / 2;
+  }
+
+  ret = http_throughput(urls, PROBE_DOWNLOADS, warmup, duration, &probe->throughput);
+
+  cleanup:
+  while (list != NULL) {
+    PAPP_LIST next = list->next;
+    free(list->name);
+    free(list);
+    list = next;
+  }
+
+  for (int i = 0; i < PROBE_DOWNLOADS; i++) {
+    free(urls[i]);
+    if (data[i] != NULL)
+      http_free_data(data[i]);
+  }
+
+  return ret;
 }
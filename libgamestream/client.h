@@ -38,7 +38,25 @@ typedef struct _SERVER_DATA {
   SERVER_INFORMATION serverInfo;
 } SERVER_DATA, *PSERVER_DATA;
 
+typedef struct _SERVER_POLL {
+  SERVER_DATA server;
+  int status;
+  long latency;
+} SERVER_POLL, *PSERVER_POLL;
+
+typedef struct _NETWORK_PROBE {
+  long rtt; // Median round trip time in microseconds
+  long jitter; // Mean difference between consecutive round trip times in microseconds
+  int throughput; // Usable throughput in kbps, 0 if it couldn't be measured
+} NETWORK_PROBE, *PNETWORK_PROBE;
+
+typedef void(*GsPhaseCallback)(const char* phase);
+
+void gs_set_phase_callbacks(GsPhaseCallback begin, GsPhaseCallback end);
+
 int gs_init(PSERVER_DATA server, char* address, const char *keyDirectory);
+int gs_poll_servers(char** addresses, PSERVER_POLL servers, int count, const char *keyDirectory, long timeout);
+int gs_probe_network(PSERVER_DATA server, PNETWORK_PROBE probe, long timeout);
 int gs_start_app(PSERVER_DATA server, PSTREAM_CONFIGURATION config, int appId, bool sops, bool localaudio);
 int gs_applist(PSERVER_DATA server, PAPP_LIST *app_list);
 int gs_unpair(PSERVER_DATA server);
@@ -0,0 +1,246 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "clip.h"
+#include "nal.h"
+
+#include "bs.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NAL unit headers including the reference priority
+#define NAL_HEADER_SLICE 0x41
+#define NAL_HEADER_IDR_SLICE 0x65
+#define NAL_HEADER_SPS 0x67
+#define NAL_HEADER_PPS 0x68
+
+// Constrained baseline at level 5.1, enough for 4K
+#define PROFILE_BASELINE 66
+#define CONSTRAINT_SET1 0x40
+#define LEVEL 51
+
+#define LOG2_MAX_FRAME_NUM 4
+#define SLICE_TYPE_P 5
+#define SLICE_TYPE_I 7
+// High enough for the deblocking filter to do its work
+#define SLICE_QP 30
+
+// Intra 16x16 with DC prediction and no coded residual
+#define MB_TYPE_I_16X16_DC 3
+#define MB_TYPE_P_L0_16X16 0
+
+// Motion vectors range in quarter pixels, which makes most of them
+// require interpolation and differ enough between neighbours to filter
+#define MAX_MOTION 8
+
+static const char start_code[] = { 0x00, 0x00, 0x00, 0x01 };
+
+// Terminates the RBSP and appends it as NAL unit to the buffer, returns
+// the new length of the buffer or -1 if it is too small
+static int clip_append(bs_t* b, char* buffer, int size, int length) {
+  bs_write_u1(b, 1);
+  while (!bs_byte_aligned(b))
+    bs_write_u1(b, 0);
+
+  if (length < 0 || b->p > b->end || size - length < (int) sizeof(start_code))
+    return -1;
+
+  memcpy(buffer + length, start_code, sizeof(start_code));
+  length += sizeof(start_code);
+  int ret = gs_nal_escape((char*) b->start, bs_pos(b), buffer + length, size - length);
+  return ret < 0 ? -1 : length + ret;
+}
+
+static void clip_sps(bs_t* b, int width, int height) {
+  int mbWidth = (width + 15) / 16;
+  int mbHeight = (height + 15) / 16;
+  bool cropping = mbWidth * 16 != width || mbHeight * 16 != height;
+
+  bs_write_u8(b, NAL_HEADER_SPS);
+  bs_write_u8(b, PROFILE_BASELINE);
+  bs_write_u8(b, CONSTRAINT_SET1);
+  bs_write_u8(b, LEVEL);
+  bs_write_ue(b, 0); // seq_parameter_set_id
+  bs_write_ue(b, LOG2_MAX_FRAME_NUM - 4);
+  bs_write_ue(b, 2); // pic_order_cnt_type, output order is decoding order
+  bs_write_ue(b, 1); // max_num_ref_frames
+  bs_write_u1(b, 0); // gaps_in_frame_num_value_allowed_flag
+  bs_write_ue(b, mbWidth - 1);
+  bs_write_ue(b, mbHeight - 1);
+  bs_write_u1(b, 1); // frame_mbs_only_flag
+  bs_write_u1(b, 1); // direct_8x8_inference_flag
+  bs_write_u1(b, cropping);
+  if (cropping) {
+    // Offsets in chroma samples
+    bs_write_ue(b, 0);
+    bs_write_ue(b, (mbWidth * 16 - width) / 2);
+    bs_write_ue(b, 0);
+    bs_write_ue(b, (mbHeight * 16 - height) / 2);
+  }
+  bs_write_u1(b, 0); // vui_parameters_present_flag
+}
+
+static void clip_pps(bs_t* b) {
+  bs_write_u8(b, NAL_HEADER_PPS);
+  bs_write_ue(b, 0); // pic_parameter_set_id
+  bs_write_ue(b, 0); // seq_parameter_set_id
+  bs_write_u1(b, 0); // entropy_coding_mode_flag
+  bs_write_u1(b, 0); // bottom_field_pic_order_in_frame_present_flag
+  bs_write_ue(b, 0); // num_slice_groups_minus1
+  bs_write_ue(b, 0); // num_ref_idx_l0_default_active_minus1
+  bs_write_ue(b, 0); // num_ref_idx_l1_default_active_minus1
+  bs_write_u1(b, 0); // weighted_pred_flag
+  bs_write_u(b, 2, 0); // weighted_bipred_idc
+  bs_write_se(b, 0); // pic_init_qp_minus26
+  bs_write_se(b, 0); // pic_init_qs_minus26
+  bs_write_se(b, 0); // chroma_qp_index_offset
+  bs_write_u1(b, 1); // deblocking_filter_control_present_flag
+  bs_write_u1(b, 0); // constrained_intra_pred_flag
+  bs_write_u1(b, 0); // redundant_pic_cnt_present_flag
+}
+
+static void clip_slice_header(bs_t* b, bool idr, int frameNum, int firstMb) {
+  bs_write_u8(b, idr ? NAL_HEADER_IDR_SLICE : NAL_HEADER_SLICE);
+  bs_write_ue(b, firstMb);
+  bs_write_ue(b, idr ? SLICE_TYPE_I : SLICE_TYPE_P);
+  bs_write_ue(b, 0); // pic_parameter_set_id
+  bs_write_u(b, LOG2_MAX_FRAME_NUM, frameNum);
+  if (idr) {
+    bs_write_ue(b, 0); // idr_pic_id
+    bs_write_u1(b, 0); // no_output_of_prior_pics_flag
+    bs_write_u1(b, 0); // long_term_reference_flag
+  } else {
+    bs_write_u1(b, 0); // num_ref_idx_active_override_flag
+    bs_write_u1(b, 0); // ref_pic_list_modification_flag_l0
+    bs_write_u1(b, 0); // adaptive_ref_pic_marking_mode_flag
+  }
+  bs_write_se(b, SLICE_QP - 26);
+  bs_write_ue(b, 0); // disable_deblocking_filter_idc
+  bs_write_se(b, 0); // slice_alpha_c0_offset_div2
+  bs_write_se(b, 0); // slice_beta_offset_div2
+}
+
+static int clip_median(int a, int b, int c) {
+  int min = a < b ? (a < c ? a : c) : (b < c ? b : c);
+  int max = a > b ? (a > c ? a : c) : (b > c ? b : c);
+  return a + b + c - min - max;
+}
+
+// Motion vector prediction for a 16x16 partition, macroblocks above the
+// first row of the slice are unavailable
+static void clip_predict(short (*mvs)[2], int mbWidth, int x, int y, int firstRow, int prediction[2]) {
+  short* neighbours[3] = {
+    x > 0 ? mvs[y * mbWidth + x - 1] : NULL,
+    y > firstRow ? mvs[(y - 1) * mbWidth + x] : NULL,
+    y > firstRow && x + 1 < mbWidth ? mvs[(y - 1) * mbWidth + x + 1] : NULL,
+  };
+  if (neighbours[2] == NULL && y > firstRow && x > 0)
+    neighbours[2] = mvs[(y - 1) * mbWidth + x - 1];
+
+  if (neighbours[1] == NULL && neighbours[2] == NULL && neighbours[0] != NULL)
+    neighbours[1] = neighbours[2] = neighbours[0];
+
+  int available = 0, last = 0;
+  for (int i = 0; i < 3; i++) {
+    if (neighbours[i] != NULL) {
+      available++;
+      last = i;
+    }
+  }
+
+  for (int i = 0; i < 2; i++) {
+    if (available == 1)
+      prediction[i] = neighbours[last][i];
+    else {
+      int v[3];
+      for (int j = 0; j < 3; j++)
+        v[j] = neighbours[j] != NULL ? neighbours[j][i] : 0;
+
+      prediction[i] = clip_median(v[0], v[1], v[2]);
+    }
+  }
+}
+
+static void clip_slice(bs_t* b, int index, int mbWidth, int firstRow, int lastRow, short (*mvs)[2]) {
+  clip_slice_header(b, index == 0, index % (1 << LOG2_MAX_FRAME_NUM), firstRow * mbWidth);
+
+  unsigned int seed = index * 7919 + firstRow;
+  for (int y = firstRow; y < lastRow; y++) {
+    for (int x = 0; x < mbWidth; x++) {
+      if (index == 0) {
+        bs_write_ue(b, MB_TYPE_I_16X16_DC);
+        bs_write_ue(b, 0); // intra_chroma_pred_mode DC
+        bs_write_se(b, 0); // mb_qp_delta
+        bs_write_u1(b, 1); // coeff_token of the empty luma DC block
+        continue;
+      }
+
+      short* mv = mvs[y * mbWidth + x];
+      int prediction[2];
+      clip_predict(mvs, mbWidth, x, y, firstRow, prediction);
+      for (int i = 0; i < 2; i++) {
+        seed = seed * 1103515245 + 12345;
+        mv[i] = (int) ((seed >> 16) % (2 * MAX_MOTION + 1)) - MAX_MOTION;
+      }
+
+      bs_write_ue(b, 0); // mb_skip_run
+      bs_write_ue(b, MB_TYPE_P_L0_16X16);
+      bs_write_se(b, mv[0] - prediction[0]);
+      bs_write_se(b, mv[1] - prediction[1]);
+      bs_write_ue(b, 0); // coded_block_pattern without residual
+    }
+  }
+}
+
+int gs_clip_frame(int index, int width, int height, int slices, char* buffer, int size) {
+  int mbWidth = (width + 15) / 16;
+  int mbHeight = (height + 15) / 16;
+  if (slices < 1)
+    slices = 1;
+  else if (slices > mbHeight)
+    slices = mbHeight;
+
+  uint8_t* rbsp = malloc(size);
+  short (*mvs)[2] = calloc(mbWidth * mbHeight, sizeof(*mvs));
+  if (rbsp == NULL || mvs == NULL) {
+    free(rbsp);
+    free(mvs);
+    return -1;
+  }
+
+  int length = 0;
+  bs_t b;
+  if (index == 0) {
+    clip_sps(bs_init(&b, rbsp, size), width, height);
+    length = clip_append(&b, buffer, size, length);
+    clip_pps(bs_init(&b, rbsp, size));
+    length = clip_append(&b, buffer, size, length);
+  }
+
+  for (int i = 0; i < slices; i++) {
+    clip_slice(bs_init(&b, rbsp, size), index, mbWidth, i * mbHeight / slices, (i + 1) * mbHeight / slices, mvs);
+    length = clip_append(&b, buffer, size, length);
+  }
+
+  free(rbsp);
+  free(mvs);
+  return length;
+}
@@ -0,0 +1,26 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Writes a frame of a synthetic H.264 reference clip in Annex B format. The
+// first frame is an IDR frame preceded by the parameter sets, all following
+// frames are P frames with motion on every macroblock. Returns the length of
+// the frame or -1 if the buffer is too small.
+int gs_clip_frame(int index, int width, int height, int slices, char* buffer, int size);
@@ -17,6 +17,7 @@
  * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "discover.h"
 #include "errors.h"
 
 #include <avahi-client/client.h>
@@ -25,84 +26,234 @@
 #include <avahi-common/simple-watch.h>
 #include <avahi-common/malloc.h>
 #include <avahi-common/error.h>
+#include <avahi-common/timeval.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-static AvahiSimplePoll *simple_poll = NULL;
+#define DEFAULT_DISCOVER_TIMEOUT 5000
+
+struct discovery {
+  AvahiSimplePoll *simple_poll;
+  PHOST_LIST hosts;
+  int pending;
+  bool all_for_now;
+  bool first_only;
+  const char* error;
+};
+
+static void discovery_check_done(struct discovery *discovery) {
+  if ((discovery->first_only && discovery->hosts != NULL) || (discovery->all_for_now && discovery->pending == 0))
+    avahi_simple_poll_quit(discovery->simple_poll);
+}
 
 static void client_callback(AvahiClient *c, AvahiClientState state, void *userdata) {
+  struct discovery *discovery = userdata;
   if (state == AVAHI_CLIENT_FAILURE) {
-    gs_error = "Server connection failure";
-    avahi_simple_poll_quit(simple_poll);
+    discovery->error = "Server connection failure";
+    avahi_simple_poll_quit(discovery->simple_poll);
   }
 }
 
+static void timeout_callback(AvahiTimeout *timeout, void *userdata) {
+  struct discovery *discovery = userdata;
+  avahi_simple_poll_quit(discovery->simple_poll);
+}
+
 static void resolve_callback(AvahiServiceResolver *r, AvahiIfIndex interface, AvahiProtocol protocol, AvahiResolverEvent event, const char *name, const char *type, const char *domain, const char *host_name, const AvahiAddress *address, uint16_t port, AvahiStringList *txt, AvahiLookupResultFlags flags, void *userdata) {
+  struct discovery *discovery = userdata;
   if (event == AVAHI_RESOLVER_FOUND) {
-    if (userdata != NULL) {
-      avahi_address_snprint(userdata, AVAHI_ADDRESS_STR_MAX, address);
-      avahi_simple_poll_quit(simple_poll);
-    } else {
-      char strAddress[AVAHI_ADDRESS_STR_MAX];
-      avahi_address_snprint(strAddress, sizeof(strAddress), address);
-      printf(" %s (%s)\n", host_name, strAddress);
+    char strAddress[AVAHI_ADDRESS_STR_MAX];
+    avahi_address_snprint(strAddress, sizeof(strAddress), address);
+
+    // The same host is announced on every interface and protocol
+    PHOST_LIST host = discovery->hosts;
+    while (host != NULL && strcmp(host->address, strAddress) != 0)
+      host = host->next;
+
+    if (host == NULL && (host = malloc(sizeof(HOST_LIST))) != NULL) {
+      host->name = strdup(host_name);
+      strncpy(host->address, strAddress, MAX_ADDRESS_SIZE - 1);
+      host->address[MAX_ADDRESS_SIZE - 1] = 0;
+      host->next = discovery->hosts;
+      discovery->hosts = host;
     }
   }
 
   avahi_service_resolver_free(r);
+  discovery->pending--;
+  discovery_check_done(discovery);
 }
 
 static void browse_callback(AvahiServiceBrowser *b, AvahiIfIndex interface, AvahiProtocol protocol, AvahiBrowserEvent event, const char *name, const char *type, const char *domain, AvahiLookupResultFlags flags, void* userdata) {
+  struct discovery *discovery = userdata;
   AvahiClient *c = avahi_service_browser_get_client(b);
 
   switch (event) {
   case AVAHI_BROWSER_FAILURE:
-    gs_error = "Server browser failure";
-    avahi_simple_poll_quit(simple_poll);
+    discovery->error = "Server browser failure";
+    avahi_simple_poll_quit(discovery->simple_poll);
     break;
   case AVAHI_BROWSER_NEW:
-    if (!(avahi_service_resolver_new(c, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC, 0, resolve_callback, userdata)))
-      gs_error = "Failed to resolve service";
+    // Resolvers run concurrently on the same poll loop
+    if (avahi_service_resolver_new(c, interface, protocol, name, type, domain, AVAHI_PROTO_UNSPEC, 0, resolve_callback, discovery))
+      discovery->pending++;
+    else
+      discovery->error = "Failed to resolve service";
 
     break;
+  case AVAHI_BROWSER_ALL_FOR_NOW:
+    discovery->all_for_now = true;
+    discovery_check_done(discovery);
+    break;
   case AVAHI_BROWSER_REMOVE:
+  case AVAHI_BROWSER_CACHE_EXHAUSTED:
     break;
   }
 }
 
-void gs_discover_server(char* dest) {
+static int discover(struct discovery *discovery, int timeout) {
   AvahiClient *client = NULL;
   AvahiServiceBrowser *sb = NULL;
+  AvahiTimeout *poll_timeout = NULL;
+  const AvahiPoll *poll_api = NULL;
+  int ret = GS_FAILED;
 
-  if (!(simple_poll = avahi_simple_poll_new())) {
-    gs_error = "Failed to create simple poll object";
+  if (!(discovery->simple_poll = avahi_simple_poll_new())) {
+    discovery->error = "Failed to create simple poll object";
     goto cleanup;
   }
 
   int error;
-  client = avahi_client_new(avahi_simple_poll_get(simple_poll), 0, client_callback, NULL, &error);
+  client = avahi_client_new(avahi_simple_poll_get(discovery->simple_poll), 0, client_callback, discovery, &error);
   if (!client) {
-    gs_error = "Failed to create client";
+    discovery->error = "Failed to create client";
     goto cleanup;
   }
 
-  if (!(sb = avahi_service_browser_new(client, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, "_nvstream._tcp", NULL, 0, browse_callback, dest))) {
-    gs_error = "Failed to create service browser";
+  if (!(sb = avahi_service_browser_new(client, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, "_nvstream._tcp", NULL, 0, browse_callback, discovery))) {
+    discovery->error = "Failed to create service browser";
     goto cleanup;
   }
 
-  avahi_simple_poll_loop(simple_poll);
+  poll_api = avahi_simple_poll_get(discovery->simple_poll);
+  struct timeval tv;
+  poll_timeout = poll_api->timeout_new(poll_api, avahi_elapse_time(&tv, timeout, 0), timeout_callback, discovery);
+
+  avahi_simple_poll_loop(discovery->simple_poll);
+
+  if (discovery->hosts != NULL)
+    ret = GS_OK;
+  else
+    discovery->error = "No host found";
 
   cleanup:
+  if (poll_timeout)
+    poll_api->timeout_free(poll_timeout);
+
   if (sb)
     avahi_service_browser_free(sb);
 
   if (client)
     avahi_client_free(client);
 
-  if (simple_poll)
-    avahi_simple_poll_free(simple_poll);
+  if (discovery->simple_poll)
+    avahi_simple_poll_free(discovery->simple_poll);
+
+  return ret;
+}
+
+void gs_discover_server(char* dest) {
+  struct discovery discovery = {0};
+  discovery.first_only = true;
+
+  if (discover(&discovery, DEFAULT_DISCOVER_TIMEOUT) == GS_OK)
+    strcpy(dest, discovery.hosts->address);
+  else
+    gs_error = discovery.error;
+
+  gs_discover_free(discovery.hosts);
+}
+
+int gs_discover_hosts(PHOST_LIST *hosts, int timeout) {
+  const char* error;
+  int ret = gs_discover_hosts_r(hosts, timeout, &error);
+  if (ret != GS_OK)
+    gs_error = error;
+
+  return ret;
+}
+
+int gs_discover_hosts_r(PHOST_LIST *hosts, int timeout, const char** error) {
+  struct discovery discovery = {0};
+
+  int ret = discover(&discovery, timeout);
+  *hosts = discovery.hosts;
+  *error = discovery.error;
+  return ret;
+}
+
+void gs_discover_free(PHOST_LIST hosts) {
+  while (hosts != NULL) {
+    PHOST_LIST next = hosts->next;
+    free(hosts->name);
+    free(hosts);
+    hosts = next;
+  }
+}
+
+int gs_discover_load_cache(const char* fileName, PHOST_LIST *hosts) {
+  *hosts = NULL;
+  FILE* fd = fopen(fileName, "r");
+  if (fd == NULL)
+    return GS_FAILED;
+
+  // Keep the order of the file, the first host is the last one used
+  PHOST_LIST *last = hosts;
+  char *line = NULL;
+  size_t len = 0;
+  while (getline(&line, &len, fd) != -1) {
+    char *address = NULL, *name = NULL;
+    if (sscanf(line, "%ms = %m[^\n]", &address, &name) == 2 && strlen(address) < MAX_ADDRESS_SIZE) {
+      PHOST_LIST host = malloc(sizeof(HOST_LIST));
+      if (host != NULL) {
+        strcpy(host->address, address);
+        host->name = name;
+        host->next = NULL;
+        *last = host;
+        last = &host->next;
+        name = NULL;
+      }
+    }
+    free(address);
+    free(name);
+  }
+  free(line);
+  fclose(fd);
+
+  return *hosts != NULL ? GS_OK : GS_FAILED;
+}
+
+int gs_discover_save_cache(const char* fileName, PHOST_LIST hosts) {
+  // Replace the cache at once, so it is never read half written
+  char tmpFileName[4096];
+  if (snprintf(tmpFileName, sizeof(tmpFileName), "%s.tmp", fileName) >= sizeof(tmpFileName))
+    return GS_FAILED;
+
+  FILE* fd = fopen(tmpFileName, "w");
+  if (fd == NULL)
+    return GS_FAILED;
+
+  for (; hosts != NULL; hosts = hosts->next)
+    fprintf(fd, "%s = %s\n", hosts->address, hosts->name != NULL ? hosts->name : hosts->address);
+
+  if (fclose(fd) != 0 || rename(tmpFileName, fileName) != 0) {
+    unlink(tmpFileName);
+    return GS_FAILED;
+  }
+  return GS_OK;
 }
@@ -21,4 +21,16 @@
 
 #define MAX_ADDRESS_SIZE 40
 
+typedef struct _HOST_LIST {
+  char* name;
+  char address[MAX_ADDRESS_SIZE];
+  struct _HOST_LIST *next;
+} HOST_LIST, *PHOST_LIST;
+
 void gs_discover_server(char* dest);
+int gs_discover_hosts(PHOST_LIST *hosts, int timeout);
+int gs_discover_hosts_r(PHOST_LIST *hosts, int timeout, const char** error);
+void gs_discover_free(PHOST_LIST hosts);
+
+int gs_discover_load_cache(const char* fileName, PHOST_LIST *hosts);
+int gs_discover_save_cache(const char* fileName, PHOST_LIST hosts);
@@ -0,0 +1,149 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frame.h"
+
+#include "bs.h"
+
+#define FRAME_INFO_SLOTS 8
+#define SLICE_HEADER_SIZE 16
+
+#define H264_NAL_UNIT_TYPE_SLICE 1
+#define H264_NAL_UNIT_TYPE_IDR 5
+#define H264_NAL_UNIT_TYPE_SPS 7
+#define H264_NAL_UNIT_TYPE_PPS 8
+
+#define HEVC_NAL_UNIT_TYPE_RSV_VCL_N14 14
+#define HEVC_NAL_UNIT_TYPE_BLA_W_LP 16
+#define HEVC_NAL_UNIT_TYPE_CRA 21
+#define HEVC_NAL_UNIT_TYPE_VPS 32
+#define HEVC_NAL_UNIT_TYPE_PPS 34
+
+// Classification is kept for the last few decode units, so backends
+// queueing a couple of units can still look them up
+static FRAME_INFO frames[FRAME_INFO_SLOTS];
+static int nextFrame;
+
+static DECODER_RENDERER_CALLBACKS classifier_callbacks;
+static PDECODER_RENDERER_CALLBACKS classifier_target;
+static bool classifier_hevc;
+
+static void read_slice_header(PFRAME_INFO info, PNAL_UNIT unit, bool hevc) {
+  const enum slice_type slice_types[] = { SLICE_P, SLICE_B, SLICE_I, SLICE_P, SLICE_I };
+  uint8_t rbsp[SLICE_HEADER_SIZE];
+
+  // Only the first fields of the slice header are needed
+  int length = gs_nal_unescape(unit->entry->data + unit->offset, unit->length < SLICE_HEADER_SIZE ? unit->length : SLICE_HEADER_SIZE, (char*) rbsp);
+
+  bs_t b;
+  bs_init(&b, rbsp, length);
+  if (hevc) {
+    bs_skip_u(&b, 16);
+    info->firstSlice = bs_read_u1(&b);
+  } else {
+    bs_skip_u(&b, 8);
+    info->firstSlice = bs_read_ue(&b) == 0;
+    unsigned int slice_type = bs_read_ue(&b);
+    info->sliceType = slice_type < 10 ? slice_types[slice_type % 5] : SLICE_UNKNOWN;
+  }
+}
+
+static enum frame_type classify_nal(PNAL_UNIT unit, bool hevc) {
+  if (hevc) {
+    if (unit->type >= HEVC_NAL_UNIT_TYPE_BLA_W_LP && unit->type <= HEVC_NAL_UNIT_TYPE_CRA)
+      return FRAME_IDR;
+    else if (unit->type <= HEVC_NAL_UNIT_TYPE_RSV_VCL_N14)
+      // Even types are sub-layer non-reference pictures
+      return unit->type % 2 == 0 ? FRAME_DROPPABLE : FRAME_REFERENCE;
+  } else {
+    if (unit->type == H264_NAL_UNIT_TYPE_IDR)
+      return FRAME_IDR;
+    else if (unit->type == H264_NAL_UNIT_TYPE_SLICE)
+      return (unit->entry->data[unit->offset] & 0x60) != 0 ? FRAME_REFERENCE : FRAME_DROPPABLE;
+  }
+
+  return FRAME_UNKNOWN;
+}
+
+PFRAME_INFO gs_frame_classify(PDECODE_UNIT decodeUnit, bool hevc) {
+  PFRAME_INFO info = &frames[nextFrame];
+  nextFrame = (nextFrame + 1) % FRAME_INFO_SLOTS;
+
+  info->decodeUnit = decodeUnit;
+  info->type = FRAME_UNKNOWN;
+  info->sliceType = SLICE_UNKNOWN;
+  info->firstSlice = false;
+  info->parameterSets = false;
+
+  gs_nal_index(decodeUnit, &info->index, hevc);
+  for (int i = 0; i < info->index.count; i++) {
+    PNAL_UNIT unit = &info->index.units[i];
+    if (hevc ? unit->type >= HEVC_NAL_UNIT_TYPE_VPS && unit->type <= HEVC_NAL_UNIT_TYPE_PPS : unit->type == H264_NAL_UNIT_TYPE_SPS || unit->type == H264_NAL_UNIT_TYPE_PPS)
+      info->parameterSets = true;
+
+    enum frame_type type = classify_nal(unit, hevc);
+    if (type == FRAME_UNKNOWN)
+      continue;
+
+    // A single referenced slice makes the whole frame a reference frame
+    if (info->type == FRAME_UNKNOWN) {
+      info->type = type;
+      read_slice_header(info, unit, hevc);
+    } else if (type == FRAME_IDR || (type == FRAME_REFERENCE && info->type == FRAME_DROPPABLE))
+      info->type = type;
+  }
+
+  return info;
+}
+
+// Returns the classification of a decode unit or NULL if it isn't classified
+PFRAME_INFO gs_frame_info(PDECODE_UNIT decodeUnit) {
+  for (int i = 0; i < FRAME_INFO_SLOTS; i++) {
+    PFRAME_INFO info = &frames[(nextFrame + FRAME_INFO_SLOTS - 1 - i) % FRAME_INFO_SLOTS];
+    if (info->decodeUnit == decodeUnit)
+      return info;
+  }
+  return NULL;
+}
+
+static void classifier_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  classifier_hevc = videoFormat == VIDEO_FORMAT_H265;
+  for (int i = 0; i < FRAME_INFO_SLOTS; i++)
+    frames[i].decodeUnit = NULL;
+
+  classifier_target->setup(videoFormat, width, height, redrawRate, context, drFlags);
+}
+
+static int classifier_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  gs_frame_classify(decodeUnit, classifier_hevc);
+  return classifier_target->submitDecodeUnit(decodeUnit);
+}
+
+// Classify every decode unit before it is submitted to the decoder,
+// the result is available to the decoder with gs_frame_info
+PDECODER_RENDERER_CALLBACKS gs_frame_classifier(PDECODER_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL)
+    return NULL;
+
+  classifier_target = callbacks;
+  classifier_callbacks = *callbacks;
+  classifier_callbacks.setup = classifier_setup;
+  classifier_callbacks.submitDecodeUnit = classifier_submit_decode_unit;
+  return &classifier_callbacks;
+}
@@ -0,0 +1,49 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "nal.h"
+
+#include <Limelight.h>
+
+#include <stdbool.h>
+
+enum frame_type {
+  FRAME_UNKNOWN,
+  FRAME_IDR,        // Starts a new sequence, all previous frames can be discarded
+  FRAME_REFERENCE,  // Used as reference by later frames
+  FRAME_DROPPABLE   // Not referenced by any other frame
+};
+
+enum slice_type { SLICE_P, SLICE_B, SLICE_I, SLICE_UNKNOWN };
+
+typedef struct _FRAME_INFO {
+  PDECODE_UNIT decodeUnit;
+  enum frame_type type;
+  enum slice_type sliceType;
+  bool firstSlice; // Contains the first slice of a picture
+  bool parameterSets; // Contains a VPS, SPS or PPS
+  NAL_INDEX index;
+} FRAME_INFO, *PFRAME_INFO;
+
+PFRAME_INFO gs_frame_classify(PDECODE_UNIT decodeUnit, bool hevc);
+PFRAME_INFO gs_frame_info(PDECODE_UNIT decodeUnit);
+
+PDECODER_RENDERER_CALLBACKS gs_frame_classifier(PDECODER_RENDERER_CALLBACKS callbacks);
@@ -21,6 +21,7 @@
 #include "errors.h"
 
 #include <string.h>
+#include <time.h>
 #include <curl/curl.h>
 
 static CURL *curl;
@@ -44,31 +45,213 @@ static size_t _write_curl(void *contents, size_t size, size_t nmemb, void *userp
   return realsize;
 }
 
+static char certificateFilePath[4096];
+static char keyFilePath[4096];
+
+static void http_setup(CURL *handle) {
+  curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
+  curl_easy_setopt(handle, CURLOPT_SSLENGINE_DEFAULT, 1L);
+  curl_easy_setopt(handle, CURLOPT_SSLCERTTYPE,"PEM");
+  curl_easy_setopt(handle, CURLOPT_SSLCERT, certificateFilePath);
+  curl_easy_setopt(handle, CURLOPT_SSLKEYTYPE, "PEM");
+  curl_easy_setopt(handle, CURLOPT_SSLKEY, keyFilePath);
+  curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0L);
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, _write_curl);
+  curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(handle, CURLOPT_SSL_SESSIONID_CACHE, 0L);
+}
+
 int http_init(const char* keyDirectory) {
   curl = curl_easy_init();
   if (!curl)
     return GS_FAILED;
 
-  char certificateFilePath[4096];
   sprintf(certificateFilePath, "%s/%s", keyDirectory, CERTIFICATE_FILE_NAME);
+  sprintf(keyFilePath, "%s/%s", keyDirectory, KEY_FILE_NAME);
+
+  http_setup(curl);
+
+  return GS_OK;
+}
+
+static void http_reset_data(PHTTP_DATA data) {
+  if (data->size > 0) {
+    free(data->memory);
+    data->memory = malloc(1);
+    data->size = 0;
+  }
+}
+
+// Perform all requests concurrently, bounded by timeout in milliseconds.
+// Requests with a NULL url are skipped.
+int http_request_multi(char** urls, PHTTP_DATA* data, int* results, PHTTP_TIMES times, int count, long timeout) {
+  CURLM *multi = curl_multi_init();
+  CURL **handles = calloc(count, sizeof(CURL*));
+  if (multi == NULL || handles == NULL) {
+    if (multi != NULL)
+      curl_multi_cleanup(multi);
 
-  char keyFilePath[4096];
-  sprintf(&keyFilePath[0], "%s/%s", keyDirectory, KEY_FILE_NAME);
+    free(handles);
+    return GS_OUT_OF_MEMORY;
+  }
 
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-  curl_easy_setopt(curl, CURLOPT_SSLENGINE_DEFAULT, 1L);
-  curl_easy_setopt(curl, CURLOPT_SSLCERTTYPE,"PEM");
-  curl_easy_setopt(curl, CURLOPT_SSLCERT, certificateFilePath);
-  curl_easy_setopt(curl, CURLOPT_SSLKEYTYPE, "PEM");
-  curl_easy_setopt(curl, CURLOPT_SSLKEY, keyFilePath);
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _write_curl);
-  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-  curl_easy_setopt(curl, CURLOPT_SSL_SESSIONID_CACHE, 0L);
+  for (int i = 0; i < count; i++) {
+    results[i] = GS_IO_ERROR;
+    times[i].connect = times[i].start = times[i].total = -1;
+    if (urls[i] == NULL)
+      continue;
+
+    http_reset_data(data[i]);
+    if (data[i]->memory == NULL || (handles[i] = curl_easy_init()) == NULL) {
+      results[i] = GS_OUT_OF_MEMORY;
+      continue;
+    }
+
+    http_setup(handles[i]);
+    curl_easy_setopt(handles[i], CURLOPT_WRITEDATA, data[i]);
+    curl_easy_setopt(handles[i], CURLOPT_URL, urls[i]);
+    curl_easy_setopt(handles[i], CURLOPT_TIMEOUT_MS, timeout);
+    curl_easy_setopt(handles[i], CURLOPT_NOSIGNAL, 1L);
+    curl_multi_add_handle(multi, handles[i]);
+  }
 
+  int running;
+  do {
+    curl_multi_perform(multi, &running);
+
+    CURLMsg *msg;
+    int left;
+    while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      for (int i = 0; i < count; i++) {
+        if (handles[i] == msg->easy_handle) {
+          double connect, start, total;
+          curl_easy_getinfo(handles[i], CURLINFO_CONNECT_TIME, &connect);
+          curl_easy_getinfo(handles[i], CURLINFO_STARTTRANSFER_TIME, &start);
+          curl_easy_getinfo(handles[i], CURLINFO_TOTAL_TIME, &total);
+          times[i].connect = connect * 1000000;
+          times[i].start = start * 1000000;
+          times[i].total = total * 1000000;
+          if (msg->data.result != CURLE_OK)
+            gs_error = curl_easy_strerror(msg->data.result);
+
+          results[i] = msg->data.result == CURLE_OK ? GS_OK : GS_FAILED;
+          break;
+        }
+      }
+    }
+
+    if (running)
+      curl_multi_wait(multi, NULL, 0, 100, NULL);
+  } while (running);
+
+  for (int i = 0; i < count; i++) {
+    if (handles[i] != NULL) {
+      curl_multi_remove_handle(multi, handles[i]);
+      curl_easy_cleanup(handles[i]);
+    }
+  }
+
+  free(handles);
+  curl_multi_cleanup(multi);
   return GS_OK;
 }
 
+struct http_counter {
+  long long measure_start;
+  long long bytes;
+};
+
+static long long http_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static size_t _count_curl(void *contents, size_t size, size_t nmemb, void *userp) {
+  struct http_counter* counter = (struct http_counter*) userp;
+  if (http_time_us() >= counter->measure_start)
+    counter->bytes += size * nmemb;
+
+  return size * nmemb;
+}
+
+// Download the urls concurrently and over and over again for duration
+// milliseconds, reusing the connections. Only data received after warmup
+// milliseconds is counted, so the TCP slow start doesn't lower the result.
+int http_throughput(char** urls, int count, long warmup, long duration, int* kbps) {
+  CURLM *multi = curl_multi_init();
+  CURL **handles = calloc(count, sizeof(CURL*));
+  if (multi == NULL || handles == NULL) {
+    if (multi != NULL)
+      curl_multi_cleanup(multi);
+
+    free(handles);
+    return GS_OUT_OF_MEMORY;
+  }
+
+  long long start = http_time_us();
+  long long end = start + duration * 1000;
+  struct http_counter counter = { .measure_start = start + warmup * 1000 };
+  int ret = GS_OK;
+  for (int i = 0; i < count && ret == GS_OK; i++) {
+    if ((handles[i] = curl_easy_init()) == NULL) {
+      ret = GS_OUT_OF_MEMORY;
+      break;
+    }
+
+    http_setup(handles[i]);
+    curl_easy_setopt(handles[i], CURLOPT_WRITEFUNCTION, _count_curl);
+    curl_easy_setopt(handles[i], CURLOPT_WRITEDATA, &counter);
+    curl_easy_setopt(handles[i], CURLOPT_URL, urls[i]);
+    // Transfers still running at the end are aborted, not timed out
+    curl_easy_setopt(handles[i], CURLOPT_TIMEOUT_MS, duration * 2);
+    curl_easy_setopt(handles[i], CURLOPT_NOSIGNAL, 1L);
+    curl_multi_add_handle(multi, handles[i]);
+  }
+
+  while (ret == GS_OK && http_time_us() < end) {
+    int running;
+    curl_multi_perform(multi, &running);
+
+    CURLMsg *msg;
+    int left;
+    while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      if (msg->data.result != CURLE_OK) {
+        gs_error = curl_easy_strerror(msg->data.result);
+        ret = GS_FAILED;
+        break;
+      }
+
+      // Request the same url again on the connection that is already open
+      CURL *handle = msg->easy_handle;
+      curl_multi_remove_handle(multi, handle);
+      curl_multi_add_handle(multi, handle);
+    }
+
+    curl_multi_wait(multi, NULL, 0, 10, NULL);
+  }
+
+  long long elapsed = http_time_us() - counter.measure_start;
+  *kbps = ret == GS_OK && elapsed > 0 ? counter.bytes * 8 * 1000 / elapsed : 0;
+
+  for (int i = 0; i < count; i++) {
+    if (handles[i] != NULL) {
+      curl_multi_remove_handle(multi, handles[i]);
+      curl_easy_cleanup(handles[i]);
+    }
+  }
+
+  free(handles);
+  curl_multi_cleanup(multi);
+  return ret;
+}
+
 int http_request(char* url, PHTTP_DATA data) {
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
   curl_easy_setopt(curl, CURLOPT_URL, url);
@@ -29,7 +29,16 @@ typedef struct _HTTP_DATA {
   size_t size;
 } HTTP_DATA, *PHTTP_DATA;
 
+// Times in microseconds since the start of a request
+typedef struct _HTTP_TIMES {
+  long connect; // TCP connection established
+  long start; // First byte of the response received
+  long total; // Transfer completed
+} HTTP_TIMES, *PHTTP_TIMES;
+
 int http_init(const char* keyDirectory);
 PHTTP_DATA http_create_data();
 int http_request(char* url, PHTTP_DATA data);
+int http_request_multi(char** urls, PHTTP_DATA* data, int* results, PHTTP_TIMES times, int count, long timeout);
+int http_throughput(char** urls, int count, long warmup, long duration, int* kbps);
 void http_free_data(PHTTP_DATA data);
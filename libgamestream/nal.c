@@ -0,0 +1,138 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nal.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// Find the first position of two zero bytes followed by a byte
+// which equals value after masking
+static int find_scalar(const uint8_t* data, int start, int length, uint8_t mask, uint8_t value) {
+  for (int i = start; i + 2 < length; i++) {
+    if ((data[i + 2] & mask) == value && data[i] == 0 && data[i + 1] == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Compare 16 positions at once, the three loads overlap so
+// patterns crossing the block boundary are found as well
+static int find(const uint8_t* data, int length, uint8_t mask, uint8_t value) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i masks = _mm_set1_epi8(mask);
+  const __m128i values = _mm_set1_epi8(value);
+  for (; i + 18 <= length; i += 16) {
+    __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i)), zero);
+    __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i + 1)), zero);
+    __m128i c = _mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i*) (data + i + 2)), masks), values);
+    int matches = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), c));
+    if (matches)
+      return i + __builtin_ctz(matches);
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  const uint8x16_t zero = vdupq_n_u8(0);
+  const uint8x16_t masks = vdupq_n_u8(mask);
+  const uint8x16_t values = vdupq_n_u8(value);
+  for (; i + 18 <= length; i += 16) {
+    uint8x16_t a = vceqq_u8(vld1q_u8(data + i), zero);
+    uint8x16_t b = vceqq_u8(vld1q_u8(data + i + 1), zero);
+    uint8x16_t c = vceqq_u8(vandq_u8(vld1q_u8(data + i + 2), masks), values);
+    uint64x2_t matches = vreinterpretq_u64_u8(vandq_u8(vandq_u8(a, b), c));
+    if (vgetq_lane_u64(matches, 0) | vgetq_lane_u64(matches, 1))
+      return find_scalar(data, i, i + 18, mask, value);
+  }
+#endif
+  return find_scalar(data, i, length, mask, value);
+}
+
+// Returns the offset of the next 0x000001 start code or -1 if there is none
+int gs_nal_find_start_code(const char* data, int length) {
+  return find((const uint8_t*) data, length, 0xFF, 0x01);
+}
+
+int gs_nal_index(PDECODE_UNIT decodeUnit, PNAL_INDEX index, bool hevc) {
+  index->count = 0;
+  for (PLENTRY entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+    const uint8_t* data = (const uint8_t*) entry->data;
+    int start = find(data, entry->length, 0xFF, 0x01);
+    while (start >= 0 && index->count < GS_NAL_MAX_UNITS) {
+      int offset = start + 3;
+      int next = find(data + offset, entry->length - offset, 0xFF, 0x01);
+      int end = next >= 0 ? offset + next : entry->length;
+
+      // The zero_byte of a 4 byte start code isn't part of the previous NAL unit
+      if (next >= 0 && end > offset && data[end - 1] == 0)
+        end--;
+
+      if (end > offset) {
+        PNAL_UNIT unit = &index->units[index->count++];
+        unit->entry = entry;
+        unit->offset = offset;
+        unit->length = end - offset;
+        unit->type = hevc ? (data[offset] >> 1) & 0x3F : data[offset] & 0x1F;
+      }
+
+      start = next >= 0 ? offset + next : -1;
+    }
+  }
+  return index->count;
+}
+
+// Remove emulation prevention bytes, the output is never larger than the input
+int gs_nal_unescape(const char* nal, int length, char* rbsp) {
+  const uint8_t* data = (const uint8_t*) nal;
+  int i = 0, j = 0, pos;
+  while ((pos = find(data + i, length - i, 0xFF, 0x03)) >= 0) {
+    memcpy(rbsp + j, nal + i, pos + 2);
+    j += pos + 2;
+    i += pos + 3;
+  }
+  memcpy(rbsp + j, nal + i, length - i);
+  return j + length - i;
+}
+
+// Insert emulation prevention bytes, returns -1 if the output doesn't fit
+int gs_nal_escape(const char* rbsp, int length, char* nal, int size) {
+  const uint8_t* data = (const uint8_t*) rbsp;
+  int i = 0, j = 0, pos;
+  while ((pos = find(data + i, length - i, 0xFC, 0x00)) >= 0) {
+    if (j + pos + 3 > size)
+      return -1;
+
+    memcpy(nal + j, rbsp + i, pos + 2);
+    j += pos + 2;
+    nal[j++] = 0x03;
+    i += pos + 2;
+  }
+
+  if (j + length - i > size)
+    return -1;
+
+  memcpy(nal + j, rbsp + i, length - i);
+  return j + length - i;
+}
@@ -0,0 +1,44 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Limelight.h>
+
+#include <stdbool.h>
+
+#define GS_NAL_MAX_UNITS 64
+
+typedef struct _NAL_UNIT {
+  PLENTRY entry;
+  int offset; // Offset of the NAL header in the entry, after the start code
+  int length; // Length of the NAL unit without start code
+  int type;
+} NAL_UNIT, *PNAL_UNIT;
+
+typedef struct _NAL_INDEX {
+  int count;
+  NAL_UNIT units[GS_NAL_MAX_UNITS];
+} NAL_INDEX, *PNAL_INDEX;
+
+int gs_nal_find_start_code(const char* data, int length);
+int gs_nal_index(PDECODE_UNIT decodeUnit, PNAL_INDEX index, bool hevc);
+
+int gs_nal_unescape(const char* nal, int length, char* rbsp);
+int gs_nal_escape(const char* rbsp, int length, char* nal, int size);
@@ -18,99 +18,614 @@
  */
 
 #include "sps.h"
+#include "nal.h"
 
 #include "h264_stream.h"
 
-static h264_stream_t* h264_stream;
+#include <stdbool.h>
+#include <string.h>
+
+#define MAX_SPS_SIZE GS_SPS_MAX_SIZE
+
+#define HEVC_NAL_UNIT_TYPE_VPS 32
+#define HEVC_NAL_UNIT_TYPE_SPS 33
+#define SPS_CACHE_SIZE 4
+
+// Rewritten SPS for a single input SPS, the replayed SPS is only
+// generated when it is needed for the baseline hack
+struct sps_cache {
+  int flags;
+  int inputLength;
+  char input[MAX_SPS_SIZE];
+  int length[2];
+  char output[2][GS_SPS_MAX_LENGTH];
+};
+
+static struct sps_cache cache[SPS_CACHE_SIZE];
+static int cacheNext;
+static struct sps_cache* last_sps;
+
+static LENTRY sps_entry;
 static int initial_width, initial_height;
 
 static int replay_sps;
 
-void gs_sps_init(int width, int height) {
-  h264_stream = h264_new();
-  initial_width = width;
-  initial_height = height;
+static uint32_t copy_u(bs_t* in, bs_t* out, int n) {
+  uint32_t v = bs_read_u(in, n);
+  if (out != NULL)
+    bs_write_u(out, n, v);
+  return v;
 }
 
-PLENTRY gs_sps_fix(PLENTRY *head, int flags) {
-  PLENTRY entry = *head;
-  const char naluHeader[] = {0x00, 0x00, 0x00, 0x01};
+static uint32_t copy_ue(bs_t* in, bs_t* out) {
+  uint32_t v = bs_read_ue(in);
+  if (out != NULL)
+    bs_write_ue(out, v);
+  return v;
+}
 
-  if (replay_sps == 1) {
-    PLENTRY replay_entry = (PLENTRY) malloc(sizeof(*replay_entry) + 128);
-    if (replay_entry == NULL)
-      return NULL;
+static int32_t copy_se(bs_t* in, bs_t* out) {
+  int32_t v = bs_read_se(in);
+  if (out != NULL)
+    bs_write_se(out, v);
+  return v;
+}
 
-    replay_entry->data = (char *) (entry + 1);
-    memcpy(replay_entry->data, naluHeader, sizeof(naluHeader));
-    h264_stream->sps->profile_idc = H264_PROFILE_HIGH;
-    replay_entry->length = write_nal_unit(h264_stream, replay_entry->data+4, 124) + 4;
+static bool high_profile(int profile) {
+  return profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+    profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138 ||
+    profile == 139 || profile == 134 || profile == 135;
+}
 
-    replay_entry->next = entry;
-    entry = replay_entry;
-    replay_sps = 2;
-  } else if ((entry->data[4] & 0x1F) == NAL_UNIT_TYPE_SPS) {
-    read_nal_unit(h264_stream, entry->data+4, entry->length-4);
+static void copy_scaling_list(bs_t* in, bs_t* out, int size) {
+  int lastScale = 8, nextScale = 8;
+  for (int i = 0; i < size && nextScale != 0; i++) {
+    int delta = copy_se(in, out);
+    nextScale = (lastScale + delta + 256) % 256;
+    lastScale = nextScale == 0 ? lastScale : nextScale;
+  }
+}
+
+static void copy_hrd_parameters(bs_t* in, bs_t* out) {
+  int count = copy_ue(in, out) + 1;
+  copy_u(in, out, 8);
+  for (int i = 0; i < count; i++) {
+    copy_ue(in, out);
+    copy_ue(in, out);
+    copy_u(in, out, 1);
+  }
+  copy_u(in, out, 20);
+}
+
+static void copy_vui_parameters(bs_t* in, bs_t* out, int flags) {
+  if (copy_u(in, out, 1) && copy_u(in, out, 8) == 255) // aspect_ratio_info_present_flag
+    copy_u(in, out, 32);
+
+  if (copy_u(in, out, 1)) // overscan_info_present_flag
+    copy_u(in, out, 1);
+
+  // GFE 2.5.11 changed the SPS to add additional extensions
+  // Some devices don't like these so we remove them here.
+  bs_write_u1(out, 0);
+  if (bs_read_u1(in)) { // video_signal_type_present_flag
+    bs_read_u(in, 4);
+    if (bs_read_u1(in))
+      bs_read_u(in, 24);
+  }
+
+  bs_write_u1(out, 0);
+  if (bs_read_u1(in)) { // chroma_loc_info_present_flag
+    bs_read_ue(in);
+    bs_read_ue(in);
+  }
+
+  if (copy_u(in, out, 1)) { // timing_info_present_flag
+    copy_u(in, out, 32);
+    copy_u(in, out, 32);
+    copy_u(in, out, 1);
+  }
+
+  bool nal_hrd = copy_u(in, out, 1);
+  if (nal_hrd)
+    copy_hrd_parameters(in, out);
+
+  bool vcl_hrd = copy_u(in, out, 1);
+  if (vcl_hrd)
+    copy_hrd_parameters(in, out);
+
+  if (nal_hrd || vcl_hrd)
+    copy_u(in, out, 1);
+
+  copy_u(in, out, 1); // pic_struct_present_flag
+
+  bool bitstream_restriction = bs_read_u1(in);
+  int motion_vectors_over_pic_boundaries = 1, log2_max_mv_length_horizontal = 16, log2_max_mv_length_vertical = 16, num_reorder_frames = 0;
+  if (bitstream_restriction) {
+    motion_vectors_over_pic_boundaries = bs_read_u1(in);
+    bs_read_ue(in);
+    bs_read_ue(in);
+    log2_max_mv_length_horizontal = bs_read_ue(in);
+    log2_max_mv_length_vertical = bs_read_ue(in);
+    num_reorder_frames = bs_read_ue(in);
+    bs_read_ue(in);
+  }
+
+  if ((flags & GS_SPS_BITSTREAM_FIXUP) == GS_SPS_BITSTREAM_FIXUP) {
+    // The SPS that comes in the current H264 bytestream doesn't set the bitstream_restriction_flag
+    // or the max_dec_frame_buffering which increases decoding latency on some devices
+    // log2_max_mv_length_horizontal and log2_max_mv_length_vertical are set to more
+    // conservite values by GFE 25.11. We'll let those values stand.
+    bs_write_u1(out, 1);
+    bs_write_u1(out, motion_vectors_over_pic_boundaries);
+
+    // These values are the default for the fields, but they are more aggressive
+    // than what GFE sends in 2.5.11, but it doesn't seem to cause picture problems.
+    bs_write_ue(out, 2); // max_bytes_per_pic_denom
+    bs_write_ue(out, 1); // max_bits_per_mb_denom
+    bs_write_ue(out, log2_max_mv_length_horizontal);
+    bs_write_ue(out, log2_max_mv_length_vertical);
+    bs_write_ue(out, num_reorder_frames);
+
+    // Some devices throw errors if max_dec_frame_buffering < num_ref_frames
+    bs_write_ue(out, 1);
+  } else // Devices that didn't/couldn't get bitstream restrictions before GFE 2.5.11 will continue to not receive them now
+    bs_write_u1(out, 0);
+}
+
+// Copy the SPS field by field, modifying only the fields that need a fixup.
+// Parsing straight into the output avoids building a full h264_stream_t.
+static void rewrite_sps(bs_t* in, bs_t* out, int profile, int flags) {
+  int input_profile = bs_read_u8(in);
+  bs_write_u8(out, profile > 0 ? profile : input_profile);
+  if (profile <= 0)
+    profile = input_profile;
 
-    // Some decoders rely on H264 level to decide how many buffers are needed
-    // Since we only need one frame buffered, we'll set level as low as we can
-    // for known resolution combinations. Otherwise leave the profile alone (currently 5.0)
-    if (initial_width == 1280 && initial_height == 720)
-      h264_stream->sps->level_idc = 32; // Max 5 buffered frames at 1280x720x60
-    else if (initial_width = 1920 && initial_height == 1080)
-      h264_stream->sps->level_idc = 42; // Max 4 buffered frames at 1920x1080x60
+  copy_u(in, out, 8); // constraint_set flags
+  int level = bs_read_u8(in);
 
-    // Some decoders requires a reference frame count of 1 to decode successfully.
-    h264_stream->sps->num_ref_frames = 1;
+  // Some decoders rely on H264 level to decide how many buffers are needed
+  // Since we only need one frame buffered, we'll set level as low as we can
+  // for known resolution combinations. Otherwise leave the profile alone (currently 5.0)
+  if (initial_width == 1280 && initial_height == 720)
+    level = 32; // Max 5 buffered frames at 1280x720x60
+  else if (initial_width == 1920 && initial_height == 1080)
+    level = 42; // Max 4 buffered frames at 1920x1080x60
 
-    // GFE 2.5.11 changed the SPS to add additional extensions
-    // Some devices don't like these so we remove them here.
-    h264_stream->sps->vui.video_signal_type_present_flag = 0;
-    h264_stream->sps->vui.chroma_loc_info_present_flag = 0;
+  bs_write_u8(out, level);
+  copy_ue(in, out); // seq_parameter_set_id
 
+  bs_t* high_out = high_profile(profile) ? out : NULL;
+  if (high_profile(input_profile)) {
+    int chroma_format_idc = copy_ue(in, high_out);
+    if (chroma_format_idc == 3)
+      copy_u(in, high_out, 1);
+
+    copy_ue(in, high_out);
+    copy_ue(in, high_out);
+    copy_u(in, high_out, 1);
+    if (copy_u(in, high_out, 1)) { // seq_scaling_matrix_present_flag
+      for (int i = 0; i < (chroma_format_idc != 3 ? 8 : 12); i++) {
+        if (copy_u(in, high_out, 1))
+          copy_scaling_list(in, high_out, i < 6 ? 16 : 64);
+      }
+    }
+  } else if (high_out != NULL) {
+    bs_write_ue(out, 1); // chroma_format_idc
+    bs_write_ue(out, 0);
+    bs_write_ue(out, 0);
+    bs_write_u(out, 2, 0);
+  }
+
+  copy_ue(in, out); // log2_max_frame_num_minus4
+  int pic_order_cnt_type = copy_ue(in, out);
+  if (pic_order_cnt_type == 0)
+    copy_ue(in, out);
+  else if (pic_order_cnt_type == 1) {
+    copy_u(in, out, 1);
+    copy_se(in, out);
+    copy_se(in, out);
+    int cycle = copy_ue(in, out);
+    for (int i = 0; i < cycle; i++)
+      copy_se(in, out);
+  }
+
+  // Some decoders requires a reference frame count of 1 to decode successfully.
+  bs_read_ue(in);
+  bs_write_ue(out, 1);
+
+  copy_u(in, out, 1); // gaps_in_frame_num_value_allowed_flag
+  copy_ue(in, out);
+  copy_ue(in, out);
+  if (!copy_u(in, out, 1)) // frame_mbs_only_flag
+    copy_u(in, out, 1);
+
+  copy_u(in, out, 1); // direct_8x8_inference_flag
+  if (copy_u(in, out, 1)) { // frame_cropping_flag
+    for (int i = 0; i < 4; i++)
+      copy_ue(in, out);
+  }
+
+  if (copy_u(in, out, 1)) // vui_parameters_present_flag
+    copy_vui_parameters(in, out, flags);
+}
+
+static int bit_pos(bs_t* b) {
+  return (b->p - b->start) * 8 + 8 - b->bits_left;
+}
+
+static void copy_bits(bs_t* in, bs_t* out, int n) {
+  for (; n > 0; n -= 32)
+    copy_u(in, out, n > 32 ? 32 : n);
+}
+
+static void copy_hevc_profile_tier_level(bs_t* in, bs_t* out, int max_sub_layers) {
+  copy_bits(in, out, 96); // general profile, tier and level
+  bool profile_present[8], level_present[8];
+  for (int i = 0; i < max_sub_layers; i++) {
+    profile_present[i] = copy_u(in, out, 1);
+    level_present[i] = copy_u(in, out, 1);
+  }
+  if (max_sub_layers > 0)
+    copy_bits(in, out, 2 * (8 - max_sub_layers));
+
+  for (int i = 0; i < max_sub_layers; i++) {
+    if (profile_present[i])
+      copy_bits(in, out, 88);
+    if (level_present[i])
+      copy_u(in, out, 8);
+  }
+}
+
+// Only the number of pictures to reorder differs between input and output. The
+// size of the DPB is left alone, as slice headers can carry their own reference
+// picture sets which are only limited by it.
+static void copy_hevc_sub_layer_ordering_info(bs_t* in, bs_t* out, int max_sub_layers, int flags) {
+  bool present = copy_u(in, out, 1);
+  for (int i = present ? 0 : max_sub_layers; i <= max_sub_layers; i++) {
+    copy_ue(in, out); // sps_max_dec_pic_buffering_minus1
     if ((flags & GS_SPS_BITSTREAM_FIXUP) == GS_SPS_BITSTREAM_FIXUP) {
-      // The SPS that comes in the current H264 bytestream doesn't set the bitstream_restriction_flag
-      // or the max_dec_frame_buffering which increases decoding latency on some devices
-      // log2_max_mv_length_horizontal and log2_max_mv_length_vertical are set to more
-      // conservite values by GFE 25.11. We'll let those values stand.
-      if (!h264_stream->sps->vui.bitstream_restriction_flag) {
-        h264_stream->sps->vui.bitstream_restriction_flag = 1;
-        h264_stream->sps->vui.motion_vectors_over_pic_boundaries_flag = 1;
-        h264_stream->sps->vui.max_bits_per_mb_denom = 1;
-        h264_stream->sps->vui.log2_max_mv_length_horizontal = 16;
-        h264_stream->sps->vui.log2_max_mv_length_vertical = 16;
-        h264_stream->sps->vui.num_reorder_frames = 0;
+      // GFE doesn't use B-frames, so there is no need to wait for frames to reorder
+      bs_read_ue(in);
+      bs_write_ue(out, 0);
+    } else
+      copy_ue(in, out);
+    copy_ue(in, out); // max_latency_increase_plus1
+  }
+}
+
+static void copy_hevc_scaling_list_data(bs_t* in, bs_t* out) {
+  for (int size = 0; size < 4; size++) {
+    for (int matrix = 0; matrix < 6; matrix += size == 3 ? 3 : 1) {
+      if (!copy_u(in, out, 1)) // scaling_list_pred_mode_flag
+        copy_ue(in, out);
+      else {
+        int coefficients = size == 0 ? 16 : 64;
+        if (size > 1)
+          copy_se(in, out);
+        for (int i = 0; i < coefficients; i++)
+          copy_se(in, out);
       }
+    }
+  }
+}
+
+// Returns the number of pictures in the short term reference picture set
+static int copy_hevc_st_ref_pic_set(bs_t* in, bs_t* out, int index, int* num_delta_pocs) {
+  if (index != 0 && copy_u(in, out, 1)) { // inter_ref_pic_set_prediction_flag
+    copy_u(in, out, 1);
+    copy_ue(in, out);
+    int count = 0;
+    for (int j = 0; j <= num_delta_pocs[index - 1]; j++) {
+      if (copy_u(in, out, 1) || copy_u(in, out, 1)) // used_by_curr_pic_flag or use_delta_flag
+        count++;
+    }
+    return num_delta_pocs[index] = count;
+  }
 
-      // Some devices throw errors if max_dec_frame_buffering < num_ref_frames
-      h264_stream->sps->vui.max_dec_frame_buffering = 1;
+  int negative = copy_ue(in, out);
+  int positive = copy_ue(in, out);
+  for (int i = 0; i < negative + positive; i++) {
+    copy_ue(in, out);
+    copy_u(in, out, 1);
+  }
+  return num_delta_pocs[index] = negative + positive;
+}
 
-      // These values are the default for the fields, but they are more aggressive
-      // than what GFE sends in 2.5.11, but it doesn't seem to cause picture problems.
-      h264_stream->sps->vui.max_bytes_per_pic_denom = 2;
-      h264_stream->sps->vui.max_bits_per_mb_denom = 1;
-    } else // Devices that didn't/couldn't get bitstream restrictions before GFE 2.5.11 will continue to not receive them now
-      h264_stream->sps->vui.bitstream_restriction_flag = 0;
+static void copy_hevc_sub_layer_hrd_parameters(bs_t* in, bs_t* out, int count, bool sub_pic) {
+  for (int i = 0; i < count; i++) {
+    copy_ue(in, out);
+    copy_ue(in, out);
+    if (sub_pic) {
+      copy_ue(in, out);
+      copy_ue(in, out);
+    }
+    copy_u(in, out, 1);
+  }
+}
 
-    if ((flags & GS_SPS_BASELINE_HACK) == GS_SPS_BASELINE_HACK && !replay_sps)
-      h264_stream->sps->profile_idc = H264_PROFILE_BASELINE;
-
-    PLENTRY sps_entry = (PLENTRY) malloc(sizeof(*sps_entry) + 128);
-    if (sps_entry == NULL)
-      return NULL;
-
-    PLENTRY next = entry->next;
-    free(entry);
-    sps_entry->data = (char*) (sps_entry + 1);
-    memcpy(sps_entry->data, naluHeader, sizeof(naluHeader));
-    sps_entry->length = write_nal_unit(h264_stream, sps_entry->data+4, 124) + 4;
-    sps_entry->next = next;
-    entry = sps_entry;
+static void copy_hevc_hrd_parameters(bs_t* in, bs_t* out, int max_sub_layers) {
+  bool nal_hrd = copy_u(in, out, 1);
+  bool vcl_hrd = copy_u(in, out, 1);
+  bool sub_pic = false;
+  if (nal_hrd || vcl_hrd) {
+    sub_pic = copy_u(in, out, 1);
+    if (sub_pic)
+      copy_u(in, out, 19);
+
+    copy_u(in, out, 8);
+    if (sub_pic)
+      copy_u(in, out, 4);
+
+    copy_u(in, out, 15);
+  }
+
+  for (int i = 0; i <= max_sub_layers; i++) {
+    bool fixed_pic_rate = copy_u(in, out, 1) || copy_u(in, out, 1);
+    bool low_delay = false;
+    if (fixed_pic_rate)
+      copy_ue(in, out);
+    else
+      low_delay = copy_u(in, out, 1);
+
+    int count = low_delay ? 1 : copy_ue(in, out) + 1;
+    if (nal_hrd)
+      copy_hevc_sub_layer_hrd_parameters(in, out, count, sub_pic);
+    if (vcl_hrd)
+      copy_hevc_sub_layer_hrd_parameters(in, out, count, sub_pic);
+  }
+}
+
+static void copy_hevc_vui_parameters(bs_t* in, bs_t* out, int max_sub_layers, int flags) {
+  if (copy_u(in, out, 1) && copy_u(in, out, 8) == 255) // aspect_ratio_info_present_flag
+    copy_u(in, out, 32);
+
+  if (copy_u(in, out, 1)) // overscan_info_present_flag
+    copy_u(in, out, 1);
+
+  if (copy_u(in, out, 1)) { // video_signal_type_present_flag
+    copy_u(in, out, 4);
+    if (copy_u(in, out, 1))
+      copy_u(in, out, 24);
+  }
+
+  if (copy_u(in, out, 1)) { // chroma_loc_info_present_flag
+    copy_ue(in, out);
+    copy_ue(in, out);
+  }
+
+  copy_u(in, out, 3);
+  if (copy_u(in, out, 1)) { // default_display_window_flag
+    for (int i = 0; i < 4; i++)
+      copy_ue(in, out);
+  }
+
+  if (copy_u(in, out, 1)) { // vui_timing_info_present_flag
+    copy_u(in, out, 32);
+    copy_u(in, out, 32);
+    if (copy_u(in, out, 1))
+      copy_ue(in, out);
+    if (copy_u(in, out, 1))
+      copy_hevc_hrd_parameters(in, out, max_sub_layers);
+  }
+
+  bool bitstream_restriction = bs_read_u1(in);
+  int restriction_flags = 0x2, min_spatial_segmentation = 0, log2_max_mv_length_horizontal = 15, log2_max_mv_length_vertical = 15;
+  if (bitstream_restriction) {
+    restriction_flags = bs_read_u(in, 3);
+    min_spatial_segmentation = bs_read_ue(in);
+    bs_read_ue(in);
+    bs_read_ue(in);
+    log2_max_mv_length_horizontal = bs_read_ue(in);
+    log2_max_mv_length_vertical = bs_read_ue(in);
+  }
+
+  if ((flags & GS_SPS_BITSTREAM_FIXUP) == GS_SPS_BITSTREAM_FIXUP) {
+    // Same restrictions as for H264, the reordering limit is part of the
+    // sub-layer ordering info in HEVC
+    bs_write_u1(out, 1);
+    bs_write_u(out, 3, restriction_flags);
+    bs_write_ue(out, min_spatial_segmentation);
+    bs_write_ue(out, 2); // max_bytes_per_pic_denom
+    bs_write_ue(out, 1); // max_bits_per_min_cu_denom
+    bs_write_ue(out, log2_max_mv_length_horizontal);
+    bs_write_ue(out, log2_max_mv_length_vertical);
+  } else
+    bs_write_u1(out, 0);
+}
+
+static void rewrite_hevc_vps(bs_t* in, bs_t* out, int end, int flags) {
+  copy_u(in, out, 12);
+  int max_sub_layers = copy_u(in, out, 3);
+  copy_u(in, out, 17);
+  copy_hevc_profile_tier_level(in, out, max_sub_layers);
+  copy_hevc_sub_layer_ordering_info(in, out, max_sub_layers, flags);
+  copy_bits(in, out, end - bit_pos(in));
+}
+
+// Returns -1 if the SPS is invalid
+static int rewrite_hevc_sps(bs_t* in, bs_t* out, int end, int flags) {
+  int num_delta_pocs[64];
+
+  copy_u(in, out, 4);
+  int max_sub_layers = copy_u(in, out, 3);
+  copy_u(in, out, 1);
+  copy_hevc_profile_tier_level(in, out, max_sub_layers);
+  copy_ue(in, out); // sps_seq_parameter_set_id
+  if (copy_ue(in, out) == 3) // chroma_format_idc
+    copy_u(in, out, 1);
+
+  copy_ue(in, out);
+  copy_ue(in, out);
+  if (copy_u(in, out, 1)) { // conformance_window_flag
+    for (int i = 0; i < 4; i++)
+      copy_ue(in, out);
+  }
+
+  copy_ue(in, out);
+  copy_ue(in, out);
+  int log2_max_pic_order_cnt_lsb = copy_ue(in, out) + 4;
+  copy_hevc_sub_layer_ordering_info(in, out, max_sub_layers, flags);
+
+  for (int i = 0; i < 6; i++)
+    copy_ue(in, out);
+
+  if (copy_u(in, out, 1) && copy_u(in, out, 1)) // scaling_list_enabled_flag and sps_scaling_list_data_present_flag
+    copy_hevc_scaling_list_data(in, out);
+
+  copy_u(in, out, 2);
+  if (copy_u(in, out, 1)) { // pcm_enabled_flag
+    copy_u(in, out, 8);
+    copy_ue(in, out);
+    copy_ue(in, out);
+    copy_u(in, out, 1);
+  }
+
+  int num_short_term_ref_pic_sets = copy_ue(in, out);
+  if (num_short_term_ref_pic_sets > 64)
+    return -1;
+
+  for (int i = 0; i < num_short_term_ref_pic_sets; i++)
+    copy_hevc_st_ref_pic_set(in, out, i, num_delta_pocs);
+
+  if (copy_u(in, out, 1)) { // long_term_ref_pics_present_flag
+    int count = copy_ue(in, out);
+    for (int i = 0; i < count; i++)
+      copy_u(in, out, log2_max_pic_order_cnt_lsb + 1);
+  }
+
+  copy_u(in, out, 2);
+  if (copy_u(in, out, 1)) // vui_parameters_present_flag
+    copy_hevc_vui_parameters(in, out, max_sub_layers, flags);
+
+  copy_bits(in, out, end - bit_pos(in));
+  return 0;
+}
+
+// Position of the rbsp_stop_one_bit
+static int rbsp_end(uint8_t* rbsp, int size) {
+  while (size > 0 && rbsp[size - 1] == 0)
+    size--;
+
+  if (size == 0)
+    return 0;
+
+  int bits = size * 8 - 1;
+  for (int v = rbsp[size - 1]; (v & 1) == 0; v >>= 1)
+    bits--;
+
+  return bits;
+}
+
+static int rewrite_nal(char* input, int length, char* output, int size, int profile, int flags) {
+  uint8_t rbsp_in[MAX_SPS_SIZE], rbsp_out[MAX_SPS_SIZE];
+  int rbsp_size = gs_nal_unescape(input, length, (char*) rbsp_in);
+
+  bs_t in, out;
+  bs_init(&in, rbsp_in, rbsp_size);
+  bs_init(&out, rbsp_out, sizeof(rbsp_out));
+
+  int end = rbsp_end(rbsp_in, rbsp_size);
+  if ((flags & GS_SPS_HEVC) == GS_SPS_HEVC) {
+    copy_u(&in, &out, 16); // NAL header
+    if (((rbsp_in[0] >> 1) & 0x3F) == HEVC_NAL_UNIT_TYPE_VPS)
+      rewrite_hevc_vps(&in, &out, end, flags);
+    else if (rewrite_hevc_sps(&in, &out, end, flags) < 0)
+      return -1;
+  } else {
+    copy_u(&in, &out, 8); // NAL header
+    rewrite_sps(&in, &out, profile, flags);
+  }
+
+  // rbsp_trailing_bits
+  bs_write_u1(&out, 1);
+  while (!bs_byte_aligned(&out))
+    bs_write_u1(&out, 0);
+
+  if (bs_overrun(&in) || bs_overrun(&out) || bit_pos(&in) > end)
+    return -1;
+
+  return gs_nal_escape((char*) rbsp_out, bs_pos(&out), output, size);
+}
+
+static void cached_sps(struct sps_cache* sps, bool replay) {
+  if (sps->length[replay] == 0) {
+    const char naluHeader[] = {0x00, 0x00, 0x00, 0x01};
+    char* output = sps->output[replay];
+    int length = rewrite_nal(sps->input + 4, sps->inputLength - 4, output + 4, sizeof(sps->output[replay]) - 4, replay ? H264_PROFILE_HIGH : ((sps->flags & GS_SPS_BASELINE_HACK) == GS_SPS_BASELINE_HACK ? H264_PROFILE_BASELINE : 0), sps->flags);
+
+    // Pass the original SPS through if it can't be parsed
+    if (length < 0) {
+      memcpy(output, sps->input, sps->inputLength);
+      sps->length[replay] = sps->inputLength;
+    } else {
+      memcpy(output, naluHeader, sizeof(naluHeader));
+      sps->length[replay] = length + 4;
+    }
+  }
+
+  sps_entry.data = sps->output[replay];
+  sps_entry.length = sps->length[replay];
+}
+
+static struct sps_cache* find_sps(PLENTRY entry, int flags) {
+  for (int i = 0; i < SPS_CACHE_SIZE; i++) {
+    if (cache[i].inputLength == entry->length && cache[i].flags == flags && memcmp(cache[i].input, entry->data, entry->length) == 0)
+      return &cache[i];
+  }
+
+  struct sps_cache* sps = &cache[cacheNext];
+  cacheNext = (cacheNext + 1) % SPS_CACHE_SIZE;
+  memcpy(sps->input, entry->data, entry->length);
+  sps->inputLength = entry->length;
+  sps->flags = flags;
+  sps->length[0] = 0;
+  sps->length[1] = 0;
+  return sps;
+}
+
+void gs_sps_init(int width, int height) {
+  initial_width = width;
+  initial_height = height;
+  replay_sps = 0;
+  last_sps = NULL;
+  memset(cache, 0, sizeof(cache));
+}
+
+static PLENTRY hevc_fix(PLENTRY entry, int flags) {
+  int type = (entry->data[4] >> 1) & 0x3F;
+  if ((type != HEVC_NAL_UNIT_TYPE_VPS && type != HEVC_NAL_UNIT_TYPE_SPS) || entry->length > MAX_SPS_SIZE)
+    return entry;
+
+  cached_sps(find_sps(entry, flags), false);
+  sps_entry.next = entry->next;
+  return &sps_entry;
+}
+
+PLENTRY gs_sps_fix(PLENTRY entry, int flags) {
+  if ((flags & GS_SPS_HEVC) == GS_SPS_HEVC)
+    return hevc_fix(entry, flags);
+
+  if (replay_sps == 1 && last_sps != NULL) {
+    cached_sps(last_sps, true);
+    sps_entry.next = entry;
+    replay_sps = 2;
+    return &sps_entry;
+  } else if ((entry->data[4] & 0x1F) == NAL_UNIT_TYPE_SPS) {
+    if (entry->length > MAX_SPS_SIZE)
+      return entry;
+
+    // The baseline hack only applies until the SPS has been replayed once
+    if (replay_sps)
+      flags &= ~GS_SPS_BASELINE_HACK;
+
+    last_sps = find_sps(entry, flags);
+    cached_sps(last_sps, false);
+    sps_entry.next = entry->next;
+    return &sps_entry;
   } else if ((entry->data[4] & 0x1F) == NAL_UNIT_TYPE_PPS) {
     if ((flags & GS_SPS_BASELINE_HACK) == GS_SPS_BASELINE_HACK && !replay_sps)
       replay_sps = 1;
-
   }
-  *head = entry;
+
   return entry;
 }
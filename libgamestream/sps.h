@@ -21,6 +21,16 @@
 
 #define GS_SPS_BITSTREAM_FIXUP 0x01
 #define GS_SPS_BASELINE_HACK 0x02
+#define GS_SPS_HEVC 0x04
 
-void gs_sps_init();
-PLENTRY gs_sps_fix(PLENTRY *entry, int flags);
+// Only parameter sets up to GS_SPS_MAX_SIZE bytes are rewritten, and a
+// rewritten entry is at most GS_SPS_MAX_LENGTH bytes
+#define GS_SPS_MAX_SIZE 128
+#define GS_SPS_MAX_LENGTH (GS_SPS_MAX_SIZE * 4 / 3 + 4)
+
+void gs_sps_init(int width, int height);
+
+// Returns the entry to submit instead of the given entry. A rewritten SPS is
+// emitted from a preallocated entry, so the list owned by the decode unit is
+// never modified and the returned entry is only valid until the next call.
+PLENTRY gs_sps_fix(PLENTRY entry, int flags);
@@ -119,6 +119,94 @@ int xml_search(char* data, size_t len, char* node, char** result) {
   return GS_OK;
 }
 
+struct xml_multi_query {
+  char** nodes;
+  char** results;
+  bool* found;
+  size_t* sizes;
+  int count;
+  int current;
+};
+
+static void XMLCALL _xml_start_multi_element(void *userData, const char *name, const char **atts) {
+  struct xml_multi_query *search = (struct xml_multi_query*) userData;
+  for (int i = 0; i < search->count; i++) {
+    if (strcmp(search->nodes[i], name) == 0) {
+      search->current = i;
+      if (search->found != NULL)
+        search->found[i] = true;
+      break;
+    }
+  }
+}
+
+static void XMLCALL _xml_end_multi_element(void *userData, const char *name) {
+  struct xml_multi_query *search = (struct xml_multi_query*) userData;
+  if (search->current >= 0 && strcmp(search->nodes[search->current], name) == 0)
+    search->current = -1;
+}
+
+static void XMLCALL _xml_write_multi_data(void *userData, const XML_Char *s, int len) {
+  struct xml_multi_query *search = (struct xml_multi_query*) userData;
+  if (search->current >= 0) {
+    int i = search->current;
+    char* memory = realloc(search->results[i], search->sizes[i] + len + 1);
+    if(memory == NULL)
+      return;
+
+    memcpy(&memory[search->sizes[i]], s, len);
+    search->sizes[i] += len;
+    memory[search->sizes[i]] = 0;
+    search->results[i] = memory;
+  }
+}
+
+// Search multiple nodes in a single pass, missing nodes result in empty strings
+// and are marked in found when it isn't NULL
+int xml_search_nodes(char* data, size_t len, char** nodes, char** results, bool* found, int count) {
+  struct xml_multi_query search;
+  search.nodes = nodes;
+  search.results = results;
+  search.found = found;
+  search.count = count;
+  search.current = -1;
+  search.sizes = calloc(count, sizeof(size_t));
+  if (search.sizes == NULL)
+    return GS_OUT_OF_MEMORY;
+
+  int ret = GS_OK;
+  for (int i = 0; i < count; i++) {
+    results[i] = calloc(1, 1);
+    if (results[i] == NULL)
+      ret = GS_OUT_OF_MEMORY;
+    if (found != NULL)
+      found[i] = false;
+  }
+
+  if (ret == GS_OK) {
+    XML_Parser parser = XML_ParserCreate("UTF-8");
+    XML_SetUserData(parser, &search);
+    XML_SetElementHandler(parser, _xml_start_multi_element, _xml_end_multi_element);
+    XML_SetCharacterDataHandler(parser, _xml_write_multi_data);
+    if (! XML_Parse(parser, data, len, 1)) {
+      int code = XML_GetErrorCode(parser);
+      gs_error = XML_ErrorString(code);
+      ret = GS_INVALID;
+    }
+    XML_ParserFree(parser);
+  }
+
+  if (ret != GS_OK) {
+    for (int i = 0; i < count; i++) {
+      free(results[i]);
+      results[i] = NULL;
+    }
+  }
+
+  free(search.sizes);
+  return ret;
+}
+
 int xml_applist(char* data, size_t len, PAPP_LIST *app_list) {
   struct xml_query query;
   query.memory = calloc(1, 1);
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdbool.h>
 
 typedef struct _APP_LIST {
   char* name;
@@ -27,4 +28,5 @@ typedef struct _APP_LIST {
 } APP_LIST, *PAPP_LIST;
 
 int xml_search(char* data, size_t len, char* node, char** result);
+int xml_search_nodes(char* data, size_t len, char** nodes, char** results, bool* found, int count);
 int xml_applist(char* data, size_t len, PAPP_LIST *app_list);
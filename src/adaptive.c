@@ -0,0 +1,238 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "adaptive.h"
+
+#include "frame.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+// Conditions are evaluated over windows of frames
+#define WINDOW_US 2000000
+// Consecutive bad windows before stepping down a tier
+#define DEGRADE_WINDOWS 2
+// Consecutive good windows before stepping up a tier, doubled every time
+// stepping up is followed by stepping down within OSCILLATION_US
+#define UPGRADE_WINDOWS 15
+#define MAX_UPGRADE_WINDOWS 240
+#define OSCILLATION_US 60000000
+
+// Thresholds for a bad window
+#define LOSS_EVENTS 2
+#define OVERLOAD_PERCENTAGE 85
+#define QUEUED_PERCENTAGE 50
+// A decode unit submitted this soon after the previous one was waiting for it
+#define QUEUED_GAP_US 1000
+
+// Every tier lowers the bitrate, the resolution is lowered when the
+// bitrate isn't sufficient for the resolution anymore
+#define TIER_PERCENTAGE 75
+#define MAX_TIERS 8
+#define MIN_BITRATE 1000
+#define KBPS_PER_MEGAPIXEL 70
+
+static const int heights[] = { 2160, 1440, 1080, 720, 540, 360 };
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool enabled;
+static AdaptiveInterrupt adaptive_interrupt;
+static STREAM_CONFIGURATION base;
+static int tier, tiers, pending = -1;
+static int upgrade_windows;
+static long long last_upgrade;
+
+static DECODER_RENDERER_CALLBACKS adaptive_callbacks;
+static PDECODER_RENDERER_CALLBACKS adaptive_target;
+
+// Statistics of the current window
+static long long window_start, previous_end, frame_period, decode_time;
+static int frames, losses, queued;
+static int bad_windows, good_windows;
+static bool settling, idr_received, idr_requested;
+
+static long long adaptive_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void adaptive_tier_config(int index, PSTREAM_CONFIGURATION config) {
+  int bitrate = base.bitrate;
+  for (int i = 0; i < index; i++)
+    bitrate = bitrate * TIER_PERCENTAGE / 100;
+
+  config->bitrate = bitrate;
+  config->width = base.width;
+  config->height = base.height;
+  if (index == 0)
+    return;
+
+  // Keep the aspect ratio and never go above the requested resolution
+  for (int i = -1; i < (int) (sizeof(heights) / sizeof(heights[0])); i++) {
+    int height = i < 0 ? base.height : heights[i];
+    if (height > base.height || (i >= 0 && height == base.height))
+      continue;
+
+    config->height = height;
+    config->width = (int) ((long long) base.width * height / base.height) & ~1;
+    if ((long long) config->width * config->height * base.fps * KBPS_PER_MEGAPIXEL / 1000000 <= bitrate)
+      break;
+  }
+}
+
+void adaptive_init(PSTREAM_CONFIGURATION config, AdaptiveInterrupt interrupt) {
+  enabled = true;
+  adaptive_interrupt = interrupt;
+  base = *config;
+  tier = 0;
+  pending = -1;
+  upgrade_windows = UPGRADE_WINDOWS;
+
+  tiers = 1;
+  for (int bitrate = base.bitrate * TIER_PERCENTAGE / 100; tiers < MAX_TIERS && bitrate >= MIN_BITRATE; bitrate = bitrate * TIER_PERCENTAGE / 100)
+    tiers++;
+}
+
+// Returns true and updates the configuration when the stream has to be
+// restarted with another tier
+bool adaptive_restart(PSTREAM_CONFIGURATION config) {
+  pthread_mutex_lock(&lock);
+  bool restart = enabled && pending >= 0;
+  if (restart) {
+    tier = pending;
+    pending = -1;
+    adaptive_tier_config(tier, config);
+    printf("Adaptive: switching to %dx%d at %d kbps\n", config->width, config->height, config->bitrate);
+  }
+  pthread_mutex_unlock(&lock);
+  return restart;
+}
+
+static void adaptive_reset_window(long long now) {
+  window_start = now;
+  decode_time = 0;
+  frames = 0;
+  losses = 0;
+  queued = 0;
+}
+
+static void adaptive_change(int index, const char* reason) {
+  printf("Adaptive: %s, stepping %s to tier %d of %d\n", reason, index > tier ? "down" : "up", index + 1, tiers);
+  pending = index;
+  adaptive_interrupt();
+}
+
+static void adaptive_evaluate(long long now) {
+  // The first window of a stream contains the startup of the decoder
+  if (settling || frames == 0) {
+    settling = false;
+    return;
+  }
+
+  const char* reason = NULL;
+  if (losses >= LOSS_EVENTS)
+    reason = "frames lost";
+  else if (decode_time / frames > frame_period * OVERLOAD_PERCENTAGE / 100)
+    reason = "decoder overloaded";
+  else if (queued * 100 > frames * QUEUED_PERCENTAGE)
+    reason = "frames queueing up";
+
+  if (reason != NULL) {
+    good_windows = 0;
+    if (++bad_windows >= DEGRADE_WINDOWS && tier + 1 < tiers) {
+      if (now - last_upgrade < OSCILLATION_US && upgrade_windows < MAX_UPGRADE_WINDOWS)
+        upgrade_windows *= 2;
+
+      adaptive_change(tier + 1, reason);
+    }
+  } else {
+    bad_windows = 0;
+    if (++good_windows >= upgrade_windows && tier > 0) {
+      last_upgrade = now;
+      adaptive_change(tier - 1, "stream stable");
+    }
+  }
+}
+
+static void adaptive_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  pthread_mutex_lock(&lock);
+  frame_period = 1000000 / (redrawRate > 0 ? redrawRate : 60);
+  previous_end = 0;
+  bad_windows = good_windows = 0;
+  settling = true;
+  idr_received = idr_requested = false;
+  adaptive_reset_window(adaptive_time_us());
+  pthread_mutex_unlock(&lock);
+
+  adaptive_target->setup(videoFormat, width, height, redrawRate, context, drFlags);
+}
+
+static int adaptive_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  long long start = adaptive_time_us();
+  int ret = adaptive_target->submitDecodeUnit(decodeUnit);
+  long long end = adaptive_time_us();
+  PFRAME_INFO info = gs_frame_info(decodeUnit);
+
+  pthread_mutex_lock(&lock);
+  frames++;
+  decode_time += end - start;
+  if (previous_end > 0 && start - previous_end < QUEUED_GAP_US)
+    queued++;
+
+  // After the first, every IDR frame is sent to recover from lost frames.
+  // An IDR frame requested by the decoder was already counted with the
+  // request, as were repeated requests while waiting for it.
+  if (ret == DR_NEED_IDR) {
+    if (!idr_requested)
+      losses++;
+
+    idr_requested = true;
+  } else if (info != NULL && info->type == FRAME_IDR) {
+    if (idr_received && !idr_requested)
+      losses++;
+
+    idr_received = true;
+    idr_requested = false;
+  }
+
+  previous_end = end;
+  if (end - window_start >= WINDOW_US) {
+    if (pending < 0)
+      adaptive_evaluate(end);
+
+    adaptive_reset_window(end);
+  }
+  pthread_mutex_unlock(&lock);
+  return ret;
+}
+
+// Watch frame loss, decode time and queueing of decode units
+PDECODER_RENDERER_CALLBACKS adaptive_video(PDECODER_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL || !enabled)
+    return callbacks;
+
+  adaptive_target = callbacks;
+  adaptive_callbacks = *callbacks;
+  adaptive_callbacks.setup = adaptive_setup;
+  adaptive_callbacks.submitDecodeUnit = adaptive_submit_decode_unit;
+  return &adaptive_callbacks;
+}
@@ -0,0 +1,35 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2015, 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "audio.h"
+
+/* The supplied mapping array has order: FL-FR-C-LFE-RL-RR
+ * ALSA expects the order: FL-FR-RL-RR-C-LFE
+ * We need copy the mapping locally and swap the channels around.
+ */
+void audio_alsa_mapping(POPUS_MULTISTREAM_CONFIGURATION opusConfig, unsigned char* mapping) {
+  mapping[0] = opusConfig->mapping[0];
+  mapping[1] = opusConfig->mapping[1];
+  if (opusConfig->channelCount == 6) {
+    mapping[2] = opusConfig->mapping[4];
+    mapping[3] = opusConfig->mapping[5];
+    mapping[4] = opusConfig->mapping[2];
+    mapping[5] = opusConfig->mapping[3];
+  }
+}
@@ -23,9 +23,14 @@
 
 extern const char* audio_device;
 
+// Reorder the Opus channel mapping to the channel order of ALSA
+void audio_alsa_mapping(POPUS_MULTISTREAM_CONFIGURATION opusConfig, unsigned char* mapping);
+
 extern AUDIO_RENDERER_CALLBACKS audio_callbacks_alsa;
+void audio_alsa_prepare();
 #ifdef HAVE_SDL
 extern AUDIO_RENDERER_CALLBACKS audio_callbacks_sdl;
+void audio_sdl_prepare();
 #endif
 #ifdef HAVE_PULSE
 extern AUDIO_RENDERER_CALLBACKS audio_callbacks_pulse;
@@ -32,22 +32,20 @@ static snd_pcm_t *handle;
 static OpusMSDecoder* decoder;
 static short pcmBuffer[FRAME_SIZE * MAX_CHANNEL_COUNT];
 
+void audio_alsa_prepare() {
+  if (audio_device == NULL)
+    audio_device = "sysdefault";
+
+  // Opening the device is the slow part, the parameters follow in init
+  if (handle == NULL && snd_pcm_open(&handle, audio_device, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK) < 0)
+    handle = NULL;
+}
+
 static void alsa_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig) {
   int rc;
   unsigned char alsaMapping[6];
 
-  /* The supplied mapping array has order: FL-FR-C-LFE-RL-RR
-   * ALSA expects the order: FL-FR-RL-RR-C-LFE
-   * We need copy the mapping locally and swap the channels around.
-   */
-  alsaMapping[0] = opusConfig->mapping[0];
-  alsaMapping[1] = opusConfig->mapping[1];
-  if (opusConfig->channelCount == 6) {
-    alsaMapping[2] = opusConfig->mapping[4];
-    alsaMapping[3] = opusConfig->mapping[5];
-    alsaMapping[4] = opusConfig->mapping[2];
-    alsaMapping[5] = opusConfig->mapping[3];
-  }
+  audio_alsa_mapping(opusConfig, alsaMapping);
 
   decoder = opus_multistream_decoder_create(opusConfig->sampleRate,
                                             opusConfig->channelCount,
@@ -65,8 +63,9 @@ static void alsa_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGU
   if (audio_device == NULL)
     audio_device = "sysdefault";
 
-  /* Open PCM device for playback. */
-  CHECK_RETURN(snd_pcm_open(&handle, audio_device, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK))
+  /* Open PCM device for playback, unless it was prepared already. */
+  if (handle == NULL)
+    CHECK_RETURN(snd_pcm_open(&handle, audio_device, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK))
 
   /* Set hardware parameters */
   CHECK_RETURN(snd_pcm_hw_params_malloc(&hw_params));
@@ -92,12 +91,15 @@ static void alsa_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGU
 }
 
 static void alsa_renderer_cleanup() {
-  if (decoder != NULL)
+  if (decoder != NULL) {
     opus_multistream_decoder_destroy(decoder);
+    decoder = NULL;
+  }
 
   if (handle != NULL) {
     snd_pcm_drain(handle);
     snd_pcm_close(handle);
+    handle = NULL;
   }
 }
 
@@ -33,6 +33,10 @@ static short pcmBuffer[FRAME_SIZE * MAX_CHANNEL_COUNT];
 static SDL_AudioDeviceID dev;
 static int channelCount;
 
+void audio_sdl_prepare() {
+  SDL_InitSubSystem(SDL_INIT_AUDIO);
+}
+
 static void sdl_renderer_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig) {
   int rc;
   decoder = opus_multistream_decoder_create(opusConfig->sampleRate,
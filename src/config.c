@@ -39,6 +39,7 @@
 bool inputAdded = false;
 static bool mapped = true;
 const char* audio_device = NULL;
+int decoder_threads = 0;
 
 static struct option long_options[] = {
   {"720", no_argument, NULL, 'a'},
@@ -66,6 +67,15 @@ static struct option long_options[] = {
   {"forcehw", no_argument, NULL, 'w'},
   {"forcehevc", no_argument, NULL, 'x'},
   {"unsupported", no_argument, NULL, 'y'},
+  {"startuptrace", required_argument, NULL, 'z'},
+  {"decoder-threads", required_argument, NULL, 'A'},
+  {"adaptive", no_argument, NULL, 'B'},
+  {"auto", no_argument, NULL, 'C'},
+  {"decoder-capacity", required_argument, NULL, 'D'},
+  {"sessionlog", required_argument, NULL, 'E'},
+  {"metrics", required_argument, NULL, 'F'},
+  {"trace", required_argument, NULL, 'G'},
+  {"gamepad-rate", required_argument, NULL, 'H'},
   {0, 0, 0, 0},
 };
 
@@ -139,6 +149,7 @@ static void parse_argument(int c, char* value, PCONFIGURATION config) {
     break;
   case 'g':
     config->stream.bitrate = atoi(value);
+    config->explicit_bitrate = true;
     break;
   case 'h':
     config->stream.packetSize = atoi(value);
@@ -209,11 +220,40 @@ static void parse_argument(int c, char* value, PCONFIGURATION config) {
   case 'y':
     config->unsupported_version = true;
     break;
+  case 'z':
+    config->startup_trace = value;
+    break;
+  case 'A':
+    decoder_threads = atoi(value);
+    break;
+  case 'B':
+    config->adaptive = true;
+    break;
+  case 'C':
+    config->autoconfig = true;
+    break;
+  case 'D':
+    config->decoder_capacity = atoi(value);
+    break;
+  case 'E':
+    config->session_log = value;
+    break;
+  case 'F':
+    config->metrics_socket = value;
+    break;
+  case 'G':
+    config->trace_file = value;
+    break;
+  case 'H':
+    config->gamepad_rate = atoi(value);
+    break;
   case 1:
     if (config->action == NULL)
       config->action = value;
     else if (config->address == NULL)
       config->address = value;
+    else if (strcmp(config->action, "hosts") == 0 && config->hostsCount < MAX_HOSTS)
+      config->hosts[config->hostsCount++] = value;
     else {
       perror("Too many options");
       exit(-1);
@@ -240,6 +280,10 @@ bool config_file_parse(char* filename, PCONFIGURATION config) {
         config->sops = strcmp("true", value) == 0;
       } else if (strcmp(key, "localaudio") == 0) {
         config->localaudio = strcmp("true", value) == 0;
+      } else if (strcmp(key, "adaptive") == 0) {
+        config->adaptive = strcmp("true", value) == 0;
+      } else if (strcmp(key, "auto") == 0) {
+        config->autoconfig = strcmp("true", value) == 0;
       } else {
         for (int i=0;long_options[i].name != NULL;i++) {
           if (long_options[i].has_arg == required_argument && strcmp(long_options[i].name, key) == 0) {
@@ -273,9 +317,21 @@ void config_save(char* filename, PCONFIGURATION config) {
     write_config_bool(fd, "sops", config->sops);
   if (config->localaudio)
     write_config_bool(fd, "localaudio", config->localaudio);
+  if (config->adaptive)
+    write_config_bool(fd, "adaptive", config->adaptive);
+  if (config->autoconfig)
+    write_config_bool(fd, "auto", config->autoconfig);
 
   if (strcmp(config->app, "Steam") != 0)
     write_config_string(fd, "app", config->app);
+  if (config->session_log != NULL)
+    write_config_string(fd, "sessionlog", config->session_log);
+  if (config->metrics_socket != NULL)
+    write_config_string(fd, "metrics", config->metrics_socket);
+  if (config->trace_file != NULL)
+    write_config_string(fd, "trace", config->trace_file);
+  if (config->gamepad_rate != 120)
+    write_config_int(fd, "gamepad-rate", config->gamepad_rate);
 
   fclose(fd);
 }
@@ -297,13 +353,23 @@ void config_parse(int argc, char* argv[], PCONFIGURATION config) {
   config->action = NULL;
   config->address = NULL;
   config->config_file = NULL;
+  config->startup_trace = NULL;
+  config->session_log = NULL;
+  config->metrics_socket = NULL;
+  config->trace_file = NULL;
+  config->gamepad_rate = 120;
   config->sops = true;
   config->localaudio = false;
   config->fullscreen = true;
   config->unsupported_version = false;
   config->forcehw = false;
+  config->adaptive = false;
+  config->autoconfig = false;
+  config->explicit_bitrate = false;
+  config->decoder_capacity = 0;
 
   config->inputsCount = 0;
+  config->hostsCount = 0;
   config->mapping = get_path("mappings/default.conf", getenv("XDG_DATA_DIRS"));
   config->key_dir[0] = 0;
 
@@ -319,7 +385,7 @@ void config_parse(int argc, char* argv[], PCONFIGURATION config) {
   } else {
     int option_index = 0;
     int c;
-    while ((c = getopt_long_only(argc, argv, "-abc:d:efg:h:i:j:k:lm:no:p:q:r:stuv:w:xy", long_options, &option_index)) != -1) {
+    while ((c = getopt_long_only(argc, argv, "-abc:d:efg:h:i:j:k:lm:no:p:q:r:stuv:w:xyz:A:BCD:E:F:G:H:", long_options, &option_index)) != -1) {
       parse_argument(c, optarg, config);
     }
   }
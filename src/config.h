@@ -17,11 +17,14 @@
  * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#pragma once
+
 #include <Limelight.h>
 
 #include <stdbool.h>
 
 #define MAX_INPUTS 6
+#define MAX_HOSTS 64
 
 struct input_config {
   char* path;
@@ -36,14 +39,25 @@ typedef struct _CONFIGURATION {
   char* mapping;
   char* platform;
   char* config_file;
+  char* startup_trace;
+  char* session_log;
+  char* metrics_socket;
+  char* trace_file;
+  int gamepad_rate;
   char key_dir[4096];
   bool sops;
   bool localaudio;
   bool fullscreen;
   bool forcehw;
   bool unsupported_version;
+  bool adaptive;
+  bool autoconfig;
+  bool explicit_bitrate;
+  int decoder_capacity;
   struct input_config inputs[MAX_INPUTS];
   int inputsCount;
+  char* hosts[MAX_HOSTS];
+  int hostsCount;
 } CONFIGURATION, *PCONFIGURATION;
 
 bool inputAdded;
@@ -0,0 +1,349 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_SDL
+
+#include "gl.h"
+
+#include <SDL_opengl.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// Uploads go through a ring of pixel buffers, so the buffer being written
+// is never one the GPU is still reading from
+#define UPLOAD_BUFFERS 3
+#define FENCE_TIMEOUT 1000000000
+
+// Functions are loaded at runtime, so no GL library is needed at link time
+#define GL_FUNCTIONS(X) \
+  X(const GLubyte*, GetString, GLenum) \
+  X(void, Viewport, GLint, GLint, GLsizei, GLsizei) \
+  X(void, ClearColor, GLfloat, GLfloat, GLfloat, GLfloat) \
+  X(void, Clear, GLbitfield) \
+  X(void, PixelStorei, GLenum, GLint) \
+  X(void, GenTextures, GLsizei, GLuint*) \
+  X(void, DeleteTextures, GLsizei, const GLuint*) \
+  X(void, BindTexture, GLenum, GLuint) \
+  X(void, ActiveTexture, GLenum) \
+  X(void, TexParameteri, GLenum, GLenum, GLint) \
+  X(void, TexImage2D, GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*) \
+  X(void, TexSubImage2D, GLenum, GLint, GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, const void*) \
+  X(void, GenBuffers, GLsizei, GLuint*) \
+  X(void, DeleteBuffers, GLsizei, const GLuint*) \
+  X(void, BindBuffer, GLenum, GLuint) \
+  X(void, BufferData, GLenum, GLsizeiptr, const void*, GLenum) \
+  X(void*, MapBufferRange, GLenum, GLintptr, GLsizeiptr, GLbitfield) \
+  X(GLboolean, UnmapBuffer, GLenum) \
+  X(GLsync, FenceSync, GLenum, GLbitfield) \
+  X(GLenum, ClientWaitSync, GLsync, GLbitfield, GLuint64) \
+  X(void, DeleteSync, GLsync) \
+  X(void, GenVertexArrays, GLsizei, GLuint*) \
+  X(void, BindVertexArray, GLuint) \
+  X(void, DrawArrays, GLenum, GLint, GLsizei) \
+  X(GLuint, CreateShader, GLenum) \
+  X(void, ShaderSource, GLuint, GLsizei, const GLchar* const*, const GLint*) \
+  X(void, CompileShader, GLuint) \
+  X(void, GetShaderiv, GLuint, GLenum, GLint*) \
+  X(void, GetShaderInfoLog, GLuint, GLsizei, GLsizei*, GLchar*) \
+  X(void, DeleteShader, GLuint) \
+  X(GLuint, CreateProgram, void) \
+  X(void, AttachShader, GLuint, GLuint) \
+  X(void, LinkProgram, GLuint) \
+  X(void, GetProgramiv, GLuint, GLenum, GLint*) \
+  X(void, UseProgram, GLuint) \
+  X(GLint, GetUniformLocation, GLuint, const GLchar*) \
+  X(void, Uniform1i, GLint, GLint)
+
+#define GL_FUNCTION_DECLARE(ret, name, ...) ret (APIENTRY *name)(__VA_ARGS__);
+#define GL_FUNCTION_LOAD(ret, name, ...) if ((gl.name = SDL_GL_GetProcAddress("gl" #name)) == NULL) return false;
+
+static struct {
+  GL_FUNCTIONS(GL_FUNCTION_DECLARE)
+  void (APIENTRY *BufferStorage)(GLenum, GLsizeiptr, const void*, GLbitfield);
+} gl;
+
+struct upload_buffer {
+  GLuint pbo;
+  GLsync fence;
+  Uint8* memory; // Persistently mapped memory or NULL
+  int linesize[3];
+};
+
+static SDL_GLContext context;
+static SDL_Window* gl_window;
+static GLuint program, vao, textures[3];
+static struct upload_buffer buffers[UPLOAD_BUFFERS];
+static int buffer_size, current = -1, next;
+static int frame_width, frame_height;
+static bool persistent, es;
+
+static const char* vertex_shader =
+  "out vec2 tex_coord;\n"
+  "void main() {\n"
+  "  vec2 pos = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));\n"
+  "  tex_coord = vec2(pos.x, 1.0 - pos.y);\n"
+  "  gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);\n"
+  "}\n";
+
+// BT.601 limited range, as sent by GFE
+static const char* fragment_shader =
+  "in vec2 tex_coord;\n"
+  "out vec4 color;\n"
+  "uniform sampler2D plane_y;\n"
+  "uniform sampler2D plane_u;\n"
+  "uniform sampler2D plane_v;\n"
+  "void main() {\n"
+  "  vec3 yuv = vec3(texture(plane_y, tex_coord).r, texture(plane_u, tex_coord).r, texture(plane_v, tex_coord).r);\n"
+  "  yuv -= vec3(0.0625, 0.5, 0.5);\n"
+  "  color = vec4(mat3(1.164, 1.164, 1.164, 0.0, -0.392, 2.017, 1.596, -0.813, 0.0) * yuv, 1.0);\n"
+  "}\n";
+
+static GLuint compile_shader(GLenum type, const char* source) {
+  const char* sources[] = { es ? "#version 300 es\nprecision mediump float;\n" : "#version 330 core\n", source };
+  GLuint shader = gl.CreateShader(type);
+  gl.ShaderSource(shader, 2, sources, NULL);
+  gl.CompileShader(shader);
+
+  GLint status;
+  gl.GetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (!status) {
+    char log[1024];
+    gl.GetShaderInfoLog(shader, sizeof(log), NULL, log);
+    fprintf(stderr, "GL: Couldn't compile shader - %s\n", log);
+    gl.DeleteShader(shader);
+    return 0;
+  }
+
+  return shader;
+}
+
+static bool create_context(SDL_Window* window, bool gles) {
+  SDL_GL_ResetAttributes();
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, gles ? SDL_GL_CONTEXT_PROFILE_ES : SDL_GL_CONTEXT_PROFILE_CORE);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, gles ? 0 : 3);
+
+  context = SDL_GL_CreateContext(window);
+  es = gles;
+  return context != NULL;
+}
+
+static bool load_functions() {
+  GL_FUNCTIONS(GL_FUNCTION_LOAD)
+
+  // Persistent mapping requires OpenGL 4.4 or the buffer storage extension
+  gl.BufferStorage = NULL;
+  if (SDL_GL_ExtensionSupported(es ? "GL_EXT_buffer_storage" : "GL_ARB_buffer_storage"))
+    gl.BufferStorage = SDL_GL_GetProcAddress(es ? "glBufferStorageEXT" : "glBufferStorage");
+
+  return true;
+}
+
+static bool create_program() {
+  GLuint vertex = compile_shader(GL_VERTEX_SHADER, vertex_shader);
+  GLuint fragment = compile_shader(GL_FRAGMENT_SHADER, fragment_shader);
+  if (!vertex || !fragment)
+    return false;
+
+  program = gl.CreateProgram();
+  gl.AttachShader(program, vertex);
+  gl.AttachShader(program, fragment);
+  gl.LinkProgram(program);
+  gl.DeleteShader(vertex);
+  gl.DeleteShader(fragment);
+
+  GLint status;
+  gl.GetProgramiv(program, GL_LINK_STATUS, &status);
+  if (!status) {
+    fprintf(stderr, "GL: Couldn't link shader program\n");
+    return false;
+  }
+
+  gl.UseProgram(program);
+  gl.Uniform1i(gl.GetUniformLocation(program, "plane_y"), 0);
+  gl.Uniform1i(gl.GetUniformLocation(program, "plane_u"), 1);
+  gl.Uniform1i(gl.GetUniformLocation(program, "plane_v"), 2);
+  return true;
+}
+
+static void create_textures(int width, int height) {
+  gl.GenTextures(3, textures);
+  for (int i = 0; i < 3; i++) {
+    gl.ActiveTexture(GL_TEXTURE0 + i);
+    gl.BindTexture(GL_TEXTURE_2D, textures[i]);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl.TexImage2D(GL_TEXTURE_2D, 0, GL_R8, i == 0 ? width : (width + 1) / 2, i == 0 ? height : (height + 1) / 2, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+  }
+}
+
+static void destroy_buffers() {
+  for (int i = 0; i < UPLOAD_BUFFERS; i++) {
+    if (buffers[i].fence != NULL)
+      gl.DeleteSync(buffers[i].fence);
+
+    if (buffers[i].memory != NULL) {
+      gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i].pbo);
+      gl.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    if (buffers[i].pbo != 0)
+      gl.DeleteBuffers(1, &buffers[i].pbo);
+  }
+  gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  memset(buffers, 0, sizeof(buffers));
+  buffer_size = 0;
+}
+
+// The size of the buffers depends on the line sizes used by the decoder,
+// so the buffers are only created when the first frame is uploaded
+static void create_buffers(int size) {
+  destroy_buffers();
+  for (int i = 0; i < UPLOAD_BUFFERS; i++) {
+    gl.GenBuffers(1, &buffers[i].pbo);
+    gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i].pbo);
+    if (persistent) {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      gl.BufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+      buffers[i].memory = gl.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+    } else
+      gl.BufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+  }
+  gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  buffer_size = size;
+}
+
+bool gl_init(SDL_Window* window, int width, int height) {
+  if (!create_context(window, false) && !create_context(window, true)) {
+    SDL_GL_ResetAttributes();
+    return false;
+  }
+
+  if (!load_functions() || !create_program()) {
+    SDL_GL_DeleteContext(context);
+    SDL_GL_ResetAttributes();
+    context = NULL;
+    return false;
+  }
+
+  persistent = gl.BufferStorage != NULL;
+  printf("GL: Using %s with %s uploads\n", gl.GetString(GL_RENDERER), persistent ? "persistent" : "mapped");
+
+  gl.GenVertexArrays(1, &vao);
+  gl.BindVertexArray(vao);
+  create_textures(width, height);
+  gl.ClearColor(0, 0, 0, 1);
+
+  SDL_GL_SetSwapInterval(1);
+  gl_window = window;
+  frame_width = width;
+  frame_height = height;
+  return true;
+}
+
+// Copy the planes of a decoded frame to the next upload buffer,
+// this is the only part that needs access to the decoder output
+void gl_upload(Uint8** data, int* linesize) {
+  int heights[] = { frame_height, (frame_height + 1) / 2, (frame_height + 1) / 2 };
+  int size = linesize[0] * heights[0] + linesize[1] * heights[1] + linesize[2] * heights[2];
+  if (size > buffer_size)
+    create_buffers(size);
+
+  struct upload_buffer* buffer = &buffers[next];
+  if (buffer->fence != NULL) {
+    // Only blocks when the GPU is more than two frames behind
+    gl.ClientWaitSync(buffer->fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+    gl.DeleteSync(buffer->fence);
+    buffer->fence = NULL;
+  }
+
+  Uint8* memory = buffer->memory;
+  if (memory == NULL) {
+    gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->pbo);
+    memory = gl.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (memory == NULL)
+      return;
+  }
+
+  for (int i = 0, offset = 0; i < 3; i++) {
+    memcpy(memory + offset, data[i], linesize[i] * heights[i]);
+    offset += linesize[i] * heights[i];
+    buffer->linesize[i] = linesize[i];
+  }
+
+  if (buffer->memory == NULL) {
+    gl.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  current = next;
+  next = (next + 1) % UPLOAD_BUFFERS;
+}
+
+void gl_draw() {
+  if (current < 0)
+    return;
+
+  struct upload_buffer* buffer = &buffers[current];
+  int heights[] = { frame_height, (frame_height + 1) / 2, (frame_height + 1) / 2 };
+  int widths[] = { frame_width, (frame_width + 1) / 2, (frame_width + 1) / 2 };
+
+  gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->pbo);
+  for (int i = 0, offset = 0; i < 3; i++) {
+    gl.ActiveTexture(GL_TEXTURE0 + i);
+    gl.PixelStorei(GL_UNPACK_ROW_LENGTH, buffer->linesize[i]);
+    gl.TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, widths[i], heights[i], GL_RED, GL_UNSIGNED_BYTE, (void*) (intptr_t) offset);
+    offset += buffer->linesize[i] * heights[i];
+  }
+  gl.PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  // The buffer can be reused as soon as the texture upload is done
+  buffer->fence = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  current = -1;
+
+  int width, height;
+  SDL_GL_GetDrawableSize(gl_window, &width, &height);
+  gl.Viewport(0, 0, width, height);
+  gl.Clear(GL_COLOR_BUFFER_BIT);
+  gl.DrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void gl_resize(int width, int height) {
+  gl.DeleteTextures(3, textures);
+  create_textures(width, height);
+  frame_width = width;
+  frame_height = height;
+  current = -1;
+}
+
+void gl_destroy() {
+  if (context == NULL)
+    return;
+
+  destroy_buffers();
+  gl.DeleteTextures(3, textures);
+  SDL_GL_DeleteContext(context);
+  context = NULL;
+}
+
+#endif /* HAVE_SDL */
@@ -0,0 +1,32 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_SDL
+
+#include <SDL.h>
+
+#include <stdbool.h>
+
+bool gl_init(SDL_Window* window, int width, int height);
+void gl_upload(Uint8** data, int* linesize);
+void gl_draw();
+void gl_resize(int width, int height);
+void gl_destroy();
+
+#endif /* HAVE_SDL */
@@ -0,0 +1,62 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "histogram.h"
+
+void histogram_add(PHISTOGRAM histogram, long long us) {
+  long long bucket = us / HISTOGRAM_BUCKET_US;
+  if (bucket < 0)
+    bucket = 0;
+  else if (bucket >= HISTOGRAM_BUCKETS)
+    bucket = HISTOGRAM_BUCKETS - 1;
+
+  histogram->buckets[bucket]++;
+  histogram->count++;
+  histogram->sum += us;
+  if (us > histogram->max)
+    histogram->max = us;
+}
+
+// Upper bound of the bucket holding the percentile, limited by the
+// longest recorded time
+long long histogram_percentile(PHISTOGRAM histogram, int percentile) {
+  if (histogram->count == 0)
+    return 0;
+
+  long target = (histogram->count * percentile + 99) / 100;
+  long seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= target && seen > 0) {
+      long long bound = (long long) (i + 1) * HISTOGRAM_BUCKET_US;
+      return bound < histogram->max ? bound : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+void histogram_merge(PHISTOGRAM histogram, PHISTOGRAM other) {
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    histogram->buckets[i] += other->buckets[i];
+
+  histogram->count += other->count;
+  histogram->sum += other->sum;
+  if (other->max > histogram->max)
+    histogram->max = other->max;
+}
@@ -0,0 +1,35 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Buckets of 100 us up to 100 ms, the last bucket also holds all longer times
+#define HISTOGRAM_BUCKET_US 100
+#define HISTOGRAM_BUCKETS 1000
+
+typedef struct _HISTOGRAM {
+  long count;
+  long long sum;
+  long long max;
+  long buckets[HISTOGRAM_BUCKETS];
+} HISTOGRAM, *PHISTOGRAM;
+
+void histogram_add(PHISTOGRAM histogram, long long us);
+long long histogram_percentile(PHISTOGRAM histogram, int percentile);
+void histogram_merge(PHISTOGRAM histogram, PHISTOGRAM other);
@@ -19,6 +19,8 @@
 
 #ifdef HAVE_LIBCEC
 
+#include "../session.h"
+
 #include <Limelight.h>
 
 #include <ceccloader.h>
@@ -70,6 +72,7 @@ static int on_cec_keypress(void* userdata, const cec_keypress key) {
   if (value != 0) {
     short code = 0x80 << 8 | value;
     LiSendKeyboardEvent(code, (key.duration > 0)?KEY_ACTION_UP:KEY_ACTION_DOWN, 0);
+    session_input(SESSION_INPUT_KEYBOARD);
   }
 }
 
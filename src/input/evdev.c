@@ -19,6 +19,8 @@
 
 #include "../loop.h"
 #include "../global.h"
+#include "../session.h"
+#include "../trace.h"
 
 #include "keyboard.h"
 #include "mapping.h"
@@ -38,6 +40,15 @@
 #include <limits.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
+
+// Kernel headers with 64 bit time on 32 bit systems don't expose the timeval
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
 
 struct input_abs_parms {
   int min, max;
@@ -46,6 +57,43 @@ struct input_abs_parms {
   int range, diff;
 };
 
+enum evdev_action {
+  ACTION_NONE,
+  ACTION_KEYBOARD,
+  ACTION_MOUSE_BUTTON,
+  ACTION_GAMEPAD_BUTTON,
+  ACTION_TRIGGER,
+  ACTION_STICK,
+  ACTION_DPAD_X,
+  ACTION_DPAD_Y,
+};
+
+enum { STICK_LEFT_X, STICK_LEFT_Y, STICK_RIGHT_X, STICK_RIGHT_Y, STICKS };
+enum { TRIGGER_LEFT, TRIGGER_RIGHT, TRIGGERS };
+
+// Translation of a key or button code compiled from the mapping
+struct evdev_key {
+  unsigned char action;
+  char modifier;
+  int value; // Keyboard code, mouse button, button flag or trigger slot
+};
+
+// Translation of an absolute axis with the conversion factors of its range
+struct evdev_axis {
+  unsigned char action;
+  unsigned char slot;
+  bool reverse;
+  int min, max, avg, flat;
+  int divisor;
+  int low, high; // Thresholds of a direction
+};
+
+struct gamepad_report {
+  int buttonFlags;
+  char triggers[TRIGGERS];
+  short sticks[STICKS];
+};
+
 struct input_device {
   struct libevdev *dev;
   struct mapping map;
@@ -54,12 +102,16 @@ struct input_device {
   __s32 mouseDeltaX, mouseDeltaY, mouseScroll;
   short controllerId;
   int buttonFlags;
-  char leftTrigger, rightTrigger;
-  short leftStickX, leftStickY;
-  short rightStickX, rightStickY;
+  char triggers[TRIGGERS];
+  short sticks[STICKS];
   bool gamepadModified;
-  struct input_abs_parms xParms, yParms, rxParms, ryParms, zParms, rzParms;
-  struct input_abs_parms dpadxParms, dpadyParms;
+  struct gamepad_report gamepadSent;
+  long long analogSentTime;
+  long long pendingTime;
+  bool analogPending;
+  int sessionDevice;
+  struct evdev_key keys[KEY_CNT];
+  struct evdev_axis axes[ABS_CNT];
 };
 
 static struct input_device* devices = NULL;
@@ -75,6 +127,13 @@ static bool grabbingDevices;
 #define QUIT_MODIFIERS (MODIFIER_SHIFT|MODIFIER_ALT|MODIFIER_CTRL)
 #define QUIT_KEY KEY_Q
 
+// Stick changes smaller than 1/512 of the range are noise, unless the
+// stick returns to the center or reaches the edge
+#define STICK_THRESHOLD 128
+
+static long long analogPeriod;
+static int flushFd = -1;
+
 static bool (*handler) (struct input_event*, struct input_device*);
 
 static void evdev_init_parms(struct input_device *dev, struct input_abs_parms *parms, int code) {
@@ -86,6 +145,18 @@ static void evdev_init_parms(struct input_device *dev, struct input_abs_parms *p
   parms->diff = parms->max - parms->min;
 }
 
+// The deadzone of the mapping in raw axis units widens the flat range
+// reported by the kernel
+static void evdev_init_deadzone(struct input_abs_parms *parms, int deadzone) {
+  if (deadzone > parms->range / 2) {
+    fprintf(stderr, "Deadzone %d exceeds half of the axis range, using %d\n", deadzone, parms->range / 2);
+    deadzone = parms->range / 2;
+  }
+
+  if (deadzone > parms->flat)
+    parms->flat = deadzone;
+}
+
 static void evdev_remove(int devindex) {
   numDevices--;
 
@@ -98,37 +169,216 @@ static void evdev_remove(int devindex) {
   fprintf(stderr, "Removed input device\n");
 }
 
-static short evdev_convert_value(struct input_event *ev, struct input_device *dev, struct input_abs_parms *parms, bool reverse) {
-  if (abs(ev->value - parms->avg) < parms->flat)
+static short evdev_convert_value(struct input_event *ev, struct evdev_axis *axis) {
+  if (abs(ev->value - axis->avg) < axis->flat)
     return 0;
-  else if (ev->value > parms->max)
-    return reverse?SHRT_MIN:SHRT_MAX;
-  else if (ev->value < parms->min)
-    return reverse?SHRT_MAX:SHRT_MIN;
-  else if (reverse)
-    return (long long)(parms->max - (ev->value<parms->avg?parms->flat*2:0) - ev->value) * (SHRT_MAX-SHRT_MIN) / (parms->max-parms->min-parms->flat*2) + SHRT_MIN;
+  else if (ev->value > axis->max)
+    return axis->reverse?SHRT_MIN:SHRT_MAX;
+  else if (ev->value < axis->min)
+    return axis->reverse?SHRT_MAX:SHRT_MIN;
+  else if (axis->reverse)
+    return (long long)(axis->max - (ev->value<axis->avg?axis->flat*2:0) - ev->value) * (SHRT_MAX-SHRT_MIN) / axis->divisor + SHRT_MIN;
   else
-    return (long long)(ev->value - (ev->value>parms->avg?parms->flat*2:0) - parms->min) * (SHRT_MAX-SHRT_MIN) / (parms->max-parms->min-parms->flat*2) + SHRT_MIN;
+    return (long long)(ev->value - (ev->value>axis->avg?axis->flat*2:0) - axis->min) * (SHRT_MAX-SHRT_MIN) / axis->divisor + SHRT_MIN;
 }
 
-static char evdev_convert_value_byte(struct input_event *ev, struct input_device *dev, struct input_abs_parms *parms) {
-  if (abs(ev->value-parms->min)<parms->flat)
+static char evdev_convert_value_byte(struct input_event *ev, struct evdev_axis *axis) {
+  if (abs(ev->value-axis->min)<axis->flat)
     return 0;
-  else if (ev->value>parms->max)
+  else if (ev->value>axis->max)
     return UCHAR_MAX;
   else
-    return (ev->value - parms->flat - parms->min) * UCHAR_MAX / (parms->diff - parms->flat);
+    return (ev->value - axis->flat - axis->min) * UCHAR_MAX / axis->divisor;
 }
 
-static int evdev_convert_value_direction(struct input_event *ev, struct input_device *dev, struct input_abs_parms *parms, bool reverse) {
-  if (ev->value > (parms->avg+parms->range/4))
-    return reverse?-1:1;
-  else if (ev->value < (parms->avg-parms->range/4))
-    return reverse?1:-1;
+static int evdev_convert_value_direction(struct input_event *ev, struct evdev_axis *axis) {
+  if (ev->value > axis->high)
+    return axis->reverse?-1:1;
+  else if (ev->value < axis->low)
+    return axis->reverse?1:-1;
   else
     return 0;
 }
 
+// Codes claimed by an earlier mapping entry keep their translation
+static void evdev_compile_key(struct input_device *dev, int code, enum evdev_action action, int value) {
+  if (code >= 0 && code < KEY_CNT && dev->keys[code].action == ACTION_NONE) {
+    dev->keys[code].action = action;
+    dev->keys[code].value = value;
+  }
+}
+
+static void evdev_compile_axis(struct input_device *dev, int code, enum evdev_action action, int slot, bool reverse) {
+  if (code < 0 || code >= ABS_CNT || dev->axes[code].action != ACTION_NONE)
+    return;
+
+  struct input_abs_parms parms;
+  evdev_init_parms(dev, &parms, code);
+  if (action == ACTION_STICK)
+    evdev_init_deadzone(&parms, dev->map.abs_deadzone);
+
+  struct evdev_axis *axis = &dev->axes[code];
+  axis->action = action;
+  axis->slot = slot;
+  axis->reverse = reverse;
+  axis->min = parms.min;
+  axis->max = parms.max;
+  axis->avg = parms.avg;
+  axis->flat = parms.flat;
+  axis->divisor = action == ACTION_STICK ? parms.diff - parms.flat*2 : parms.diff - parms.flat;
+  axis->low = parms.avg - parms.range/4;
+  axis->high = parms.avg + parms.range/4;
+  // Axes without range never leave the flat range
+  if (axis->divisor <= 0)
+    axis->divisor = 1;
+}
+
+// Compile the mapping into tables indexed by event code, in the order
+// the mapping entries take precedence
+static void evdev_compile(struct input_device *dev) {
+  struct mapping *map = &dev->map;
+  memset(dev->keys, 0, sizeof(dev->keys));
+  memset(dev->axes, 0, sizeof(dev->axes));
+
+  for (int code = 0; code < sizeof(keyCodes)/sizeof(keyCodes[0]) && code < KEY_CNT; code++) {
+    dev->keys[code].action = ACTION_KEYBOARD;
+    dev->keys[code].value = 0x80 << 8 | keyCodes[code];
+  }
+  dev->keys[KEY_LEFTSHIFT].modifier = dev->keys[KEY_RIGHTSHIFT].modifier = MODIFIER_SHIFT;
+  dev->keys[KEY_LEFTALT].modifier = dev->keys[KEY_RIGHTALT].modifier = MODIFIER_ALT;
+  dev->keys[KEY_LEFTCTRL].modifier = dev->keys[KEY_RIGHTCTRL].modifier = MODIFIER_CTRL;
+
+  evdev_compile_key(dev, BTN_LEFT, ACTION_MOUSE_BUTTON, BUTTON_LEFT);
+  evdev_compile_key(dev, BTN_MIDDLE, ACTION_MOUSE_BUTTON, BUTTON_MIDDLE);
+  evdev_compile_key(dev, BTN_RIGHT, ACTION_MOUSE_BUTTON, BUTTON_RIGHT);
+
+  evdev_compile_key(dev, map->btn_south, ACTION_GAMEPAD_BUTTON, A_FLAG);
+  evdev_compile_key(dev, map->btn_west, ACTION_GAMEPAD_BUTTON, X_FLAG);
+  evdev_compile_key(dev, map->btn_north, ACTION_GAMEPAD_BUTTON, Y_FLAG);
+  evdev_compile_key(dev, map->btn_east, ACTION_GAMEPAD_BUTTON, B_FLAG);
+  evdev_compile_key(dev, map->btn_dpad_up, ACTION_GAMEPAD_BUTTON, UP_FLAG);
+  evdev_compile_key(dev, map->btn_dpad_down, ACTION_GAMEPAD_BUTTON, DOWN_FLAG);
+  evdev_compile_key(dev, map->btn_dpad_right, ACTION_GAMEPAD_BUTTON, RIGHT_FLAG);
+  evdev_compile_key(dev, map->btn_dpad_left, ACTION_GAMEPAD_BUTTON, LEFT_FLAG);
+  evdev_compile_key(dev, map->btn_thumbl, ACTION_GAMEPAD_BUTTON, LS_CLK_FLAG);
+  evdev_compile_key(dev, map->btn_thumbr, ACTION_GAMEPAD_BUTTON, RS_CLK_FLAG);
+  evdev_compile_key(dev, map->btn_tl, ACTION_GAMEPAD_BUTTON, LB_FLAG);
+  evdev_compile_key(dev, map->btn_tr, ACTION_GAMEPAD_BUTTON, RB_FLAG);
+  evdev_compile_key(dev, map->btn_start, ACTION_GAMEPAD_BUTTON, PLAY_FLAG);
+  evdev_compile_key(dev, map->btn_select, ACTION_GAMEPAD_BUTTON, BACK_FLAG);
+  evdev_compile_key(dev, map->btn_mode, ACTION_GAMEPAD_BUTTON, SPECIAL_FLAG);
+  evdev_compile_key(dev, map->btn_tl2, ACTION_TRIGGER, TRIGGER_LEFT);
+  evdev_compile_key(dev, map->btn_tr2, ACTION_TRIGGER, TRIGGER_RIGHT);
+
+  evdev_compile_axis(dev, map->abs_x, ACTION_STICK, STICK_LEFT_X, map->reverse_x);
+  evdev_compile_axis(dev, map->abs_y, ACTION_STICK, STICK_LEFT_Y, map->reverse_y);
+  evdev_compile_axis(dev, map->abs_rx, ACTION_STICK, STICK_RIGHT_X, map->reverse_rx);
+  evdev_compile_axis(dev, map->abs_ry, ACTION_STICK, STICK_RIGHT_Y, map->reverse_ry);
+  evdev_compile_axis(dev, map->abs_z, ACTION_TRIGGER, TRIGGER_LEFT, false);
+  evdev_compile_axis(dev, map->abs_rz, ACTION_TRIGGER, TRIGGER_RIGHT, false);
+  evdev_compile_axis(dev, map->abs_dpad_x, ACTION_DPAD_X, 0, map->reverse_dpad_x);
+  evdev_compile_axis(dev, map->abs_dpad_y, ACTION_DPAD_Y, 0, map->reverse_dpad_y);
+}
+
+static long long evdev_event_time(struct input_event *ev) {
+  return (long long) ev->input_event_sec * 1000000 + ev->input_event_usec;
+}
+
+static long long evdev_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Count the event sent to the host with the delay since the kernel received it,
+// accumulated mouse and gamepad changes are sent with the timestamp of EV_SYN
+static void evdev_sent(struct input_device *dev, long long time, enum session_input type) {
+  session_input(type);
+  session_input_latency(dev->sessionDevice, type, time);
+}
+
+static bool evdev_stick_changed(short value, short sent) {
+  if (value == sent)
+    return false;
+  else if (value == 0 || value == SHRT_MAX || value == SHRT_MIN)
+    return true;
+
+  return abs(value - sent) >= STICK_THRESHOLD;
+}
+
+static void evdev_send_gamepad(struct input_device *dev, long long now, long long time) {
+  LiSendMultiControllerEvent(dev->controllerId, assignedControllerIds, dev->buttonFlags, dev->triggers[TRIGGER_LEFT], dev->triggers[TRIGGER_RIGHT],
+    dev->sticks[STICK_LEFT_X], dev->sticks[STICK_LEFT_Y], dev->sticks[STICK_RIGHT_X], dev->sticks[STICK_RIGHT_Y]);
+  evdev_sent(dev, time, SESSION_INPUT_GAMEPAD);
+
+  dev->gamepadSent.buttonFlags = dev->buttonFlags;
+  memcpy(dev->gamepadSent.triggers, dev->triggers, sizeof(dev->triggers));
+  memcpy(dev->gamepadSent.sticks, dev->sticks, sizeof(dev->sticks));
+  dev->analogSentTime = now;
+  dev->analogPending = false;
+}
+
+// Wake up the loop when the first delayed analog change may be sent
+static void evdev_arm_flush() {
+  long long deadline = 0;
+  for (int i = 0; i < numDevices; i++) {
+    long long next = devices[i].analogSentTime + analogPeriod;
+    if (devices[i].analogPending && (deadline == 0 || next < deadline))
+      deadline = next;
+  }
+
+  struct itimerspec timer = {0};
+  if (deadline > 0) {
+    timer.it_value.tv_sec = deadline / 1000000;
+    timer.it_value.tv_nsec = (deadline % 1000000) * 1000;
+  }
+  timerfd_settime(flushFd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+// Send the gamepad state when it changed more than noise. Button changes
+// are sent immediately, analog changes at most at the gamepad rate.
+static void evdev_report_gamepad(struct input_device *dev, long long time) {
+  struct gamepad_report *sent = &dev->gamepadSent;
+  bool buttons = dev->buttonFlags != sent->buttonFlags;
+  bool analog = false;
+  for (int i = 0; i < TRIGGERS; i++)
+    analog |= dev->triggers[i] != sent->triggers[i];
+  for (int i = 0; i < STICKS; i++)
+    analog |= evdev_stick_changed(dev->sticks[i], sent->sticks[i]);
+
+  if (!buttons && !analog)
+    return;
+
+  long long now = evdev_time_us();
+  if (!buttons && flushFd >= 0 && now - dev->analogSentTime < analogPeriod) {
+    // Report the latency of the oldest change that is delayed
+    if (!dev->analogPending) {
+      dev->analogPending = true;
+      dev->pendingTime = time;
+      evdev_arm_flush();
+    }
+    return;
+  }
+
+  bool pending = dev->analogPending;
+  evdev_send_gamepad(dev, now, pending ? dev->pendingTime : time);
+  if (pending)
+    evdev_arm_flush();
+}
+
+static int evdev_flush(int fd) {
+  uint64_t expirations;
+  read(fd, &expirations, sizeof(expirations));
+
+  long long now = evdev_time_us();
+  for (int i = 0; i < numDevices; i++) {
+    if (devices[i].analogPending && now - devices[i].analogSentTime >= analogPeriod)
+      evdev_send_gamepad(&devices[i], now, devices[i].pendingTime);
+  }
+  evdev_arm_flush();
+  return LOOP_OK;
+}
+
 static bool evdev_handle_event(struct input_event *ev, struct input_device *dev) {
   bool gamepadModified = false;
 
@@ -136,11 +386,13 @@ static bool evdev_handle_event(struct input_event *ev, struct input_device *dev)
   case EV_SYN:
     if (dev->mouseDeltaX != 0 || dev->mouseDeltaY != 0) {
       LiSendMouseMoveEvent(dev->mouseDeltaX, dev->mouseDeltaY);
+      evdev_sent(dev, evdev_event_time(ev), SESSION_INPUT_MOUSE);
       dev->mouseDeltaX = 0;
       dev->mouseDeltaY = 0;
     }
     if (dev->mouseScroll != 0) {
       LiSendScrollEvent(dev->mouseScroll);
+      evdev_sent(dev, evdev_event_time(ev), SESSION_INPUT_MOUSE);
       dev->mouseScroll = 0;
     }
     if (dev->gamepadModified) {
@@ -156,32 +408,22 @@ static bool evdev_handle_event(struct input_event *ev, struct input_device *dev)
         if (dev->controllerId < 0)
           dev->controllerId = 0;
       }
-      LiSendMultiControllerEvent(dev->controllerId, assignedControllerIds, dev->buttonFlags, dev->leftTrigger, dev->rightTrigger, dev->leftStickX, dev->leftStickY, dev->rightStickX, dev->rightStickY);
+      evdev_report_gamepad(dev, evdev_event_time(ev));
       dev->gamepadModified = false;
     }
     break;
-  case EV_KEY:
-    if (ev->code < sizeof(keyCodes)/sizeof(keyCodes[0])) {
-      char modifier = 0;
-      switch (ev->code) {
-      case KEY_LEFTSHIFT:
-      case KEY_RIGHTSHIFT:
-        modifier = MODIFIER_SHIFT;
-        break;
-      case KEY_LEFTALT:
-      case KEY_RIGHTALT:
-        modifier = MODIFIER_ALT;
-        break;
-      case KEY_LEFTCTRL:
-      case KEY_RIGHTCTRL:
-        modifier = MODIFIER_CTRL;
-        break;
-      }
-      if (modifier != 0) {
+  case EV_KEY: {
+    if (ev->code >= KEY_CNT)
+      break;
+
+    struct evdev_key *key = &dev->keys[ev->code];
+    switch (key->action) {
+    case ACTION_KEYBOARD:
+      if (key->modifier != 0) {
         if (ev->value)
-          dev->modifiers |= modifier;
+          dev->modifiers |= key->modifier;
         else
-          dev->modifiers &= ~modifier;
+          dev->modifiers &= ~key->modifier;
       }
 
       // Quit the stream if all the required quit keys are down
@@ -190,75 +432,29 @@ static bool evdev_handle_event(struct input_event *ev, struct input_device *dev)
         return false;
       }
 
-      short code = 0x80 << 8 | keyCodes[ev->code];
-      LiSendKeyboardEvent(code, ev->value?KEY_ACTION_DOWN:KEY_ACTION_UP, dev->modifiers);
-    } else {
-      int mouseCode = 0;
-      short gamepadCode = 0;
-      switch (ev->code) {
-      case BTN_LEFT:
-        mouseCode = BUTTON_LEFT;
-        break;
-      case BTN_MIDDLE:
-        mouseCode = BUTTON_MIDDLE;
-        break;
-      case BTN_RIGHT:
-        mouseCode = BUTTON_RIGHT;
-        break;
-      default:
-        if (ev->code == dev->map.btn_south)
-          gamepadCode = A_FLAG;
-        else if (ev->code == dev->map.btn_west)
-          gamepadCode = X_FLAG;
-        else if (ev->code == dev->map.btn_north)
-          gamepadCode = Y_FLAG;
-        else if (ev->code == dev->map.btn_east)
-          gamepadCode = B_FLAG;
-        else if (ev->code == dev->map.btn_dpad_up)
-          gamepadCode = UP_FLAG;
-        else if (ev->code == dev->map.btn_dpad_down)
-          gamepadCode = DOWN_FLAG;
-        else if (ev->code == dev->map.btn_dpad_right)
-          gamepadCode = RIGHT_FLAG;
-        else if (ev->code == dev->map.btn_dpad_left)
-          gamepadCode = LEFT_FLAG;
-        else if (ev->code == dev->map.btn_thumbl)
-          gamepadCode = LS_CLK_FLAG;
-        else if (ev->code == dev->map.btn_thumbr)
-          gamepadCode = RS_CLK_FLAG;
-        else if (ev->code == dev->map.btn_tl)
-          gamepadCode = LB_FLAG;
-        else if (ev->code == dev->map.btn_tr)
-          gamepadCode = RB_FLAG;
-        else if (ev->code == dev->map.btn_start)
-          gamepadCode = PLAY_FLAG;
-        else if (ev->code == dev->map.btn_select)
-          gamepadCode = BACK_FLAG;
-        else if (ev->code == dev->map.btn_mode)
-          gamepadCode = SPECIAL_FLAG;
-      }
-
-      if (mouseCode != 0) {
-        LiSendMouseButtonEvent(ev->value?BUTTON_ACTION_PRESS:BUTTON_ACTION_RELEASE, mouseCode);
-      } else {
-        gamepadModified = true;
-
-        if (gamepadCode != 0) {
-          if (ev->value)
-            dev->buttonFlags |= gamepadCode;
-          else
-            dev->buttonFlags &= ~gamepadCode;
-        } else if (ev->code == dev->map.btn_tl2)
-          dev->leftTrigger = ev->value?UCHAR_MAX:0;
-        else if (ev->code == dev->map.btn_tr2)
-          dev->rightTrigger = ev->value?UCHAR_MAX:0;
-        else {
-          fprintf(stderr, "Unmapped button: %d\n", ev->code);
-          gamepadModified = false;
-        }
-      }
+      LiSendKeyboardEvent(key->value, ev->value?KEY_ACTION_DOWN:KEY_ACTION_UP, dev->modifiers);
+      evdev_sent(dev, evdev_event_time(ev), SESSION_INPUT_KEYBOARD);
+      break;
+    case ACTION_MOUSE_BUTTON:
+      LiSendMouseButtonEvent(ev->value?BUTTON_ACTION_PRESS:BUTTON_ACTION_RELEASE, key->value);
+      evdev_sent(dev, evdev_event_time(ev), SESSION_INPUT_MOUSE);
+      break;
+    case ACTION_GAMEPAD_BUTTON:
+      gamepadModified = true;
+      if (ev->value)
+        dev->buttonFlags |= key->value;
+      else
+        dev->buttonFlags &= ~key->value;
+      break;
+    case ACTION_TRIGGER:
+      gamepadModified = true;
+      dev->triggers[key->value] = ev->value?UCHAR_MAX:0;
+      break;
+    default:
+      fprintf(stderr, "Unmapped button: %d\n", ev->code);
     }
     break;
+  }
   case EV_REL:
     switch (ev->code) {
       case REL_X:
@@ -272,49 +468,41 @@ static bool evdev_handle_event(struct input_event *ev, struct input_device *dev)
         break;
     }
     break;
-  case EV_ABS:
+  case EV_ABS: {
+    if (ev->code >= ABS_CNT || dev->axes[ev->code].action == ACTION_NONE)
+      break;
+
+    struct evdev_axis *axis = &dev->axes[ev->code];
     gamepadModified = true;
-    if (ev->code == dev->map.abs_x)
-      dev->leftStickX = evdev_convert_value(ev, dev, &dev->xParms, dev->map.reverse_x);
-    else if (ev->code == dev->map.abs_y)
-      dev->leftStickY = evdev_convert_value(ev, dev, &dev->yParms, dev->map.reverse_y);
-    else if (ev->code == dev->map.abs_rx)
-      dev->rightStickX = evdev_convert_value(ev, dev, &dev->rxParms, dev->map.reverse_rx);
-    else if (ev->code == dev->map.abs_ry)
-      dev->rightStickY = evdev_convert_value(ev, dev, &dev->ryParms, dev->map.reverse_ry);
-    else if (ev->code == dev->map.abs_z)
-      dev->leftTrigger = evdev_convert_value_byte(ev, dev, &dev->zParms);
-    else if (ev->code == dev->map.abs_rz)
-      dev->rightTrigger = evdev_convert_value_byte(ev, dev, &dev->rzParms);
-    else if (ev->code == dev->map.abs_dpad_x) {
-      int dir = evdev_convert_value_direction(ev, dev, &dev->dpadxParms, dev->map.reverse_dpad_x);
-      if (dir == 1) {
+
+    int dir;
+    switch (axis->action) {
+    case ACTION_STICK:
+      dev->sticks[axis->slot] = evdev_convert_value(ev, axis);
+      break;
+    case ACTION_TRIGGER:
+      dev->triggers[axis->slot] = evdev_convert_value_byte(ev, axis);
+      break;
+    case ACTION_DPAD_X:
+      dir = evdev_convert_value_direction(ev, axis);
+      dev->buttonFlags &= ~(RIGHT_FLAG | LEFT_FLAG);
+      if (dir == 1)
         dev->buttonFlags |= RIGHT_FLAG;
-        dev->buttonFlags &= ~LEFT_FLAG;
-      } else if (dir == 0) {
-        dev->buttonFlags &= ~RIGHT_FLAG;
-        dev->buttonFlags &= ~LEFT_FLAG;
-      } else {
-        dev->buttonFlags &= ~RIGHT_FLAG;
+      else if (dir == -1)
         dev->buttonFlags |= LEFT_FLAG;
-      }
-    } else if (ev->code == dev->map.abs_dpad_y) {
-      int dir = evdev_convert_value_direction(ev, dev, &dev->dpadyParms, dev->map.reverse_dpad_y);
-      if (dir == 1) {
+      break;
+    case ACTION_DPAD_Y:
+      dir = evdev_convert_value_direction(ev, axis);
+      dev->buttonFlags &= ~(DOWN_FLAG | UP_FLAG);
+      if (dir == 1)
         dev->buttonFlags |= DOWN_FLAG;
-        dev->buttonFlags &= ~UP_FLAG;
-      } else if (dir == 0) {
-        dev->buttonFlags &= ~DOWN_FLAG;
-        dev->buttonFlags &= ~UP_FLAG;
-      } else {
-        dev->buttonFlags &= ~DOWN_FLAG;
+      else if (dir == -1)
         dev->buttonFlags |= UP_FLAG;
-      }
-    } else
-      gamepadModified = false;
-
+      break;
+    }
     break;
   }
+  }
 
   dev->gamepadModified |= gamepadModified;
   return true;
@@ -365,7 +553,10 @@ static int evdev_handle(int fd) {
         if (rc == LIBEVDEV_READ_STATUS_SYNC)
           fprintf(stderr, "Error: cannot keep up\n");
         else if (rc == LIBEVDEV_READ_STATUS_SUCCESS) {
-          if (!handler(&ev, &devices[i]))
+          long long span = trace_begin();
+          bool handled = handler(&ev, &devices[i]);
+          trace_end("evdev_dispatch", span);
+          if (!handled)
             return LOOP_RETURN;
         }
       }
@@ -406,19 +597,16 @@ void evdev_create(const char* device, char* mapFile) {
   devices[dev].fd = fd;
   devices[dev].dev = libevdev_new();
   libevdev_set_fd(devices[dev].dev, devices[dev].fd);
+  // Event timestamps on the same clock as the session timings
+  libevdev_set_clock_id(devices[dev].dev, CLOCK_MONOTONIC);
+  const char* name = libevdev_get_name(devices[dev].dev);
+  devices[dev].sessionDevice = session_device(name != NULL ? name : device);
 
   if (mapFile != NULL)
     mapping_load(mapFile, &(devices[dev].map));
 
   devices[dev].controllerId = -1;
-  evdev_init_parms(&devices[dev], &(devices[dev].xParms), devices[dev].map.abs_x);
-  evdev_init_parms(&devices[dev], &(devices[dev].yParms), devices[dev].map.abs_y);
-  evdev_init_parms(&devices[dev], &(devices[dev].zParms), devices[dev].map.abs_z);
-  evdev_init_parms(&devices[dev], &(devices[dev].rxParms), devices[dev].map.abs_rx);
-  evdev_init_parms(&devices[dev], &(devices[dev].ryParms), devices[dev].map.abs_ry);
-  evdev_init_parms(&devices[dev], &(devices[dev].rzParms), devices[dev].map.abs_rz);
-  evdev_init_parms(&devices[dev], &(devices[dev].dpadxParms), devices[dev].map.abs_dpad_x);
-  evdev_init_parms(&devices[dev], &(devices[dev].dpadyParms), devices[dev].map.abs_dpad_y);
+  evdev_compile(&devices[dev]);
 
   if (grabbingDevices) {
     if (ioctl(fd, EVIOCGRAB, 1) < 0) {
@@ -528,8 +716,29 @@ void evdev_start() {
 
 void evdev_stop() {
   evdev_drain();
+
+  // Delayed analog changes are outdated for the next stream
+  if (flushFd >= 0) {
+    for (int i = 0; i < numDevices; i++)
+      devices[i].analogPending = false;
+
+    evdev_arm_flush();
+  }
 }
 
-void evdev_init() {
+// Analog gamepad changes are sent at most gamepadRate times per second,
+// or unlimited if 0
+void evdev_init(int gamepadRate) {
   handler = evdev_handle_event;
+
+  if (gamepadRate > 0) {
+    flushFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (flushFd < 0) {
+      fprintf(stderr, "Can't limit gamepad rate: %s\n", strerror(errno));
+      return;
+    }
+
+    analogPeriod = 1000000 / gamepadRate;
+    loop_add_fd(flushFd, evdev_flush, POLLIN);
+  }
 }
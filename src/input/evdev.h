@@ -21,6 +21,6 @@ void evdev_create(const char* device, char* mapFile);
 void evdev_loop();
 void evdev_map(char* fileName);
 
-void evdev_init();
+void evdev_init(int gamepadRate);
 void evdev_start();
 void evdev_stop();
@@ -22,9 +22,52 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 
 #define write_config(fd, key, value) fprintf(fd, "%s = %hd\n", key, value)
-#define write_config_bool(fd, key, value) fprintf(fd, "%s = %s\n", key, value?"true":"false");
+#define write_config_bool(fd, key, value) fprintf(fd, "%s = %s\n", key, value?"true":"false")
+
+// Entries of a mapping file in the order they are saved
+static const struct mapping_field {
+  const char* name;
+  size_t offset;
+  bool reverse;
+} fields[] = {
+  { "abs_x", offsetof(struct mapping, abs_x) },
+  { "abs_y", offsetof(struct mapping, abs_y) },
+  { "abs_z", offsetof(struct mapping, abs_z) },
+  { "reverse_x", offsetof(struct mapping, reverse_x), true },
+  { "reverse_y", offsetof(struct mapping, reverse_y), true },
+  { "abs_rx", offsetof(struct mapping, abs_rx) },
+  { "abs_ry", offsetof(struct mapping, abs_ry) },
+  { "abs_rz", offsetof(struct mapping, abs_rz) },
+  { "reverse_rx", offsetof(struct mapping, reverse_rx), true },
+  { "reverse_ry", offsetof(struct mapping, reverse_ry), true },
+  { "abs_deadzone", offsetof(struct mapping, abs_deadzone) },
+  { "abs_dpad_x", offsetof(struct mapping, abs_dpad_x) },
+  { "abs_dpad_y", offsetof(struct mapping, abs_dpad_y) },
+  { "reverse_dpad_x", offsetof(struct mapping, reverse_dpad_x), true },
+  { "reverse_dpad_y", offsetof(struct mapping, reverse_dpad_y), true },
+  { "btn_north", offsetof(struct mapping, btn_north) },
+  { "btn_east", offsetof(struct mapping, btn_east) },
+  { "btn_south", offsetof(struct mapping, btn_south) },
+  { "btn_west", offsetof(struct mapping, btn_west) },
+  { "btn_select", offsetof(struct mapping, btn_select) },
+  { "btn_start", offsetof(struct mapping, btn_start) },
+  { "btn_mode", offsetof(struct mapping, btn_mode) },
+  { "btn_thumbl", offsetof(struct mapping, btn_thumbl) },
+  { "btn_thumbr", offsetof(struct mapping, btn_thumbr) },
+  { "btn_tl", offsetof(struct mapping, btn_tl) },
+  { "btn_tr", offsetof(struct mapping, btn_tr) },
+  { "btn_tl2", offsetof(struct mapping, btn_tl2) },
+  { "btn_tr2", offsetof(struct mapping, btn_tr2) },
+  { "btn_dpad_up", offsetof(struct mapping, btn_dpad_up) },
+  { "btn_dpad_down", offsetof(struct mapping, btn_dpad_down) },
+  { "btn_dpad_left", offsetof(struct mapping, btn_dpad_left) },
+  { "btn_dpad_right", offsetof(struct mapping, btn_dpad_right) },
+};
+
+#define FIELDS (int) (sizeof(fields) / sizeof(fields[0]))
 
 void mapping_load(char* fileName, struct mapping* map) {
   FILE* fd = fopen(fileName, "r");
@@ -38,73 +81,16 @@ void mapping_load(char* fileName, struct mapping* map) {
   while (getline(&line, &len, fd) != -1) {
     char *key = NULL, *value = NULL;
     if (sscanf(line, "%ms = %ms", &key, &value) == 2) {
-      long int_value = strtol(value, NULL, 10);
-      if (strcmp("abs_x", key) == 0)
-        map->abs_x = int_value;
-      else if (strcmp("abs_y", key) == 0)
-        map->abs_y = int_value;
-      else if (strcmp("abs_z", key) == 0)
-        map->abs_z = int_value;
-      else if (strcmp("abs_rx", key) == 0)
-        map->abs_rx = int_value;
-      else if (strcmp("abs_ry", key) == 0)
-        map->abs_ry = int_value;
-      else if (strcmp("abs_rz", key) == 0)
-        map->abs_rz = int_value;
-      else if (strcmp("abs_deadzone", key) == 0)
-        map->abs_deadzone = int_value;
-      else if (strcmp("abs_dpad_x", key) == 0)
-        map->abs_dpad_x = int_value;
-      else if (strcmp("abs_dpad_y", key) == 0)
-        map->abs_dpad_y = int_value;
-      else if (strcmp("btn_south", key) == 0)
-        map->btn_south = int_value;
-      else if (strcmp("btn_north", key) == 0)
-        map->btn_north = int_value;
-      else if (strcmp("btn_east", key) == 0)
-        map->btn_east = int_value;
-      else if (strcmp("btn_west", key) == 0)
-        map->btn_west = int_value;
-      else if (strcmp("btn_select", key) == 0)
-        map->btn_select = int_value;
-      else if (strcmp("btn_start", key) == 0)
-        map->btn_start = int_value;
-      else if (strcmp("btn_mode", key) == 0)
-        map->btn_mode = int_value;
-      else if (strcmp("btn_thumbl", key) == 0)
-        map->btn_thumbl = int_value;
-      else if (strcmp("btn_thumbr", key) == 0)
-        map->btn_thumbr = int_value;
-      else if (strcmp("btn_tl", key) == 0)
-        map->btn_tl = int_value;
-      else if (strcmp("btn_tr", key) == 0)
-        map->btn_tr = int_value;
-      else if (strcmp("btn_tl2", key) == 0)
-        map->btn_tl2 = int_value;
-      else if (strcmp("btn_tr2", key) == 0)
-        map->btn_tr2 = int_value;
-      else if (strcmp("btn_dpad_up", key) == 0)
-        map->btn_dpad_up = int_value;
-      else if (strcmp("btn_dpad_down", key) == 0)
-        map->btn_dpad_down = int_value;
-      else if (strcmp("btn_dpad_left", key) == 0)
-        map->btn_dpad_left = int_value;
-      else if (strcmp("btn_dpad_right", key) == 0)
-        map->btn_dpad_right = int_value;
-      else if (strcmp("reverse_x", key) == 0)
-        map->reverse_x = strcmp("true", value) == 0;
-      else if (strcmp("reverse_y", key) == 0)
-        map->reverse_y = strcmp("true", value) == 0;
-      else if (strcmp("reverse_rx", key) == 0)
-        map->reverse_rx = strcmp("true", value) == 0;
-      else if (strcmp("reverse_ry", key) == 0)
-        map->reverse_ry = strcmp("true", value) == 0;
-      else if (strcmp("reverse_dpad_x", key) == 0)
-        map->reverse_dpad_x = strcmp("true", value) == 0;
-      else if (strcmp("reverse_dpad_y", key) == 0)
-        map->reverse_dpad_y = strcmp("true", value) == 0;
-      else
+      int i = 0;
+      while (i < FIELDS && strcmp(fields[i].name, key) != 0)
+        i++;
+
+      if (i == FIELDS)
         fprintf(stderr, "Can't map (%s)\n", key);
+      else if (fields[i].reverse)
+        *(bool*) ((char*) map + fields[i].offset) = strcmp("true", value) == 0;
+      else
+        *(short*) ((char*) map + fields[i].offset) = strtol(value, NULL, 10);
     }
     if (key != NULL)
       free(key);
@@ -122,49 +108,12 @@ void mapping_save(char* fileName, struct mapping* map) {
     exit(EXIT_FAILURE);
   }
 
-  write_config(fd, "abs_x", map->abs_x);
-  write_config(fd, "abs_y", map->abs_y);
-  write_config(fd, "abs_z", map->abs_z);
-
-  write_config_bool(fd, "reverse_x", map->reverse_x);
-  write_config_bool(fd, "reverse_y", map->reverse_y);
-
-  write_config(fd, "abs_rx", map->abs_rx);
-  write_config(fd, "abs_ry", map->abs_ry);
-  write_config(fd, "abs_rz", map->abs_rz);
-
-  write_config_bool(fd, "reverse_rx", map->reverse_rx);
-  write_config_bool(fd, "reverse_ry", map->reverse_ry);
-
-  write_config(fd, "abs_deadzone", map->abs_deadzone);
-
-  write_config(fd, "abs_dpad_x", map->abs_dpad_x);
-  write_config(fd, "abs_dpad_y", map->abs_dpad_y);
-
-  write_config_bool(fd, "reverse_dpad_x", map->reverse_dpad_x);
-  write_config_bool(fd, "reverse_dpad_y", map->reverse_dpad_y);
-
-  write_config(fd, "btn_north", map->btn_north);
-  write_config(fd, "btn_east", map->btn_east);
-  write_config(fd, "btn_south", map->btn_south);
-  write_config(fd, "btn_west", map->btn_west);
-
-  write_config(fd, "btn_select", map->btn_select);
-  write_config(fd, "btn_start", map->btn_start);
-  write_config(fd, "btn_mode", map->btn_mode);
-
-  write_config(fd, "btn_thumbl", map->btn_thumbl);
-  write_config(fd, "btn_thumbr", map->btn_thumbr);
-
-  write_config(fd, "btn_tl", map->btn_tl);
-  write_config(fd, "btn_tr", map->btn_tr);
-  write_config(fd, "btn_tl2", map->btn_tl2);
-  write_config(fd, "btn_tr2", map->btn_tr2);
-
-  write_config(fd, "btn_dpad_up", map->btn_dpad_up);
-  write_config(fd, "btn_dpad_down", map->btn_dpad_down);
-  write_config(fd, "btn_dpad_left", map->btn_dpad_left);
-  write_config(fd, "btn_dpad_right", map->btn_dpad_right);
+  for (int i = 0; i < FIELDS; i++) {
+    if (fields[i].reverse)
+      write_config_bool(fd, fields[i].name, *(bool*) ((char*) map + fields[i].offset));
+    else
+      write_config(fd, fields[i].name, *(short*) ((char*) map + fields[i].offset));
+  }
 
   fclose(fd);
 }
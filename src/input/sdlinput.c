@@ -21,6 +21,7 @@
 
 #include "sdlinput.h"
 #include "../sdl.h"
+#include "../session.h"
 
 #include <Limelight.h>
 
@@ -78,9 +79,11 @@ int sdlinput_handle_event(SDL_Event* event) {
   switch (event->type) {
   case SDL_MOUSEMOTION:
     LiSendMouseMoveEvent(event->motion.xrel, event->motion.yrel);
+    session_input(SESSION_INPUT_MOUSE);
     break;
   case SDL_MOUSEWHEEL:
     LiSendScrollEvent(event->wheel.y);
+    session_input(SESSION_INPUT_MOUSE);
     break;
   case SDL_MOUSEBUTTONUP:
   case SDL_MOUSEBUTTONDOWN:
@@ -96,8 +99,10 @@ int sdlinput_handle_event(SDL_Event* event) {
       break;
     }
 
-    if (button != 0)
+    if (button != 0) {
       LiSendMouseButtonEvent(event->type==SDL_MOUSEBUTTONDOWN?BUTTON_ACTION_PRESS:BUTTON_ACTION_RELEASE, button);
+      session_input(SESSION_INPUT_MOUSE);
+    }
 
     return SDL_MOUSE_GRAB;
   case SDL_KEYDOWN:
@@ -140,6 +145,7 @@ int sdlinput_handle_event(SDL_Event* event) {
       return SDL_MOUSE_UNGRAB;
 
     LiSendKeyboardEvent(0x80 << 8 | button, event->type==SDL_KEYDOWN?KEY_ACTION_DOWN:KEY_ACTION_UP, keyboard_modifiers);
+    session_input(SESSION_INPUT_KEYBOARD);
     break;
   case SDL_CONTROLLERAXISMOTION:
     gamepad = get_gamepad(event->caxis.which);
@@ -166,6 +172,7 @@ int sdlinput_handle_event(SDL_Event* event) {
       return SDL_NOTHING;
     }
     LiSendMultiControllerEvent(gamepad->id, activeGamepadMask, gamepad->buttons, gamepad->leftTrigger, gamepad->rightTrigger, gamepad->leftStickX, gamepad->leftStickY, gamepad->rightStickX, gamepad->rightStickY);
+    session_input(SESSION_INPUT_GAMEPAD);
     break;
   case SDL_CONTROLLERBUTTONDOWN:
   case SDL_CONTROLLERBUTTONUP:
@@ -225,6 +232,7 @@ int sdlinput_handle_event(SDL_Event* event) {
       gamepad->buttons &= ~button;
 
     LiSendMultiControllerEvent(gamepad->id, activeGamepadMask, gamepad->buttons, gamepad->leftTrigger, gamepad->rightTrigger, gamepad->leftStickX, gamepad->leftStickY, gamepad->rightStickX, gamepad->rightStickY);
+    session_input(SESSION_INPUT_GAMEPAD);
     break;
   }
   return SDL_NOTHING;
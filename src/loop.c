@@ -34,7 +34,7 @@ static struct pollfd* fds = NULL;
 static FdHandler* fdHandlers = NULL;
 static int numFds = 0;
 
-static int sigFd;
+static int sigFd = -1;
 
 static int loop_sig_handler(int fd) {
   struct signalfd_siginfo info;
@@ -96,8 +96,11 @@ void loop_main() {
   sigaddset(&sigset, SIGINT);
   sigaddset(&sigset, SIGQUIT);
   sigprocmask(SIG_BLOCK, &sigset, NULL);
-  sigFd = signalfd(-1, &sigset, 0);
-  loop_add_fd(sigFd, loop_sig_handler, POLLIN | POLLERR | POLLHUP);
+  // The loop runs again when the stream is restarted
+  if (sigFd < 0) {
+    sigFd = signalfd(-1, &sigset, 0);
+    loop_add_fd(sigFd, loop_sig_handler, POLLIN | POLLERR | POLLHUP);
+  }
 
 //static bool evdev_poll(bool (*handler) (struct input_event*, struct input_device*)) {
   while (poll(fds, numFds, -1)) {
@@ -18,15 +18,23 @@
  */
 
 #include "loop.h"
+#include "global.h"
 #include "client.h"
 #include "connection.h"
 #include "configuration.h"
 #include "audio.h"
 #include "video.h"
 #include "discover.h"
+#include "frame.h"
 #include "config.h"
 #include "platform.h"
 #include "sdl.h"
+#include "startup.h"
+#include "adaptive.h"
+#include "probe.h"
+#include "session.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include "input/evdev.h"
 #include "input/udev.h"
@@ -40,6 +48,8 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -47,6 +57,11 @@
 #include <arpa/inet.h>
 #include <openssl/rand.h>
 
+#define DISCOVER_TIMEOUT 5000
+#define POLL_TIMEOUT 1000
+#define HOST_CACHE_FILE_NAME "hosts.cache"
+#define DISCOVER_GRACE 1000
+
 static void applist(PSERVER_DATA server) {
   PAPP_LIST list = NULL;
   if (gs_applist(server, &list) != GS_OK) {
@@ -62,7 +77,10 @@ static void applist(PSERVER_DATA server) {
 
 static int get_app_id(PSERVER_DATA server, const char *name) {
   PAPP_LIST list = NULL;
-  if (gs_applist(server, &list) != GS_OK) {
+  startup_begin("gs_applist");
+  int ret = gs_applist(server, &list);
+  startup_end("gs_applist");
+  if (ret != GS_OK) {
     fprintf(stderr, "Can't get app list\n");
     return -1;
   }
@@ -76,43 +94,267 @@ static int get_app_id(PSERVER_DATA server, const char *name) {
   return -1;
 }
 
+struct launch_request {
+  PSERVER_DATA server;
+  PCONFIGURATION config;
+  int appId;
+  int ret;
+};
+
+static void* launch_app(void* data) {
+  struct launch_request* request = (struct launch_request*) data;
+
+  request->appId = get_app_id(request->server, request->config->app);
+  if (request->appId >= 0) {
+    startup_begin("gs_start_app");
+    request->ret = gs_start_app(request->server, &request->config->stream, request->appId, request->config->sops, request->config->localaudio);
+    startup_end("gs_start_app");
+  }
+
+  return NULL;
+}
+
 static void stream(PSERVER_DATA server, PCONFIGURATION config, enum platform system) {
-  int appId = get_app_id(server, config->app);
-  if (appId<0) {
+  int drFlags = 0;
+  if (config->fullscreen)
+    drFlags |= DISPLAY_FULLSCREEN;
+
+  if (config->forcehw)
+    drFlags |= FORCE_HARDWARE_ACCELERATION;
+
+  // Launching the app can take seconds, so prepare the video and audio
+  // backends on this thread while the host is busy starting the game
+  struct launch_request request = { .server = server, .config = config, .appId = -1, .ret = GS_OK };
+  if (config->metrics_socket != NULL)
+    metrics_init(config->metrics_socket);
+
+  if (config->trace_file != NULL)
+    trace_init(config->trace_file);
+
+  session_init(config->session_log);
+
+  startup_begin("launch");
+  pthread_t launch_thread;
+  bool launching = pthread_create(&launch_thread, NULL, launch_app, &request) == 0;
+  if (!launching)
+    launch_app(&request);
+
+  startup_begin("prepare");
+  #ifdef HAVE_SDL
+  if (system == SDL)
+    sdl_init(config->stream.width, config->stream.height, config->fullscreen);
+  #endif
+
+  if (config->adaptive) {
+    #ifdef HAVE_SDL
+    if (system == SDL)
+      adaptive_init(&config->stream, sdl_stop);
+    else
+    #endif
+      adaptive_init(&config->stream, quit);
+  }
+
+  platform_prepare(system, &config->stream, drFlags);
+  PDECODER_RENDERER_CALLBACKS video_callbacks = startup_trace_video(trace_video(session_video(adaptive_video(gs_frame_classifier(platform_get_video(system))))));
+  PAUDIO_RENDERER_CALLBACKS audio_callbacks = platform_get_audio(system);
+  platform_prepare_audio(audio_callbacks);
+  audio_callbacks = startup_trace_audio(trace_audio(session_audio(audio_callbacks)));
+  startup_end("prepare");
+
+  if (launching)
+    pthread_join(launch_thread, NULL);
+
+  startup_end("launch");
+
+  if (request.appId < 0) {
     fprintf(stderr, "Can't find app %s\n", config->app);
     exit(-1);
   }
 
-  int ret = gs_start_app(server, &config->stream, appId, config->sops, config->localaudio);
-  if (ret < 0) {
-    if (ret == GS_NOT_SUPPORTED_4K)
+  if (request.ret < 0) {
+    if (request.ret == GS_NOT_SUPPORTED_4K)
       fprintf(stderr, "Server doesn't support 4K\n");
     else
-      fprintf(stderr, "Errorcode starting app: %d\n", ret);
+      fprintf(stderr, "Errorcode starting app: %d\n", request.ret);
     exit(-1);
   }
 
-  int drFlags = 0;
-  if (config->fullscreen)
-    drFlags |= DISPLAY_FULLSCREEN;
+  printf("Stream %d x %d, %d fps, %d kbps\n", config->stream.width, config->stream.height, config->stream.fps, config->stream.bitrate);
+  startup_begin("LiStartConnection");
+  LiStartConnection(&server->serverInfo, &config->stream, &connection_callbacks, video_callbacks, audio_callbacks, NULL, drFlags);
+  startup_end("LiStartConnection");
 
-  if (config->forcehw)
-    drFlags |= FORCE_HARDWARE_ACCELERATION;
+  while (true) {
+    if (IS_EMBEDDED(system)) {
+      evdev_start();
+      loop_main();
+      evdev_stop();
+    }
+    #ifdef HAVE_SDL
+    else if (system == SDL)
+      sdl_loop();
+    #endif
 
-  printf("Stream %d x %d, %d fps, %d kbps\n", config->stream.width, config->stream.height, config->stream.fps, config->stream.bitrate);
-  LiStartConnection(&server->serverInfo, &config->stream, &connection_callbacks, platform_get_video(system), platform_get_audio(system), NULL, drFlags);
+    LiStopConnection();
+    session_collect();
+
+    // Resume the running app with the next tier of the adaptive controller
+    if (!adaptive_restart(&config->stream))
+      break;
 
-  if (IS_EMBEDDED(system)) {
-    evdev_start();
-    loop_main();
-    evdev_stop();
+    int ret = gs_start_app(server, &config->stream, request.appId, config->sops, config->localaudio);
+    if (ret < 0) {
+      fprintf(stderr, "Errorcode resuming app: %d\n", ret);
+      break;
+    }
+
+    #ifdef HAVE_SDL
+    if (system == SDL)
+      sdl_resize(config->stream.width, config->stream.height);
+    #endif
+
+    // Prepare again for the new resolution and frame rate. The slices per
+    // frame are part of the capabilities, which the wrappers copied.
+    platform_prepare(system, &config->stream, drFlags);
+    video_callbacks->capabilities = platform_get_video(system)->capabilities;
+
+    LiStartConnection(&server->serverInfo, &config->stream, &connection_callbacks, video_callbacks, audio_callbacks, NULL, drFlags);
   }
+
+  session_save(config, platform_name(system));
+  metrics_destroy();
+  trace_save();
+
   #ifdef HAVE_SDL
-  else if (system == SDL)
-    sdl_loop();
+  if (system == SDL)
+    sdl_destroy();
   #endif
+}
+
+struct discover_request {
+  char cacheFile[4096];
+  char address[MAX_ADDRESS_SIZE];
+  PHOST_LIST hosts;
+  const char* error;
+  int ret;
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+  struct timespec deadline;
+  bool done;
+  bool cancelled;
+};
+
+static struct discover_request* discovery;
+static pthread_t discover_thread;
+static bool discovering;
 
-  LiStopConnection();
+// Save the discovered servers with the server in use first
+static void save_host_cache(const char* fileName, const char* address, PHOST_LIST *hosts) {
+  PHOST_LIST *entry = hosts;
+  while (*entry != NULL && strcmp((*entry)->address, address) != 0)
+    entry = &(*entry)->next;
+
+  PHOST_LIST host = *entry;
+  if (host != NULL) {
+    *entry = host->next;
+  } else if ((host = malloc(sizeof(HOST_LIST))) != NULL) {
+    host->name = strdup(address);
+    strcpy(host->address, address);
+  } else
+    return;
+
+  host->next = *hosts;
+  *hosts = host;
+  gs_discover_save_cache(fileName, *hosts);
+}
+
+static void* discover_hosts(void* data) {
+  struct discover_request* request = (struct discover_request*) data;
+
+  // Runs next to the main thread, so errors are not reported in gs_error
+  request->ret = gs_discover_hosts_r(&request->hosts, DISCOVER_TIMEOUT, &request->error);
+
+  pthread_mutex_lock(&request->lock);
+  if (!request->cancelled)
+    save_host_cache(request->cacheFile, request->address, &request->hosts);
+
+  request->done = true;
+  pthread_cond_signal(&request->finished);
+  pthread_mutex_unlock(&request->lock);
+
+  return NULL;
+}
+
+// Called on exit, waits until discovery would have timed out at the latest
+// and makes sure the cache isn't written once the process is exiting
+static void discover_finish() {
+  if (!discovering)
+    return;
+
+  pthread_mutex_lock(&discovery->lock);
+  int rc = 0;
+  while (!discovery->done && rc == 0)
+    rc = pthread_cond_timedwait(&discovery->finished, &discovery->lock, &discovery->deadline);
+
+  discovery->cancelled = true;
+  bool done = discovery->done;
+  pthread_mutex_unlock(&discovery->lock);
+
+  discovering = false;
+  if (done) {
+    pthread_join(discover_thread, NULL);
+    gs_discover_free(discovery->hosts);
+    free(discovery);
+    discovery = NULL;
+  }
+}
+
+static void poll_hosts(PCONFIGURATION config) {
+  char* addresses[MAX_HOSTS + 1];
+  int count = 0;
+  PHOST_LIST hosts = NULL;
+
+  if (config->address != NULL) {
+    addresses[count++] = config->address;
+    for (int i = 0; i < config->hostsCount; i++)
+      addresses[count++] = config->hosts[i];
+  } else {
+    if (gs_discover_hosts(&hosts, DISCOVER_TIMEOUT) != GS_OK) {
+      fprintf(stderr, "Autodiscovery failed: %s\n", gs_error);
+      exit(-1);
+    }
+    for (PHOST_LIST host = hosts; host != NULL && count <= MAX_HOSTS; host = host->next)
+      addresses[count++] = host->address;
+  }
+
+  PSERVER_POLL servers = calloc(count, sizeof(SERVER_POLL));
+  if (servers == NULL) {
+    fprintf(stderr, "Not enough memory\n");
+    exit(-1);
+  }
+
+  // All hosts are queried at once, so the total time is bound by the timeout
+  int ret = gs_poll_servers(addresses, servers, count, config->key_dir, POLL_TIMEOUT);
+  if (ret != GS_OK) {
+    fprintf(stderr, "Can't poll hosts: %d\n", ret);
+    exit(-1);
+  }
+
+  for (int i = 0; i < count; i++) {
+    PSERVER_DATA server = &servers[i].server;
+    if (servers[i].status == GS_OK || servers[i].status == GS_UNSUPPORTED_VERSION) {
+      printf("%d. %s (%s, ", i + 1, addresses[i], server->paired ? "paired" : "not paired");
+      if (server->currentGame != 0)
+        printf("running game %d", server->currentGame);
+      else
+        printf("available");
+
+      printf(", %ld ms)\n", servers[i].latency);
+    } else
+      printf("%d. %s (offline)\n", i + 1, addresses[i]);
+  }
+
+  gs_discover_free(hosts);
 }
 
 static void help() {
@@ -125,6 +367,7 @@ static void help() {
   printf("\tstream\t\t\tStream computer to device\n");
   printf("\tlist\t\t\tList available games and applications\n");
   printf("\tquit\t\t\tQuit the application or game being streamed\n");
+  printf("\thosts\t\t\tShow the status of the given or discovered hosts\n");
   printf("\thelp\t\t\tShow this help\n");
   printf("\n Global Options\n\n");
   printf("\t-config <config>\tLoad configuration file\n");
@@ -145,14 +388,25 @@ static void help() {
   printf("\t-localaudio\t\tPlay audio locally\n");
   printf("\t-surround\t\tStream 5.1 surround sound (requires GFE 2.7)\n");
   printf("\t-keydir <directory>\tLoad encryption keys from directory\n");
+  printf("\t-startuptrace <file>\tWrite startup phase timings as JSON to file\n");
+  printf("\t-sessionlog <directory>\tWrite a performance report as JSON to directory for every session\n");
+  printf("\t-metrics <socket>\tServe live metrics in Prometheus text format on a Unix socket\n");
+  printf("\t-trace <file>\t\tWrite spans of the video, audio and input threads as Chrome trace events to file\n");
+  printf("\t-adaptive\t\tLower bitrate and resolution when frames are lost or decoding is too slow\n");
+  printf("\t-auto\t\t\tChoose stream settings from the measured decoder capacity and network\n");
   #ifdef HAVE_SDL
   printf("\n Video options (SDL Only)\n\n");
   printf("\t-windowed\t\tDisplay screen in a window\n");
   #endif
+  #if defined(HAVE_SDL) || defined(HAVE_KMS)
+  printf("\n Software decoding options\n\n");
+  printf("\t-decoder-threads <n>\tUse <n> decoder threads (default automatic)\n");
+  #endif
   #ifdef HAVE_EMBEDDED
   printf("\n I/O options\n\n");
   printf("\t-mapping <file>\t\tUse <file> as gamepad mapping configuration file (use before -input)\n");
   printf("\t-input <device>\t\tUse <device> as input. Can be used multiple times\n");
+  printf("\t-gamepad-rate <rate>\tSend analog gamepad changes at most <rate> times per second (default 120, 0 for unlimited)\n");
   printf("\t-audio <device>\t\tUse <device> as audio output device\n");
   printf("\t-forcehw \t\tTry to use video hardware acceleration\n");
   #endif
@@ -170,13 +424,22 @@ static void pair_check(PSERVER_DATA server) {
 int main(int argc, char* argv[]) {
   printf("Moonlight Embedded %d.%d.%d (%s)\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, COMPILE_OPTIONS);
 
+  startup_init();
+
   CONFIGURATION config;
+  startup_begin("config_parse");
   config_parse(argc, argv, &config);
+  startup_end("config_parse");
+
+  if (config.startup_trace != NULL)
+    startup_save(config.startup_trace);
 
   if (config.action == NULL || strcmp("help", config.action) == 0)
     help();
   
+  startup_begin("platform_check");
   enum platform system = platform_check(config.platform);
+  startup_end("platform_check");
   if (system == 0) {
     fprintf(stderr, "Platform '%s' not found\n", config.platform);
     exit(-1);
@@ -196,18 +459,49 @@ int main(int argc, char* argv[]) {
     exit(0);
   }
 
+  if (strcmp("hosts", config.action) == 0) {
+    poll_hosts(&config);
+    exit(0);
+  }
+
   if (config.address == NULL) {
     config.address = malloc(MAX_ADDRESS_SIZE);
-    if (config.address == NULL) {
+    discovery = calloc(1, sizeof(struct discover_request));
+    if (config.address == NULL || discovery == NULL) {
       perror("Not enough memory");
       exit(-1);
     }
     config.address[0] = 0;
-    printf("Searching for server...\n");
-    gs_discover_server(config.address);
-    if (config.address[0] == 0) {
-      fprintf(stderr, "Autodiscovery failed. Specify an IP address next time.\n");
-      exit(-1);
+    sprintf(discovery->cacheFile, "%s/%s", config.key_dir, HOST_CACHE_FILE_NAME);
+
+    PHOST_LIST cached;
+    if (gs_discover_load_cache(discovery->cacheFile, &cached) == GS_OK) {
+      // Connect to the last used server right away and let discovery
+      // confirm it in the background
+      strcpy(config.address, cached->address);
+      strcpy(discovery->address, cached->address);
+      gs_discover_free(cached);
+
+      pthread_mutex_init(&discovery->lock, NULL);
+      pthread_cond_init(&discovery->finished, NULL);
+      clock_gettime(CLOCK_REALTIME, &discovery->deadline);
+      discovery->deadline.tv_sec += (DISCOVER_TIMEOUT + DISCOVER_GRACE) / 1000;
+      discovering = pthread_create(&discover_thread, NULL, discover_hosts, discovery) == 0;
+      if (discovering)
+        atexit(discover_finish);
+    } else {
+      printf("Searching for server...\n");
+      startup_begin("discover");
+      discovery->ret = gs_discover_hosts(&discovery->hosts, DISCOVER_TIMEOUT);
+      startup_end("discover");
+      if (discovery->ret != GS_OK) {
+        fprintf(stderr, "Autodiscovery failed: %s. Specify an IP address next time.\n", gs_error);
+        exit(-1);
+      }
+      for (PHOST_LIST host = discovery->hosts; host != NULL; host = host->next)
+        printf("Found server %s (%s)\n", host->name, host->address);
+
+      strcpy(config.address, discovery->hosts->address);
     }
   }
   
@@ -219,8 +513,35 @@ int main(int argc, char* argv[]) {
   SERVER_DATA server;
   printf("Connect to %s...\n", config.address);
 
-  int ret;
-  if ((ret = gs_init(&server, config.address, config.key_dir)) == GS_OUT_OF_MEMORY) {
+  gs_set_phase_callbacks(startup_begin, startup_end);
+  startup_begin("gs_init");
+  int ret = gs_init(&server, config.address, config.key_dir);
+  startup_end("gs_init");
+
+  if (discovering && (ret == GS_FAILED || ret == GS_IO_ERROR)) {
+    // The last used server is gone, wait for discovery to find another one
+    printf("Server %s not available, searching for server...\n", config.address);
+    pthread_join(discover_thread, NULL);
+    discovering = false;
+    if (discovery->ret != GS_OK)
+      fprintf(stderr, "Autodiscovery failed: %s\n", discovery->error);
+
+    PHOST_LIST host = discovery->hosts;
+    while (host != NULL && strcmp(host->address, config.address) == 0)
+      host = host->next;
+
+    if (host != NULL) {
+      strcpy(config.address, host->address);
+      sprintf(host_config_file, "hosts/%s.conf", config.address);
+      if (access(host_config_file, R_OK) != -1)
+        config_file_parse(host_config_file, &config);
+
+      printf("Connect to %s...\n", config.address);
+      ret = gs_init(&server, config.address, config.key_dir);
+    }
+  }
+
+  if (ret == GS_OUT_OF_MEMORY) {
     fprintf(stderr, "Not enough memory\n");
     exit(-1);
   } else if (ret == GS_INVALID) {
@@ -236,6 +557,10 @@ int main(int argc, char* argv[]) {
     exit(-1);
   }
 
+  // When discovery is still running it updates the cache once finished
+  if (discovery != NULL && !discovering)
+    save_host_cache(discovery->cacheFile, config.address, &discovery->hosts);
+
   printf("NVIDIA %s, GFE %s (protocol version %d)\n", server.gpuType, server.serverInfo.serverInfoGfeVersion, server.serverMajorVersion);
 
   if (strcmp("list", config.action) == 0) {
@@ -250,15 +575,16 @@ int main(int argc, char* argv[]) {
       }
 
       udev_init(!inputAdded, config.mapping);
-      evdev_init();
+      evdev_init(config.gamepad_rate);
       #ifdef HAVE_LIBCEC
       cec_init();
       #endif /* HAVE_LIBCEC */
     }
-    #ifdef HAVE_SDL
-    else if (system == SDL)
-      sdl_init(config.stream.width, config.stream.height, config.fullscreen);
-    #endif
+
+    if (config.autoconfig) {
+      probe_configure(&server, &config, system, host_config_file);
+      probe_network(&server, &config);
+    }
 
     stream(&server, &config, system);
   } else if (strcmp("pair", config.action) == 0) {
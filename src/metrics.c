@@ -0,0 +1,277 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_METRICS 64
+
+// Every thread updates its own slot, so the hot paths never share a
+// cache line. Threads beyond the number of slots share them atomically.
+#define METRICS_SLOTS 8
+#define CACHE_LINE 64
+
+// Time a client gets to send a request before the metrics are written
+// without HTTP response header
+#define REQUEST_TIMEOUT_MS 100
+
+enum metric_type { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM };
+
+// Upper bounds of the histogram buckets in us, the last bucket is +Inf
+static const long long bucket_bounds[] = { 1000, 2000, 4000, 8000, 16000, 33000, 50000, 100000, 250000, 1000000 };
+#define BUCKETS (int) (sizeof(bucket_bounds) / sizeof(bucket_bounds[0]) + 1)
+
+struct metric_slot {
+  // Buckets of a histogram followed by the sum, counters and gauges only use the first value
+  long long values[BUCKETS + 1];
+} __attribute__((aligned(CACHE_LINE)));
+
+struct _METRIC {
+  const char* name;
+  const char* help;
+  enum metric_type type;
+  struct metric_slot slots[METRICS_SLOTS];
+};
+
+static METRIC metrics[MAX_METRICS];
+static int numMetrics;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* socket_path;
+static int server_fd = -1;
+static pthread_t server_thread;
+
+static __thread int thread_slot = -1;
+static int next_slot;
+
+static inline struct metric_slot* metrics_slot(PMETRIC metric) {
+  if (thread_slot < 0)
+    thread_slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED) % METRICS_SLOTS;
+
+  return &metric->slots[thread_slot];
+}
+
+void metrics_add(PMETRIC metric, long long value) {
+  if (metric != NULL)
+    __atomic_fetch_add(&metrics_slot(metric)->values[0], value, __ATOMIC_RELAXED);
+}
+
+void metrics_set(PMETRIC metric, long long value) {
+  if (metric != NULL)
+    __atomic_store_n(&metric->slots[0].values[0], value, __ATOMIC_RELAXED);
+}
+
+void metrics_observe(PMETRIC metric, long long us) {
+  if (metric == NULL)
+    return;
+
+  int bucket = 0;
+  while (bucket < BUCKETS - 1 && us > bucket_bounds[bucket])
+    bucket++;
+
+  struct metric_slot* slot = metrics_slot(metric);
+  __atomic_fetch_add(&slot->values[bucket], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&slot->values[BUCKETS], us, __ATOMIC_RELAXED);
+}
+
+static long long metrics_sum(PMETRIC metric, int value) {
+  long long sum = 0;
+  for (int i = 0; i < METRICS_SLOTS; i++)
+    sum += __atomic_load_n(&metric->slots[i].values[value], __ATOMIC_RELAXED);
+
+  return sum;
+}
+
+static PMETRIC metrics_register(enum metric_type type, const char* name, const char* help) {
+  if (server_fd < 0)
+    return NULL;
+
+  PMETRIC metric = NULL;
+  pthread_mutex_lock(&lock);
+  int count = __atomic_load_n(&numMetrics, __ATOMIC_RELAXED);
+  for (int i = 0; i < count && metric == NULL; i++) {
+    if (strcmp(metrics[i].name, name) == 0)
+      metric = &metrics[i];
+  }
+
+  if (metric == NULL && count < MAX_METRICS) {
+    metric = &metrics[count];
+    metric->name = name;
+    metric->help = help;
+    metric->type = type;
+    // Publish the metric to the server thread only when it is complete
+    __atomic_store_n(&numMetrics, count + 1, __ATOMIC_RELEASE);
+  } else if (metric == NULL)
+    fprintf(stderr, "Too many metrics, %s isn't exported\n", name);
+
+  pthread_mutex_unlock(&lock);
+  return metric;
+}
+
+PMETRIC metrics_counter(const char* name, const char* help) {
+  return metrics_register(METRIC_COUNTER, name, help);
+}
+
+PMETRIC metrics_gauge(const char* name, const char* help) {
+  return metrics_register(METRIC_GAUGE, name, help);
+}
+
+PMETRIC metrics_histogram(const char* name, const char* help) {
+  return metrics_register(METRIC_HISTOGRAM, name, help);
+}
+
+// Prometheus text exposition format, times are in seconds
+static void metrics_write(FILE* fd) {
+  static const char* type_names[] = { "counter", "gauge", "histogram" };
+
+  int count = __atomic_load_n(&numMetrics, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < count; i++) {
+    PMETRIC metric = &metrics[i];
+    fprintf(fd, "# HELP %s %s\n# TYPE %s %s\n", metric->name, metric->help, metric->name, type_names[metric->type]);
+    if (metric->type != METRIC_HISTOGRAM) {
+      fprintf(fd, "%s %lld\n", metric->name, metrics_sum(metric, 0));
+      continue;
+    }
+
+    long long cumulative = 0;
+    for (int j = 0; j < BUCKETS; j++) {
+      cumulative += metrics_sum(metric, j);
+      if (j < BUCKETS - 1)
+        fprintf(fd, "%s_bucket{le=\"%g\"} %lld\n", metric->name, bucket_bounds[j] / 1000000.0, cumulative);
+      else
+        fprintf(fd, "%s_bucket{le=\"+Inf\"} %lld\n", metric->name, cumulative);
+    }
+    fprintf(fd, "%s_sum %.6f\n%s_count %lld\n", metric->name, metrics_sum(metric, BUCKETS) / 1000000.0, metric->name, cumulative);
+  }
+}
+
+// Answer HTTP requests like an exporter, other clients get the plain
+// text after a short wait for a request
+static void metrics_serve(int client) {
+  char request[512];
+  bool http = false;
+  struct pollfd pfd = { .fd = client, .events = POLLIN };
+  if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) > 0) {
+    ssize_t length = recv(client, request, sizeof(request) - 1, 0);
+    http = length >= 4 && memcmp(request, "GET ", 4) == 0;
+  }
+
+  char* buffer = NULL;
+  size_t size = 0;
+  FILE* fd = open_memstream(&buffer, &size);
+  if (fd == NULL)
+    return;
+
+  metrics_write(fd);
+  fclose(fd);
+
+  if (http) {
+    char header[128];
+    int length = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", size);
+    send(client, header, length, MSG_NOSIGNAL);
+  }
+
+  for (size_t sent = 0; sent < size;) {
+    ssize_t ret = send(client, buffer + sent, size - sent, MSG_NOSIGNAL);
+    if (ret <= 0)
+      break;
+
+    sent += ret;
+  }
+  free(buffer);
+}
+
+static void* metrics_server(void* data) {
+  while (true) {
+    int client = accept(server_fd, NULL, NULL);
+    if (client < 0 && errno == EINTR)
+      continue;
+    else if (client < 0)
+      return NULL;
+
+    metrics_serve(client);
+    close(client);
+  }
+}
+
+// Serve the metrics on a Unix socket at path until metrics_destroy
+bool metrics_init(const char* path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Metrics socket path too long: %s\n", path);
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("Can't create metrics socket");
+    return false;
+  }
+
+  // Remove the socket of a previous run
+  unlink(path);
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+    fprintf(stderr, "Can't listen for metrics on %s\n", path);
+    close(fd);
+    return false;
+  }
+
+  server_fd = fd;
+  if (pthread_create(&server_thread, NULL, metrics_server, NULL) != 0) {
+    fprintf(stderr, "Can't start metrics server\n");
+    close(fd);
+    unlink(path);
+    server_fd = -1;
+    return false;
+  }
+  socket_path = path;
+
+  printf("Serving metrics on %s\n", path);
+  return true;
+}
+
+bool metrics_enabled() {
+  return server_fd >= 0;
+}
+
+void metrics_destroy() {
+  if (server_fd < 0)
+    return;
+
+  // Wakes up the server thread blocking in accept
+  shutdown(server_fd, SHUT_RDWR);
+  pthread_join(server_thread, NULL);
+
+  close(server_fd);
+  unlink(socket_path);
+  server_fd = -1;
+}
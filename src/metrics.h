@@ -0,0 +1,38 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+typedef struct _METRIC METRIC, *PMETRIC;
+
+bool metrics_init(const char* path);
+void metrics_destroy();
+bool metrics_enabled();
+
+// Registering returns the existing metric if the name is already known,
+// or NULL if metrics are disabled. Updating a NULL metric does nothing.
+PMETRIC metrics_counter(const char* name, const char* help);
+PMETRIC metrics_gauge(const char* name, const char* help);
+PMETRIC metrics_histogram(const char* name, const char* help);
+
+void metrics_add(PMETRIC metric, long long value);
+void metrics_set(PMETRIC metric, long long value);
+void metrics_observe(PMETRIC metric, long long us);
@@ -0,0 +1,200 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pacer.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define DEFAULT_REDRAW_RATE 60
+// Time reserved before vblank in addition to the measured render time
+#define PRESENT_MARGIN_US 1500
+// Waking up this close to the deadline is good enough
+#define DEADLINE_SLACK_US 1000
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long long redraw_period, refresh_period;
+static long long last_vblank, render_time;
+static long long ready_time, present_start, present_ready_time;
+static bool pending;
+
+static PACER_STATS stats;
+static HISTOGRAM latency_histogram;
+static double latency_sum;
+
+static PMETRIC metric_presented, metric_dropped, metric_repeated, metric_latency;
+
+long long pacer_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void pacer_init(int redrawRate) {
+  metric_presented = metrics_counter("moonlight_frames_presented_total", "Frames presented on the display");
+  metric_dropped = metrics_counter("moonlight_frames_dropped_total", "Decoded frames replaced by a newer frame before presentation");
+  metric_repeated = metrics_counter("moonlight_frames_repeated_total", "Stream frame intervals without a new frame on screen");
+  metric_latency = metrics_histogram("moonlight_present_latency_seconds", "Time from decoded to on screen");
+
+  pthread_mutex_lock(&lock);
+  redraw_period = 1000000 / (redrawRate > 0 ? redrawRate : DEFAULT_REDRAW_RATE);
+  last_vblank = 0;
+  render_time = 0;
+  pending = false;
+  memset(&stats, 0, sizeof(stats));
+  memset(&latency_histogram, 0, sizeof(latency_histogram));
+  latency_sum = 0;
+  pthread_mutex_unlock(&lock);
+}
+
+// Use the refresh rate of the display, if unknown the stream is
+// expected to match the display
+void pacer_set_refresh_rate(int refreshRate) {
+  pthread_mutex_lock(&lock);
+  refresh_period = refreshRate > 0 ? 1000000 / refreshRate : 0;
+  pthread_mutex_unlock(&lock);
+}
+
+// Latest moment to start presenting and still make the next vblank
+static long long pacer_deadline(long long now) {
+  long long period = refresh_period > 0 ? refresh_period : redraw_period;
+  if (last_vblank == 0 || now < last_vblank)
+    return now;
+
+  long long margin = render_time + PRESENT_MARGIN_US;
+  if (margin > period / 2)
+    margin = period / 2;
+
+  long long next_vblank = last_vblank + ((now - last_vblank) / period + 1) * period;
+  long long deadline = next_vblank - margin;
+  return deadline < now ? now : deadline;
+}
+
+// Called by the decoder for every decoded frame, returns true if the
+// presentation thread isn't yet aware of a pending frame
+bool pacer_frame_ready() {
+  pthread_mutex_lock(&lock);
+  bool wake = !pending;
+  stats.decoded++;
+  if (pending) {
+    stats.dropped++;
+    metrics_add(metric_dropped, 1);
+  }
+
+  pending = true;
+  ready_time = pacer_time_us();
+  pthread_mutex_unlock(&lock);
+  return wake;
+}
+
+// Time in ms the presentation thread can wait for other events,
+// or -1 if there is no frame to present
+int pacer_wait_time() {
+  pthread_mutex_lock(&lock);
+  int wait = -1;
+  if (pending) {
+    long long now = pacer_time_us();
+    wait = (pacer_deadline(now) - now) / 1000;
+  }
+  pthread_mutex_unlock(&lock);
+  return wait;
+}
+
+// Returns true if the newest frame must be presented now, which
+// must be followed by pacer_end_present after the buffer swap
+bool pacer_begin_present() {
+  pthread_mutex_lock(&lock);
+  bool present = false;
+  long long now = pacer_time_us();
+  if (pending && now >= pacer_deadline(now) - DEADLINE_SLACK_US) {
+    pending = false;
+    present = true;
+    present_start = now;
+    present_ready_time = ready_time;
+  }
+  pthread_mutex_unlock(&lock);
+  return present;
+}
+
+// Presents the newest frame without waiting for the deadline, for displays
+// which queue the frame for the next vblank themselves
+void pacer_begin_present_now() {
+  pthread_mutex_lock(&lock);
+  if (pending) {
+    pending = false;
+    present_start = pacer_time_us();
+    present_ready_time = ready_time;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+// The swap blocks until vblank, so its return marks the refresh timing
+void pacer_end_present(long long renderDone) {
+  pthread_mutex_lock(&lock);
+  long long now = pacer_time_us();
+  render_time = (render_time * 7 + (renderDone - present_start)) / 8;
+
+  if (last_vblank > 0) {
+    long long intervals = (now - last_vblank + redraw_period / 2) / redraw_period;
+    if (intervals > 1) {
+      stats.repeated += intervals - 1;
+      metrics_add(metric_repeated, intervals - 1);
+    }
+  }
+  last_vblank = now;
+
+  histogram_add(&latency_histogram, now - present_ready_time);
+  metrics_observe(metric_latency, now - present_ready_time);
+  metrics_add(metric_presented, 1);
+  double latency = (now - present_ready_time) / 1000.0;
+  latency_sum += latency;
+  if (latency > stats.latencyMax)
+    stats.latencyMax = latency;
+
+  stats.presented++;
+  stats.latencyAvg = latency_sum / stats.presented;
+  pthread_mutex_unlock(&lock);
+}
+
+void pacer_get_stats(PPACER_STATS result) {
+  pthread_mutex_lock(&lock);
+  *result = stats;
+  pthread_mutex_unlock(&lock);
+}
+
+void pacer_get_latency(PHISTOGRAM latency) {
+  pthread_mutex_lock(&lock);
+  *latency = latency_histogram;
+  pthread_mutex_unlock(&lock);
+}
+
+void pacer_report() {
+  PACER_STATS result;
+  pacer_get_stats(&result);
+  if (result.decoded == 0)
+    return;
+
+  long intervals = result.presented + result.repeated;
+  printf("Presented %ld of %ld frames, display latency %.1f ms (max %.1f ms)\n", result.presented, result.decoded, result.latencyAvg, result.latencyMax);
+  printf("Dropped %.1f%% of decoded frames, repeated %.1f%% of frame intervals\n", result.dropped * 100.0 / result.decoded, intervals > 0 ? result.repeated * 100.0 / intervals : 0);
+}
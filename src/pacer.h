@@ -0,0 +1,47 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "histogram.h"
+
+#include <stdbool.h>
+
+typedef struct _PACER_STATS {
+  long decoded;
+  long presented;
+  long dropped;   // Decoded frames replaced by a newer frame before presentation
+  long repeated;  // Stream frame intervals without a new frame on screen
+  double latencyAvg; // Time from decoded to on screen in ms
+  double latencyMax;
+} PACER_STATS, *PPACER_STATS;
+
+void pacer_init(int redrawRate);
+void pacer_set_refresh_rate(int refreshRate);
+
+bool pacer_frame_ready();
+int pacer_wait_time();
+bool pacer_begin_present();
+void pacer_begin_present_now();
+void pacer_end_present(long long renderDone);
+
+long long pacer_time_us();
+void pacer_get_stats(PPACER_STATS stats);
+void pacer_get_latency(PHISTOGRAM latency);
+void pacer_report();
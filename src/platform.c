@@ -28,6 +28,7 @@
 #include <dlfcn.h>
 
 typedef bool(*ImxInit)();
+typedef void(*DecoderPrepare)(int videoFormat, int width, int height, int redrawRate, int drFlags);
 
 enum platform platform_check(char* name) {
   bool std = strcmp(name, "default") == 0;
@@ -55,6 +56,13 @@ enum platform platform_check(char* name) {
       return AML;
   }
   #endif
+  #ifdef HAVE_KMS
+  // Without a display server the screen can be used directly
+  if ((std && getenv("DISPLAY") == NULL && getenv("WAYLAND_DISPLAY") == NULL) || strcmp(name, "kms") == 0) {
+    if (kms_init())
+      return KMS;
+  }
+  #endif
   #ifdef HAVE_SDL
   if (std || strcmp(name, "sdl") == 0)
     return SDL;
@@ -66,6 +74,24 @@ enum platform platform_check(char* name) {
   return 0;
 }
 
+const char* platform_name(enum platform system) {
+  switch (system) {
+  case SDL:
+    return "sdl";
+  case PI:
+    return "pi";
+  case IMX:
+    return "imx";
+  case AML:
+    return "aml";
+  case KMS:
+    return "kms";
+  case FAKE:
+    return "fake";
+  }
+  return "none";
+}
+
 DECODER_RENDERER_CALLBACKS* platform_get_video(enum platform system) {
   switch (system) {
   #ifdef HAVE_SDL
@@ -84,6 +110,10 @@ DECODER_RENDERER_CALLBACKS* platform_get_video(enum platform system) {
   case AML:
     return (PDECODER_RENDERER_CALLBACKS) dlsym(RTLD_DEFAULT, "decoder_callbacks_aml");
   #endif
+  #ifdef HAVE_KMS
+  case KMS:
+    return &decoder_callbacks_kms;
+  #endif
   #ifdef HAVE_FAKE
   case FAKE:
     return &decoder_callbacks_fake;
@@ -120,3 +150,39 @@ bool platform_supports_hevc(enum platform system) {
   }
   return false;
 }
+
+void platform_prepare(enum platform system, PSTREAM_CONFIGURATION config, int drFlags) {
+  // The server decides the codec, but will only pick HEVC when we asked for it
+  int videoFormat = config->supportsHevc ? VIDEO_FORMAT_H265 : VIDEO_FORMAT_H264;
+
+  switch (system) {
+  #ifdef HAVE_SDL
+  case SDL:
+    sdl_prepare(videoFormat, config->width, config->height, config->fps, drFlags);
+    break;
+  #endif
+  #ifdef HAVE_KMS
+  case KMS:
+    kms_prepare(videoFormat, config->width, config->height, config->fps, drFlags);
+    break;
+  #endif
+  #ifdef HAVE_PI
+  case PI:
+    {
+      DecoderPrepare video_pi_prepare = (DecoderPrepare) dlsym(RTLD_DEFAULT, "video_pi_prepare");
+      if (video_pi_prepare != NULL)
+        video_pi_prepare(videoFormat, config->width, config->height, config->fps, drFlags);
+    }
+    break;
+  #endif
+  }
+}
+
+void platform_prepare_audio(PAUDIO_RENDERER_CALLBACKS callbacks) {
+  #ifdef HAVE_SDL
+  if (callbacks == &audio_callbacks_sdl)
+    audio_sdl_prepare();
+  #endif
+  if (callbacks == &audio_callbacks_alsa)
+    audio_alsa_prepare();
+}
@@ -17,6 +17,8 @@
  * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#pragma once
+
 #include <Limelight.h>
 
 #include <dlfcn.h>
@@ -26,17 +28,26 @@
 
 #define IS_EMBEDDED(SYSTEM) SYSTEM != SDL
 
-enum platform { NONE, SDL, PI, IMX, AML, FAKE };
+enum platform { NONE, SDL, PI, IMX, AML, KMS, FAKE };
 
 enum platform platform_check(char*);
+const char* platform_name(enum platform system);
 PDECODER_RENDERER_CALLBACKS platform_get_video(enum platform system);
 PAUDIO_RENDERER_CALLBACKS platform_get_audio(enum platform system);
 bool platform_supports_hevc(enum platform system);
+void platform_prepare(enum platform system, PSTREAM_CONFIGURATION config, int drFlags);
+void platform_prepare_audio(PAUDIO_RENDERER_CALLBACKS callbacks);
 
 #ifdef HAVE_FAKE
 extern DECODER_RENDERER_CALLBACKS decoder_callbacks_fake;
 #endif
+#ifdef HAVE_KMS
+extern DECODER_RENDERER_CALLBACKS decoder_callbacks_kms;
+bool kms_init();
+void kms_prepare(int videoFormat, int width, int height, int redrawRate, int drFlags);
+#endif
 #ifdef HAVE_SDL
 extern DECODER_RENDERER_CALLBACKS decoder_callbacks_sdl;
+void sdl_prepare(int videoFormat, int width, int height, int redrawRate, int drFlags);
 void sdl_loop();
 #endif
@@ -0,0 +1,276 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "probe.h"
+#include "video.h"
+
+#if defined(HAVE_SDL) || defined(HAVE_KMS)
+#include "video/ffmpeg.h"
+#endif
+
+#include "clip.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define CLIP_BUFFER_SIZE 512*1024
+// Zeroed bytes after every frame, required by ffmpeg
+#define CLIP_PADDING 64
+
+// Every mode is decoded for half a second after the IDR frame
+#define PROBE_SECONDS_DIVIDER 2
+
+// The synthetic clip has no residual data, so the average decode time must
+// leave room for real content next to presentation. The slowest frames
+// still have to be decoded within the frame period.
+#define AVERAGE_BUDGET_PERCENTAGE 50
+#define SLOW_FRAME_PERCENTILE 95
+
+// HEVC takes more time to decode than the probed H.264 clip
+#define HEVC_COST_PERCENTAGE 150
+
+// Hardware decoders only queue the decode units, so they can't be timed.
+// They are assumed to keep up with 1080p at 60 fps.
+#define HARDWARE_CAPACITY (1920 * 1080 * 60 / 1000000)
+
+#define NETWORK_TIMEOUT 3000
+// Leave room for audio, control traffic and retransmissions
+#define THROUGHPUT_PERCENTAGE 75
+#define MIN_BITRATE 1000
+// Paths with a longer round trip or more jitter aren't a local network
+#define LOCAL_RTT_US 2000
+#define LOCAL_JITTER_US 1000
+// Fills a 1500 byte MTU, smaller packets avoid fragmentation over tunnels
+#define LOCAL_PACKET_SIZE 1392
+#define REMOTE_PACKET_SIZE 1024
+
+static const struct probe_mode {
+  int width, height, fps, bitrate;
+} modes[] = {
+  { 1280, 720, 30, 5000 },
+  { 1280, 720, 60, 10000 },
+  { 1920, 1080, 30, 10000 },
+  { 1920, 1080, 60, 20000 },
+  { 2560, 1440, 60, 40000 },
+  { 3840, 2160, 30, 40000 },
+  { 3840, 2160, 60, 80000 },
+};
+
+#define MODES (int) (sizeof(modes) / sizeof(modes[0]))
+
+static int mode_rate(const struct probe_mode* mode) {
+  return (long long) mode->width * mode->height * mode->fps / 1000000;
+}
+
+static long long probe_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#if defined(HAVE_SDL) || defined(HAVE_KMS)
+static DECODER_RENDERER_CALLBACKS probe_callbacks_ffmpeg;
+
+// Software platforms are timed on the decoder alone, without presentation
+static void probe_ffmpeg_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  int threads = ffmpeg_threads(videoFormat, width, height, redrawRate);
+  probe_callbacks_ffmpeg.capabilities = CAPABILITY_SLICES_PER_FRAME(threads);
+  if (ffmpeg_init(videoFormat, width, height, SLICE_THREADING, threads) < 0) {
+    fprintf(stderr, "Couldn't initialize video decoding\n");
+    exit(1);
+  }
+}
+
+static int probe_ffmpeg_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  return ffmpeg_decode((unsigned char*) decodeUnit->bufferList->data, decodeUnit->bufferList->length, NULL) == DR_NEED_IDR ? DR_NEED_IDR : DR_OK;
+}
+
+static DECODER_RENDERER_CALLBACKS probe_callbacks_ffmpeg = {
+  .setup = probe_ffmpeg_setup,
+  .cleanup = ffmpeg_destroy,
+  .submitDecodeUnit = probe_ffmpeg_submit_decode_unit,
+};
+#endif
+
+static int compare_time(const void* a, const void* b) {
+  long long diff = *(const long long*) a - *(const long long*) b;
+  return diff < 0 ? -1 : diff > 0;
+}
+
+// Returns true if the decoder keeps up with the mode within the budget
+static bool probe_mode(PDECODER_RENDERER_CALLBACKS callbacks, const struct probe_mode* mode) {
+  int frames = mode->fps / PROBE_SECONDS_DIVIDER + 1;
+  LENTRY* entries = calloc(frames, sizeof(LENTRY));
+  long long* times = calloc(frames, sizeof(long long));
+  char* buffer = malloc(CLIP_BUFFER_SIZE);
+  if (entries == NULL || times == NULL || buffer == NULL) {
+    fprintf(stderr, "Not enough memory\n");
+    exit(1);
+  }
+
+  callbacks->setup(VIDEO_FORMAT_H264, mode->width, mode->height, mode->fps, NULL, 0);
+
+  // Encode as many slices as the host would for this decoder
+  int slices = (callbacks->capabilities >> 24) & 0xff;
+  for (int i = 0; i < frames; i++) {
+    int length = gs_clip_frame(i, mode->width, mode->height, slices, buffer, CLIP_BUFFER_SIZE);
+    entries[i].data = length > 0 ? calloc(length + CLIP_PADDING, 1) : NULL;
+    if (entries[i].data == NULL) {
+      fprintf(stderr, "Can't generate probe clip\n");
+      exit(1);
+    }
+    memcpy(entries[i].data, buffer, length);
+    entries[i].length = length;
+  }
+
+  bool failed = false;
+  long long total = 0;
+  for (int i = 0; i < frames && !failed; i++) {
+    DECODE_UNIT decodeUnit = { .fullLength = entries[i].length, .bufferList = &entries[i] };
+    long long start = probe_time_us();
+    failed = callbacks->submitDecodeUnit(&decodeUnit) != DR_OK;
+    times[i] = probe_time_us() - start;
+    // Startup of the decoder isn't part of the stream
+    if (i > 0)
+      total += times[i];
+  }
+
+  callbacks->cleanup();
+
+  long long period = 1000000 / mode->fps;
+  long long average = total / (frames - 1);
+  qsort(times + 1, frames - 1, sizeof(long long), compare_time);
+  long long slow = times[1 + (frames - 2) * SLOW_FRAME_PERCENTILE / 100];
+
+  bool pass = !failed && average <= period * AVERAGE_BUDGET_PERCENTAGE / 100 && slow <= period;
+  if (failed)
+    printf("Probe %dx%d at %d fps: decoding failed\n", mode->width, mode->height, mode->fps);
+  else
+    printf("Probe %dx%d at %d fps: %.1f ms per frame (%.1f ms for the slowest frames), %s\n", mode->width, mode->height, mode->fps, average / 1000.0, slow / 1000.0, pass ? "ok" : "too slow");
+
+  for (int i = 0; i < frames; i++)
+    free(entries[i].data);
+  free(entries);
+  free(times);
+  free(buffer);
+  return pass;
+}
+
+// Decode a synthetic clip in increasingly demanding modes and return the
+// highest pixel rate in megapixels per second the decoder keeps up with,
+// or 0 if the decoder of the platform can't be probed
+int probe_decoder(enum platform system) {
+  // Only the software decoder returns when the frame has been decoded
+  PDECODER_RENDERER_CALLBACKS callbacks = NULL;
+  #if defined(HAVE_SDL) || defined(HAVE_KMS)
+  if (system == SDL || system == KMS)
+    callbacks = &probe_callbacks_ffmpeg;
+  #endif
+  if (callbacks == NULL)
+    return 0;
+
+  printf("Probing decoder capacity...\n");
+  // Fall back to the lowest mode if none is fast enough
+  int capacity = mode_rate(&modes[0]);
+  for (int i = 0; i < MODES && probe_mode(callbacks, &modes[i]); i++)
+    capacity = mode_rate(&modes[i]);
+
+  return capacity;
+}
+
+static void probe_save(char* host_config_file, int capacity) {
+  mkdir("hosts", 0755);
+  FILE* fd = fopen(host_config_file, "a");
+  if (fd == NULL) {
+    fprintf(stderr, "Can't save decoder capacity to %s\n", host_config_file);
+    return;
+  }
+
+  fprintf(fd, "decoder-capacity = %d\n", capacity);
+  fclose(fd);
+}
+
+// Select the highest mode within the decoder capacity the host supports,
+// probing the decoder first if the capacity isn't known for this host yet
+void probe_configure(PSERVER_DATA server, PCONFIGURATION config, enum platform system, char* host_config_file) {
+  if (config->decoder_capacity <= 0) {
+    config->decoder_capacity = probe_decoder(system);
+    if (config->decoder_capacity > 0)
+      probe_save(host_config_file, config->decoder_capacity);
+    else {
+      config->decoder_capacity = HARDWARE_CAPACITY;
+      if (config->stream.supportsHevc)
+        config->decoder_capacity = config->decoder_capacity * HEVC_COST_PERCENTAGE / 100;
+
+      printf("Can't probe the %s decoder, assuming %d megapixels per second\n", platform_name(system), config->decoder_capacity);
+    }
+  }
+
+  int i = MODES - 1;
+  for (; i > 0; i--) {
+    // gs_start_app refuses 4K on hosts without support for it
+    if (modes[i].height >= 2160 && !server->supports4K)
+      continue;
+
+    int rate = mode_rate(&modes[i]);
+    if (config->stream.supportsHevc)
+      rate = rate * HEVC_COST_PERCENTAGE / 100;
+
+    if (rate <= config->decoder_capacity)
+      break;
+  }
+
+  config->stream.width = modes[i].width;
+  config->stream.height = modes[i].height;
+  config->stream.fps = modes[i].fps;
+  if (!config->explicit_bitrate)
+    config->stream.bitrate = modes[i].bitrate;
+  printf("Decoder capacity %d megapixels per second, streaming %dx%d at %d fps and %d kbps\n", config->decoder_capacity, config->stream.width, config->stream.height, config->stream.fps, config->stream.bitrate);
+}
+
+// Limit the bitrate to the measured throughput, unless it was configured
+// explicitly, and choose the packet size from the round trip time and
+// jitter to the host
+void probe_network(PSERVER_DATA server, PCONFIGURATION config) {
+  NETWORK_PROBE probe;
+  int ret = gs_probe_network(server, &probe, NETWORK_TIMEOUT);
+  if (ret != GS_OK) {
+    fprintf(stderr, "Can't probe network: %s\n", gs_error);
+    return;
+  }
+
+  bool local = probe.rtt <= LOCAL_RTT_US && probe.jitter <= LOCAL_JITTER_US;
+  config->stream.packetSize = local ? LOCAL_PACKET_SIZE : REMOTE_PACKET_SIZE;
+  config->stream.streamingRemotely = !local;
+
+  if (probe.throughput > 0 && !config->explicit_bitrate) {
+    int bitrate = (long long) probe.throughput * THROUGHPUT_PERCENTAGE / 100;
+    if (bitrate < MIN_BITRATE)
+      bitrate = MIN_BITRATE;
+    if (bitrate < config->stream.bitrate)
+      config->stream.bitrate = bitrate;
+  }
+
+  printf("Network round trip %.1f ms, jitter %.1f ms, throughput %d kbps%s\n", probe.rtt / 1000.0, probe.jitter / 1000.0, probe.throughput, probe.throughput > 0 ? "" : " (not measurable)");
+  printf("Streaming %s at %d kbps with packets of %d bytes\n", local ? "locally" : "remotely", config->stream.bitrate, config->stream.packetSize);
+}
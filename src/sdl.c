@@ -20,19 +20,40 @@
 #ifdef HAVE_SDL
 
 #include "sdl.h"
+#include "gl.h"
+#include "pacer.h"
+#include "startup.h"
+#include "trace.h"
 #include "input/sdlinput.h"
 
 #include <Limelight.h>
 
-static bool done;
+static bool done, presented, use_gl;
 static int fullscreen_flags;
 
 static SDL_Window *window;
 static SDL_Renderer *renderer;
 static SDL_Texture *bmp;
 
+static Uint8** frame_data;
+static int* frame_linesize;
+
 SDL_mutex *mutex;
 
+static void init_renderer(int width, int height) {
+  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  if (!renderer) {
+    printf("SDL_CreateRenderer failed: %s\n", SDL_GetError());
+    exit(1);
+  }
+
+  bmp = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STREAMING, width, height);
+  if (!bmp) {
+    fprintf(stderr, "SDL: could not create texture - exiting\n");
+    exit(1);
+  }
+}
+
 void sdl_init(int width, int height, bool fullscreen) {
   if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS)) {
     fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());
@@ -47,17 +68,15 @@ void sdl_init(int width, int height, bool fullscreen) {
   }
 
   SDL_SetRelativeMouseMode(SDL_TRUE);
-  renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-  if (!renderer) {
-    printf("SDL_CreateRenderer failed: %s\n", SDL_GetError());
-    exit(1);
-  }
 
-  bmp = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STREAMING, width, height);
-  if (!bmp) {
-    fprintf(stderr, "SDL: could not create texture - exiting\n");
-    exit(1);
-  }
+  SDL_DisplayMode mode;
+  if (SDL_GetWindowDisplayMode(window, &mode) == 0)
+    pacer_set_refresh_rate(mode.refresh_rate);
+
+  // Prefer rendering with shaders, the SDL renderer is used as fallback
+  use_gl = gl_init(window, width, height);
+  if (!use_gl)
+    init_renderer(width, height);
 
   mutex = SDL_CreateMutex();
   if (!mutex) {
@@ -69,42 +88,121 @@ void sdl_init(int width, int height, bool fullscreen) {
   sdlinput_init();
 }
 
+// Present the newest decoded frame
+static void sdl_present() {
+  if (SDL_LockMutex(mutex) != 0) {
+    fprintf(stderr, "Couldn't lock mutex\n");
+    return;
+  }
+
+  long long renderDone;
+  long long span = trace_begin();
+  if (use_gl) {
+    // Only copying the frame blocks the decoder, not waiting for vsync
+    gl_upload(frame_data, frame_linesize);
+    SDL_UnlockMutex(mutex);
+    trace_end("texture_upload", span);
+    span = trace_begin();
+    gl_draw();
+    renderDone = pacer_time_us();
+    SDL_GL_SwapWindow(window);
+  } else {
+    SDL_UpdateYUVTexture(bmp, NULL, frame_data[0], frame_linesize[0], frame_data[1], frame_linesize[1], frame_data[2], frame_linesize[2]);
+    SDL_UnlockMutex(mutex);
+    trace_end("texture_upload", span);
+    span = trace_begin();
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, bmp, NULL, NULL);
+    renderDone = pacer_time_us();
+    SDL_RenderPresent(renderer);
+  }
+  trace_end("present", span);
+  pacer_end_present(renderDone);
+
+  if (!presented) {
+    startup_mark("first_frame_presented");
+    presented = true;
+  }
+}
+
+static void sdl_handle_event(SDL_Event* event) {
+  switch (sdlinput_handle_event(event)) {
+  case SDL_QUIT_APPLICATION:
+    done = true;
+    break;
+  case SDL_TOGGLE_FULLSCREEN:
+    fullscreen_flags ^= SDL_WINDOW_FULLSCREEN;
+    SDL_SetWindowFullscreen(window, fullscreen_flags);
+  case SDL_MOUSE_GRAB:
+    SDL_SetRelativeMouseMode(SDL_TRUE);
+    break;
+  case SDL_MOUSE_UNGRAB:
+    SDL_SetRelativeMouseMode(SDL_FALSE);
+    break;
+  default:
+    if (event->type == SDL_QUIT)
+      done = true;
+    else if (event->type == SDL_USEREVENT && event->user.code == SDL_CODE_FRAME) {
+      frame_data = (Uint8**) event->user.data1;
+      frame_linesize = (int*) event->user.data2;
+    }
+  }
+}
+
+// Forward all pending keyboard, mouse, controller and touch events to the
+// host, frame and window events stay queued behind them
+static void sdl_forward_input() {
+  SDL_Event event;
+  SDL_PumpEvents();
+  while (!done && SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_KEYDOWN, SDL_MULTIGESTURE) > 0)
+    sdl_handle_event(&event);
+}
+
 void sdl_loop() {
   SDL_Event event;
-  while(!done && SDL_WaitEvent(&event)) {
-    switch (sdlinput_handle_event(&event)) {
-    case SDL_QUIT_APPLICATION:
-      done = true;
-      break;
-    case SDL_TOGGLE_FULLSCREEN:
-      fullscreen_flags ^= SDL_WINDOW_FULLSCREEN;
-      SDL_SetWindowFullscreen(window, fullscreen_flags);
-    case SDL_MOUSE_GRAB:
-      SDL_SetRelativeMouseMode(SDL_TRUE);
-      break;
-    case SDL_MOUSE_UNGRAB:
-      SDL_SetRelativeMouseMode(SDL_FALSE);
-      break;
-    default:
-      if (event.type == SDL_QUIT)
-        done = true;
-      else if (event.type == SDL_USEREVENT) {
-        if (event.user.code == SDL_CODE_FRAME) {
-          if (SDL_LockMutex(mutex) == 0) {
-            Uint8** data = ((Uint8**) event.user.data1);
-            int* linesize = ((int*) event.user.data2);
-            SDL_UpdateYUVTexture(bmp, NULL, data[0], linesize[0], data[1], linesize[1], data[2], linesize[2]);
-            SDL_RenderClear(renderer);
-            SDL_RenderCopy(renderer, bmp, NULL, NULL);
-            SDL_RenderPresent(renderer);
-            SDL_UnlockMutex(mutex);
-          } else
-            fprintf(stderr, "Couldn't lock mutex\n");
-        }
-      }
+  done = false;
+  while(!done) {
+    // Wait for events until the deadline of a pending frame
+    int timeout = pacer_wait_time();
+    if (timeout < 0 ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event, timeout))
+      sdl_handle_event(&event);
+
+    if (frame_data != NULL && pacer_begin_present()) {
+      // Uploading and presenting can block up to a refresh, input queued
+      // before or during that time must not wait for the next iteration
+      sdl_forward_input();
+      sdl_present();
+      sdl_forward_input();
+    }
+  }
+
+  pacer_report();
+}
+
+// Stop the loop from another thread, the window is kept
+void sdl_stop() {
+  SDL_Event event;
+  event.type = SDL_QUIT;
+  SDL_PushEvent(&event);
+}
+
+// Resize the video textures, while the loop isn't running
+void sdl_resize(int width, int height) {
+  frame_data = NULL;
+  if (use_gl)
+    gl_resize(width, height);
+  else {
+    SDL_DestroyTexture(bmp);
+    bmp = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!bmp) {
+      fprintf(stderr, "SDL: could not create texture - exiting\n");
+      exit(1);
     }
   }
+}
 
+void sdl_destroy() {
+  gl_destroy();
   SDL_DestroyWindow(window);
   SDL_Quit();
 }
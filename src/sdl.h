@@ -33,6 +33,9 @@
 
 void sdl_init(int width, int height, bool fullscreen);
 void sdl_loop();
+void sdl_stop();
+void sdl_resize(int width, int height);
+void sdl_destroy();
 
 SDL_mutex *mutex;
 
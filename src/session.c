@@ -0,0 +1,344 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "session.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "pacer.h"
+#include "startup.h"
+#include "configuration.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+static const char* input_names[SESSION_INPUT_TYPES] = { "keyboard", "mouse", "gamepad" };
+static const char* input_metric_names[SESSION_INPUT_TYPES] = {
+  "moonlight_input_keyboard_events_total",
+  "moonlight_input_mouse_events_total",
+  "moonlight_input_gamepad_events_total",
+};
+static const char* latency_metric_names[SESSION_INPUT_TYPES] = {
+  "moonlight_input_keyboard_latency_seconds",
+  "moonlight_input_mouse_latency_seconds",
+  "moonlight_input_gamepad_latency_seconds",
+};
+
+#define MAX_SESSION_DEVICES 16
+
+struct session_device {
+  char name[64];
+  HISTOGRAM latency[SESSION_INPUT_TYPES];
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* log_directory;
+static time_t start_time;
+static long long start_us;
+
+static DECODER_RENDERER_CALLBACKS video_callbacks;
+static PDECODER_RENDERER_CALLBACKS video_target;
+static AUDIO_RENDERER_CALLBACKS audio_callbacks;
+static PAUDIO_RENDERER_CALLBACKS audio_target;
+
+static long frames, idr_requests, audio_packets;
+static long long video_bytes;
+static long inputs[SESSION_INPUT_TYPES];
+static HISTOGRAM decode_time, audio_time, present_latency;
+// Presentation statistics of the connections before the current one
+static PACER_STATS presentation;
+
+static PMETRIC metric_frames, metric_bytes, metric_idr_requests, metric_decode_time, metric_frame_interval;
+static PMETRIC metric_audio_packets, metric_audio_time;
+static PMETRIC metric_inputs[SESSION_INPUT_TYPES], metric_input_latency[SESSION_INPUT_TYPES];
+static struct session_device devices[MAX_SESSION_DEVICES];
+static int numDevices;
+static PMETRIC metric_active, metric_width, metric_height, metric_fps;
+static long long last_submit;
+
+static long long session_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void session_metrics() {
+  metric_frames = metrics_counter("moonlight_video_frames_total", "Frames submitted to the decoder");
+  metric_bytes = metrics_counter("moonlight_video_bytes_total", "Bytes of video submitted to the decoder");
+  metric_idr_requests = metrics_counter("moonlight_video_idr_requests_total", "IDR frames requested by the decoder");
+  metric_decode_time = metrics_histogram("moonlight_video_decode_seconds", "Time to submit a frame to the decoder");
+  metric_frame_interval = metrics_histogram("moonlight_video_frame_interval_seconds", "Time between frames received from the host");
+  metric_audio_packets = metrics_counter("moonlight_audio_packets_total", "Audio packets decoded");
+  metric_audio_time = metrics_histogram("moonlight_audio_decode_seconds", "Time to decode and play an audio packet");
+  for (int i = 0; i < SESSION_INPUT_TYPES; i++) {
+    metric_inputs[i] = metrics_counter(input_metric_names[i], "Input events sent to the host");
+    metric_input_latency[i] = metrics_histogram(latency_metric_names[i], "Time from the kernel event to sending it to the host");
+  }
+
+  metric_active = metrics_gauge("moonlight_stream_active", "Whether the video stream is running");
+  metric_width = metrics_gauge("moonlight_stream_width", "Width of the video stream");
+  metric_height = metrics_gauge("moonlight_stream_height", "Height of the video stream");
+  metric_fps = metrics_gauge("moonlight_stream_fps", "Framerate of the video stream");
+}
+
+// Starts the session report if directory isn't NULL and exports the
+// session counters when metrics are enabled
+void session_init(const char* directory) {
+  log_directory = directory;
+  start_time = time(NULL);
+  start_us = session_time_us();
+  session_metrics();
+}
+
+void session_input(enum session_input type) {
+  metrics_add(metric_inputs[type], 1);
+  if (log_directory == NULL)
+    return;
+
+  pthread_mutex_lock(&lock);
+  inputs[type]++;
+  pthread_mutex_unlock(&lock);
+}
+
+// Returns the index of the input device to report latencies for, devices
+// with the same name are reported together
+int session_device(const char* name) {
+  int device = -1;
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < numDevices && device < 0; i++) {
+    if (strcmp(devices[i].name, name) == 0)
+      device = i;
+  }
+
+  if (device < 0 && numDevices < MAX_SESSION_DEVICES) {
+    device = numDevices++;
+    snprintf(devices[device].name, sizeof(devices[device].name), "%s", name);
+  }
+  pthread_mutex_unlock(&lock);
+  return device;
+}
+
+// Record the time since the event was received by the kernel, given in
+// us on the monotonic clock, when sending it to the host
+void session_input_latency(int device, enum session_input type, long long time) {
+  long long latency = session_time_us() - time;
+  metrics_observe(metric_input_latency[type], latency);
+  if (log_directory == NULL || device < 0)
+    return;
+
+  pthread_mutex_lock(&lock);
+  histogram_add(&devices[device].latency[type], latency);
+  pthread_mutex_unlock(&lock);
+}
+
+// Add the presentation statistics of a connection that ended, the pacer
+// starts over for every connection. Only the SDL and KMS platforms present
+// through the pacer, the statistics stay zero on the other platforms.
+void session_collect() {
+  if (log_directory == NULL)
+    return;
+
+  PACER_STATS stats;
+  HISTOGRAM latency;
+  pacer_get_stats(&stats);
+  pacer_get_latency(&latency);
+
+  pthread_mutex_lock(&lock);
+  presentation.decoded += stats.decoded;
+  presentation.presented += stats.presented;
+  presentation.dropped += stats.dropped;
+  presentation.repeated += stats.repeated;
+  histogram_merge(&present_latency, &latency);
+  pthread_mutex_unlock(&lock);
+}
+
+static void session_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  last_submit = 0;
+  metrics_set(metric_width, width);
+  metrics_set(metric_height, height);
+  metrics_set(metric_fps, redrawRate);
+  metrics_set(metric_active, 1);
+  video_target->setup(videoFormat, width, height, redrawRate, context, drFlags);
+}
+
+static void session_cleanup() {
+  metrics_set(metric_active, 0);
+  video_target->cleanup();
+}
+
+static int session_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  long long start = session_time_us();
+  int ret = video_target->submitDecodeUnit(decodeUnit);
+  long long end = session_time_us();
+
+  metrics_add(metric_frames, 1);
+  metrics_add(metric_bytes, decodeUnit->fullLength);
+  if (ret == DR_NEED_IDR)
+    metrics_add(metric_idr_requests, 1);
+
+  metrics_observe(metric_decode_time, end - start);
+  // Only the decoder thread submits frames
+  if (last_submit > 0)
+    metrics_observe(metric_frame_interval, start - last_submit);
+
+  last_submit = start;
+  if (log_directory == NULL)
+    return ret;
+
+  pthread_mutex_lock(&lock);
+  frames++;
+  video_bytes += decodeUnit->fullLength;
+  if (ret == DR_NEED_IDR)
+    idr_requests++;
+
+  histogram_add(&decode_time, end - start);
+  pthread_mutex_unlock(&lock);
+  return ret;
+}
+
+static void session_decode_and_play_sample(char* data, int length) {
+  long long start = session_time_us();
+  audio_target->decodeAndPlaySample(data, length);
+  long long end = session_time_us();
+
+  metrics_add(metric_audio_packets, 1);
+  metrics_observe(metric_audio_time, end - start);
+  if (log_directory == NULL)
+    return;
+
+  pthread_mutex_lock(&lock);
+  audio_packets++;
+  histogram_add(&audio_time, end - start);
+  pthread_mutex_unlock(&lock);
+}
+
+PDECODER_RENDERER_CALLBACKS session_video(PDECODER_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL || (log_directory == NULL && !metrics_enabled()))
+    return callbacks;
+
+  video_target = callbacks;
+  video_callbacks = *callbacks;
+  video_callbacks.setup = session_setup;
+  video_callbacks.cleanup = session_cleanup;
+  video_callbacks.submitDecodeUnit = session_submit_decode_unit;
+  return &video_callbacks;
+}
+
+PAUDIO_RENDERER_CALLBACKS session_audio(PAUDIO_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL || (log_directory == NULL && !metrics_enabled()))
+    return callbacks;
+
+  audio_target = callbacks;
+  audio_callbacks = *callbacks;
+  audio_callbacks.decodeAndPlaySample = session_decode_and_play_sample;
+  return &audio_callbacks;
+}
+
+static void session_write_string(FILE* fd, const char* value) {
+  fputc('"', fd);
+  for (; value != NULL && *value != 0; value++) {
+    if (*value == '"' || *value == '\\')
+      fprintf(fd, "\\%c", *value);
+    else if ((unsigned char) *value < 0x20)
+      fprintf(fd, "\\u%04x", *value);
+    else
+      fputc(*value, fd);
+  }
+  fputc('"', fd);
+}
+
+// Times in ms, percentiles are the upper bound of their bucket
+static void session_write_histogram(FILE* fd, const char* name, PHISTOGRAM histogram) {
+  fprintf(fd, "\"%s\": {\"count\": %ld, \"avg\": %.2f, \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f}", name, histogram->count,
+    histogram->count > 0 ? histogram->sum / 1000.0 / histogram->count : 0,
+    histogram_percentile(histogram, 50) / 1000.0, histogram_percentile(histogram, 90) / 1000.0,
+    histogram_percentile(histogram, 99) / 1000.0, histogram->max / 1000.0);
+}
+
+// Write the session report to a new file in the log directory
+void session_save(PCONFIGURATION config, const char* platform) {
+  if (log_directory == NULL)
+    return;
+
+  char fileName[4096];
+  char timestamp[32];
+  struct tm tm;
+  gmtime_r(&start_time, &tm);
+  strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", &tm);
+  snprintf(fileName, sizeof(fileName), "%s/session-%s-%d.json", log_directory, timestamp, (int) getpid());
+
+  mkdir(log_directory, 0755);
+  FILE* fd = fopen(fileName, "w");
+  if (fd == NULL) {
+    fprintf(stderr, "Can't open session log: %s\n", fileName);
+    return;
+  }
+
+  double duration = (session_time_us() - start_us) / 1000000.0;
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+  PSTREAM_CONFIGURATION stream = &config->stream;
+
+  pthread_mutex_lock(&lock);
+  fprintf(fd, "{\n  \"version\": \"%d.%d.%d\",\n  \"start\": \"%s\",\n  \"duration\": %.1f,\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, timestamp, duration);
+  fprintf(fd, "  \"host\": ");
+  session_write_string(fd, config->address);
+  fprintf(fd, ",\n  \"app\": ");
+  session_write_string(fd, config->app);
+  fprintf(fd, ",\n  \"platform\": \"%s\",\n", platform);
+  fprintf(fd, "  \"stream\": {\"width\": %d, \"height\": %d, \"fps\": %d, \"bitrate\": %d, \"packetSize\": %d, \"remote\": %s, \"hevc\": %s, \"audio\": \"%s\"},\n",
+    stream->width, stream->height, stream->fps, stream->bitrate, stream->packetSize, stream->streamingRemotely ? "true" : "false",
+    stream->supportsHevc ? "true" : "false", stream->audioConfiguration == AUDIO_CONFIGURATION_51_SURROUND ? "5.1" : "stereo");
+
+  fprintf(fd, "  \"video\": {\"frames\": %ld, \"bytes\": %lld, \"idrRequests\": %ld, ", frames, video_bytes, idr_requests);
+  session_write_histogram(fd, "decode", &decode_time);
+  fprintf(fd, "},\n  \"presentation\": {\"decoded\": %ld, \"presented\": %ld, \"dropped\": %ld, \"repeated\": %ld, ", presentation.decoded, presentation.presented, presentation.dropped, presentation.repeated);
+  session_write_histogram(fd, "latency", &present_latency);
+  fprintf(fd, "},\n  \"audio\": {\"packets\": %ld, ", audio_packets);
+  session_write_histogram(fd, "decode", &audio_time);
+  fprintf(fd, "},\n  \"input\": {");
+  for (int i = 0; i < SESSION_INPUT_TYPES; i++)
+    fprintf(fd, "%s\"%s\": {\"events\": %ld, \"rate\": %.2f}", i > 0 ? ", " : "", input_names[i], inputs[i], duration > 0 ? inputs[i] / duration : 0);
+
+  // Latency from the kernel event to sending it, per device and class
+  fprintf(fd, ", \"latency\": [");
+  for (int i = 0; i < numDevices; i++) {
+    fprintf(fd, "%s\n    {\"device\": ", i > 0 ? "," : "");
+    session_write_string(fd, devices[i].name);
+    for (int j = 0; j < SESSION_INPUT_TYPES; j++) {
+      if (devices[i].latency[j].count > 0) {
+        fprintf(fd, ", ");
+        session_write_histogram(fd, input_names[j], &devices[i].latency[j]);
+      }
+    }
+    fprintf(fd, "}");
+  }
+  fprintf(fd, "%s]", numDevices > 0 ? "\n  " : "");
+  fprintf(fd, "},\n  \"startup\": {\n");
+  pthread_mutex_unlock(&lock);
+
+  startup_write_events(fd, "    ");
+  fprintf(fd, "\n  }\n}\n");
+  fclose(fd);
+  printf("Session log written to %s\n", fileName);
+}
@@ -0,0 +1,36 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <Limelight.h>
+
+enum session_input { SESSION_INPUT_KEYBOARD, SESSION_INPUT_MOUSE, SESSION_INPUT_GAMEPAD, SESSION_INPUT_TYPES };
+
+void session_init(const char* directory);
+void session_input(enum session_input type);
+int session_device(const char* name);
+void session_input_latency(int device, enum session_input type, long long time);
+void session_collect();
+void session_save(PCONFIGURATION config, const char* platform);
+
+PDECODER_RENDERER_CALLBACKS session_video(PDECODER_RENDERER_CALLBACKS callbacks);
+PAUDIO_RENDERER_CALLBACKS session_audio(PAUDIO_RENDERER_CALLBACKS callbacks);
@@ -0,0 +1,205 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "startup.h"
+#include "configuration.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_STARTUP_EVENTS 32
+
+struct startup_event {
+  const char* name;
+  long long start, end;
+  bool mark;
+};
+
+static struct startup_event events[MAX_STARTUP_EVENTS];
+static int numEvents;
+static long long startTime;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* fileName;
+
+static DECODER_RENDERER_CALLBACKS video_callbacks;
+static PDECODER_RENDERER_CALLBACKS video_target;
+static AUDIO_RENDERER_CALLBACKS audio_callbacks;
+static PAUDIO_RENDERER_CALLBACKS audio_target;
+static bool frame_submitted;
+
+static long long startup_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct startup_event* startup_find(const char* name) {
+  for (int i = numEvents - 1; i >= 0; i--) {
+    if (strcmp(events[i].name, name) == 0)
+      return &events[i];
+  }
+  return NULL;
+}
+
+void startup_init() {
+  startTime = startup_time_us();
+}
+
+void startup_begin(const char* phase) {
+  long long now = startup_time_us() - startTime;
+
+  pthread_mutex_lock(&lock);
+  if (numEvents < MAX_STARTUP_EVENTS) {
+    events[numEvents].name = phase;
+    events[numEvents].start = now;
+    events[numEvents].end = -1;
+    events[numEvents].mark = false;
+    numEvents++;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void startup_end(const char* phase) {
+  long long now = startup_time_us() - startTime;
+
+  pthread_mutex_lock(&lock);
+  struct startup_event* event = startup_find(phase);
+  if (event != NULL && event->end < 0)
+    event->end = now;
+  pthread_mutex_unlock(&lock);
+}
+
+void startup_mark(const char* name) {
+  long long now = startup_time_us() - startTime;
+
+  pthread_mutex_lock(&lock);
+  if (startup_find(name) == NULL && numEvents < MAX_STARTUP_EVENTS) {
+    events[numEvents].name = name;
+    events[numEvents].start = now;
+    events[numEvents].end = now;
+    events[numEvents].mark = true;
+    numEvents++;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+long startup_duration_ms(const char* phase) {
+  long duration = -1;
+
+  pthread_mutex_lock(&lock);
+  struct startup_event* event = startup_find(phase);
+  if (event != NULL && event->end >= 0)
+    duration = (event->end - event->start) / 1000;
+  pthread_mutex_unlock(&lock);
+
+  return duration;
+}
+
+static void startup_video_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  startup_begin("decoder_setup");
+  video_target->setup(videoFormat, width, height, redrawRate, context, drFlags);
+  startup_end("decoder_setup");
+}
+
+static int startup_video_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  int ret = video_target->submitDecodeUnit(decodeUnit);
+  if (!frame_submitted) {
+    startup_mark("first_frame_submitted");
+    frame_submitted = true;
+  }
+  return ret;
+}
+
+static void startup_audio_init(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig) {
+  startup_begin("audio_init");
+  audio_target->init(audioConfiguration, opusConfig);
+  startup_end("audio_init");
+}
+
+PDECODER_RENDERER_CALLBACKS startup_trace_video(PDECODER_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL)
+    return NULL;
+
+  video_target = callbacks;
+  video_callbacks = *callbacks;
+  video_callbacks.setup = startup_video_setup;
+  video_callbacks.submitDecodeUnit = startup_video_submit_decode_unit;
+  return &video_callbacks;
+}
+
+PAUDIO_RENDERER_CALLBACKS startup_trace_audio(PAUDIO_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL)
+    return NULL;
+
+  audio_target = callbacks;
+  audio_callbacks = *callbacks;
+  audio_callbacks.init = startup_audio_init;
+  return &audio_callbacks;
+}
+
+// Writes the phases and events as JSON members, in microseconds
+void startup_write_events(FILE* fd, const char* indent) {
+  pthread_mutex_lock(&lock);
+  fprintf(fd, "%s\"phases\": [", indent);
+  bool first = true;
+  for (int i = 0; i < numEvents; i++) {
+    if (events[i].mark)
+      continue;
+
+    fprintf(fd, "%s\n%s  {\"name\": \"%s\", \"start\": %lld, \"end\": %lld, \"duration\": %lld}", first ? "" : ",", indent, events[i].name, events[i].start, events[i].end, events[i].end >= 0 ? events[i].end - events[i].start : -1);
+    first = false;
+  }
+  fprintf(fd, "\n%s],\n%s\"events\": [", indent, indent);
+  first = true;
+  for (int i = 0; i < numEvents; i++) {
+    if (!events[i].mark)
+      continue;
+
+    fprintf(fd, "%s\n%s  {\"name\": \"%s\", \"time\": %lld}", first ? "" : ",", indent, events[i].name, events[i].start);
+    first = false;
+  }
+  fprintf(fd, "\n%s]", indent);
+  pthread_mutex_unlock(&lock);
+}
+
+static void startup_write() {
+  FILE* fd = fopen(fileName, "w");
+  if (fd == NULL) {
+    fprintf(stderr, "Can't open startup trace file: %s\n", fileName);
+    return;
+  }
+
+  fprintf(fd, "{\n  \"version\": \"%d.%d.%d\",\n  \"clock\": \"monotonic\",\n  \"unit\": \"us\",\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
+  startup_write_events(fd, "  ");
+  fprintf(fd, "\n}\n");
+  fclose(fd);
+}
+
+// The report is written on exit, so failed startups are recorded as well
+void startup_save(const char* file) {
+  if (fileName == NULL)
+    atexit(startup_write);
+
+  fileName = file;
+}
@@ -0,0 +1,37 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Limelight.h>
+
+#include <stdio.h>
+#include <stdbool.h>
+
+void startup_init();
+void startup_begin(const char* phase);
+void startup_end(const char* phase);
+void startup_mark(const char* event);
+long startup_duration_ms(const char* phase);
+
+PDECODER_RENDERER_CALLBACKS startup_trace_video(PDECODER_RENDERER_CALLBACKS callbacks);
+PAUDIO_RENDERER_CALLBACKS startup_trace_audio(PAUDIO_RENDERER_CALLBACKS callbacks);
+
+void startup_write_events(FILE* fd, const char* indent);
+void startup_save(const char* fileName);
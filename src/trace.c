@@ -0,0 +1,190 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#define MAX_TRACE_THREADS 16
+// Ring buffer size per thread, older spans are overwritten
+#define TRACE_SPANS 16384
+
+struct trace_span {
+  const char* name;
+  long long start, duration;
+};
+
+struct trace_thread {
+  pid_t tid;
+  char name[16];
+  unsigned long count;
+  struct trace_span* spans;
+};
+
+static const char* fileName;
+static bool enabled;
+static long long startTime;
+
+static struct trace_thread threads[MAX_TRACE_THREADS];
+static struct trace_span* spans;
+static int numThreads;
+
+// Ring buffer of the current thread, NULL until its first span
+static __thread struct trace_thread* current;
+static __thread bool dropped;
+
+static DECODER_RENDERER_CALLBACKS video_callbacks;
+static PDECODER_RENDERER_CALLBACKS video_target;
+static AUDIO_RENDERER_CALLBACKS audio_callbacks;
+static PAUDIO_RENDERER_CALLBACKS audio_target;
+
+static long long trace_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Record spans of all threads to a Chrome trace-event file written by trace_save
+bool trace_init(const char* file) {
+  spans = calloc(MAX_TRACE_THREADS * TRACE_SPANS, sizeof(struct trace_span));
+  if (spans == NULL) {
+    fprintf(stderr, "Not enough memory for tracing\n");
+    return false;
+  }
+
+  // Touch all pages now, so recording never faults them in
+  memset(spans, 0, MAX_TRACE_THREADS * TRACE_SPANS * sizeof(struct trace_span));
+  for (int i = 0; i < MAX_TRACE_THREADS; i++)
+    threads[i].spans = &spans[i * TRACE_SPANS];
+
+  fileName = file;
+  startTime = trace_time_ns();
+  enabled = true;
+  return true;
+}
+
+// Claim a ring buffer for the calling thread
+static struct trace_thread* trace_thread() {
+  int index = __atomic_fetch_add(&numThreads, 1, __ATOMIC_RELAXED);
+  if (index >= MAX_TRACE_THREADS) {
+    dropped = true;
+    return NULL;
+  }
+
+  struct trace_thread* thread = &threads[index];
+  thread->tid = syscall(SYS_gettid);
+  pthread_getname_np(pthread_self(), thread->name, sizeof(thread->name));
+  return thread;
+}
+
+long long trace_begin() {
+  return enabled ? trace_time_ns() : 0;
+}
+
+void trace_end(const char* name, long long start) {
+  if (start == 0 || dropped)
+    return;
+
+  if (current == NULL && (current = trace_thread()) == NULL)
+    return;
+
+  struct trace_span* span = &current->spans[current->count % TRACE_SPANS];
+  span->name = name;
+  span->start = start;
+  span->duration = trace_time_ns() - start;
+  __atomic_store_n(&current->count, current->count + 1, __ATOMIC_RELEASE);
+}
+
+static int trace_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  long long span = trace_begin();
+  int ret = video_target->submitDecodeUnit(decodeUnit);
+  trace_end("submitDecodeUnit", span);
+  return ret;
+}
+
+static void trace_decode_and_play_sample(char* data, int length) {
+  long long span = trace_begin();
+  audio_target->decodeAndPlaySample(data, length);
+  trace_end("decodeAndPlaySample", span);
+}
+
+PDECODER_RENDERER_CALLBACKS trace_video(PDECODER_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL || !enabled)
+    return callbacks;
+
+  video_target = callbacks;
+  video_callbacks = *callbacks;
+  video_callbacks.submitDecodeUnit = trace_submit_decode_unit;
+  return &video_callbacks;
+}
+
+PAUDIO_RENDERER_CALLBACKS trace_audio(PAUDIO_RENDERER_CALLBACKS callbacks) {
+  if (callbacks == NULL || !enabled)
+    return callbacks;
+
+  audio_target = callbacks;
+  audio_callbacks = *callbacks;
+  audio_callbacks.decodeAndPlaySample = trace_decode_and_play_sample;
+  return &audio_callbacks;
+}
+
+// Write all recorded spans as complete events with times in us
+void trace_save() {
+  if (!enabled)
+    return;
+
+  FILE* fd = fopen(fileName, "w");
+  if (fd == NULL) {
+    fprintf(stderr, "Can't open trace file: %s\n", fileName);
+    return;
+  }
+
+  int pid = getpid();
+  int count = __atomic_load_n(&numThreads, __ATOMIC_ACQUIRE);
+  if (count > MAX_TRACE_THREADS) {
+    fprintf(stderr, "Spans of %d threads aren't traced\n", count - MAX_TRACE_THREADS);
+    count = MAX_TRACE_THREADS;
+  }
+
+  bool first = true;
+  fprintf(fd, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  for (int i = 0; i < count; i++) {
+    struct trace_thread* thread = &threads[i];
+    fprintf(fd, "%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}", first ? "" : ",", pid, thread->tid, thread->name);
+    first = false;
+
+    unsigned long end = __atomic_load_n(&thread->count, __ATOMIC_ACQUIRE);
+    unsigned long begin = end > TRACE_SPANS ? end - TRACE_SPANS : 0;
+    for (unsigned long j = begin; j < end; j++) {
+      struct trace_span* span = &thread->spans[j % TRACE_SPANS];
+      fprintf(fd, ",\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", span->name, pid, thread->tid, (span->start - startTime) / 1000.0, span->duration / 1000.0);
+    }
+  }
+  fprintf(fd, "\n]}\n");
+  fclose(fd);
+  printf("Trace written to %s\n", fileName);
+}
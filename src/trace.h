@@ -0,0 +1,35 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Limelight.h>
+
+#include <stdbool.h>
+
+bool trace_init(const char* file);
+void trace_save();
+
+// Returns the start of a span or 0 if tracing is disabled, the name
+// passed to trace_end must be a string constant
+long long trace_begin();
+void trace_end(const char* name, long long start);
+
+PDECODER_RENDERER_CALLBACKS trace_video(PDECODER_RENDERER_CALLBACKS callbacks);
+PAUDIO_RENDERER_CALLBACKS trace_audio(PAUDIO_RENDERER_CALLBACKS callbacks);
@@ -19,3 +19,5 @@
 
 #define DISPLAY_FULLSCREEN 1
 #define FORCE_HARDWARE_ACCELERATION 2
+
+extern int decoder_threads;
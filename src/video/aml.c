@@ -18,6 +18,7 @@
  * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "sps.h"
 #include <Limelight.h>
 
 #include <sys/utsname.h>
@@ -33,6 +34,7 @@
 #define UCODE_IP_ONLY_PARAM 0x08
 
 static codec_para_t codecParam = { 0 };
+static bool hevc;
 
 static int osd_blank(char *path,int cmd) {
   int fd;
@@ -57,6 +59,7 @@ void aml_setup(int videoFormat, int width, int height, int redrawRate, void* con
   osd_blank("/sys/class/graphics/fb0/blank",1);
   osd_blank("/sys/class/graphics/fb1/blank",0);
 
+  hevc = false;
   codecParam.stream_type = STREAM_TYPE_ES_VIDEO;
   codecParam.has_video = 1;
   codecParam.noblock = 0;
@@ -81,6 +84,7 @@ void aml_setup(int videoFormat, int width, int height, int redrawRate, void* con
       }
       break;
     case VIDEO_FORMAT_H265:
+      hevc = true;
       codecParam.video_type = VFORMAT_HEVC;
       codecParam.am_sysinfo.format = VIDEO_DEC_FORMAT_HEVC;
       break;
@@ -111,8 +115,10 @@ int aml_submit_decode_unit(PDECODE_UNIT decodeUnit) {
   int result = DR_OK;
   PLENTRY entry = decodeUnit->bufferList;
   while (entry != NULL) {
-    int api = codec_write(&codecParam, entry->data, entry->length);
-    if (api != entry->length) {
+    // Limit reordering and buffering in the HEVC parameter sets
+    PLENTRY nal = hevc ? gs_sps_fix(entry, GS_SPS_HEVC | GS_SPS_BITSTREAM_FIXUP) : entry;
+    int api = codec_write(&codecParam, nal->data, nal->length);
+    if (api != nal->length) {
       fprintf(stderr, "codec_write error: %x\n", api);
       codec_reset(&codecParam);
       result = DR_NEED_IDR;
@@ -18,6 +18,8 @@
  */
 
 #include "ffmpeg.h"
+#include "../video.h"
+#include "../trace.h"
 
 #ifdef HAVE_VDPAU
 #include "ffmpeg_vdpau.h"
@@ -30,6 +32,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <unistd.h>
 
 // General decoder and renderer state
 static AVPacket pkt;
@@ -40,8 +43,49 @@ static AVFrame* dec_frame;
 enum decoders {SOFTWARE, VDPAU};
 enum decoders decoder_system;
 
+// Number of frames to wait for the requested IDR frame before asking again
+#define RECOVERY_FRAMES 30
+
+// Decode errors are tracked by the frame number of the decode unit,
+// corrupt_frame is the first frame of the current range of corrupt frames.
+// The connection layer only invalidates references of frames it lost itself,
+// a decoder can only report errors by requesting a full IDR frame.
+static int last_frame, corrupt_frame, idr_requested;
+static bool corrupt;
+
 #define BYTES_PER_PIXEL 4
 
+// Pixel rate a single thread is expected to decode and the maximum
+// number of slices per frame requested from the host
+#define PIXELS_PER_THREAD (1920 * 1080 * 30)
+#define MAX_THREADS 8
+
+// Select the number of slice threads for a stream, frame threading is
+// never used as every thread adds a frame of latency
+int ffmpeg_threads(int videoFormat, int width, int height, int fps) {
+  int cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = decoder_threads;
+  if (threads <= 0) {
+    long long pixels = (long long) width * height * fps;
+    // HEVC takes more time to decode
+    if (videoFormat == VIDEO_FORMAT_H265)
+      pixels = pixels * 3 / 2;
+
+    threads = (pixels + PIXELS_PER_THREAD - 1) / PIXELS_PER_THREAD;
+    // Leave a core for receiving, audio and presentation
+    if (threads > cores - 1)
+      threads = cores - 1;
+  }
+
+  if (threads < 1)
+    threads = 1;
+  else if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+
+  printf("Decoding with %d slice thread%s (%s, %d cores, %dx%d at %d fps)\n", threads, threads > 1 ? "s" : "", decoder_threads > 0 ? "requested" : "automatic", cores, width, height, fps);
+  return threads;
+}
+
 // This function must be called before
 // any other decoding functions
 int ffmpeg_init(int videoFormat, int width, int height, int perf_lvl, int thread_count) {
@@ -51,6 +95,10 @@ int ffmpeg_init(int videoFormat, int width, int height, int perf_lvl, int thread
 
   av_init_packet(&pkt);
 
+  last_frame = 0;
+  corrupt = false;
+
+  decoder = NULL;
   #ifdef HAVE_VDPAU
   if (perf_lvl & HARDWARE_ACCELERATION) {
     switch (videoFormat) {
@@ -153,13 +201,24 @@ AVFrame* ffmpeg_get_frame() {
 
 // packets must be decoded in order
 // indata must be inlen + FF_INPUT_BUFFER_PADDING_SIZE in length
-int ffmpeg_decode(unsigned char* indata, int inlen) {
-  int err;
+// returns 1 if a correct picture is available, 0 if not and DR_NEED_IDR
+// if the decoder can't recover without an IDR frame
+int ffmpeg_decode(unsigned char* indata, int inlen, PFRAME_INFO frame) {
+  int err = 0;
   int got_pic = 0;
+  enum frame_type type = frame != NULL ? frame->type : FRAME_UNKNOWN;
+
+  int frame_number = frame != NULL ? frame->decodeUnit->frameNumber : last_frame + 1;
+  last_frame = frame_number;
+  if (type == FRAME_IDR && corrupt) {
+    printf("Recovered from corrupt frame %d with IDR frame %d\n", corrupt_frame, frame_number);
+    corrupt = false;
+  }
 
   pkt.data = indata;
   pkt.size = inlen;
 
+  long long span = trace_begin();
   while (pkt.size > 0) {
     got_pic = 0;
     err = avcodec_decode_video2(decoder_ctx, dec_frame, &got_pic, &pkt);
@@ -174,10 +233,31 @@ int ffmpeg_decode(unsigned char* indata, int inlen) {
     pkt.size -= err;
     pkt.data += err;
   }
-  
-  if (got_pic) {
-    return 1;
+  trace_end("ffmpeg_decode", span);
+
+  bool failed = err < 0 || (got_pic && (dec_frame->decode_error_flags != 0 || (dec_frame->flags & AV_FRAME_FLAG_CORRUPT)));
+  // Nothing references a droppable frame, so only this frame is lost
+  if (failed && type != FRAME_DROPPABLE && !corrupt) {
+    fprintf(stderr, "Frame %d is corrupt, requesting IDR frame\n", frame_number);
+    corrupt = true;
+    corrupt_frame = frame_number;
+    idr_requested = frame_number;
+    return DR_NEED_IDR;
+  }
+
+  if (corrupt) {
+    // ffmpeg conceals errors, so a frame decoding without errors can still
+    // reference the corrupt range. Only the reference lists in the slice
+    // headers could prove otherwise, so every frame is suppressed until
+    // the IDR frame arrives, which is requested again when it doesn't.
+    if (frame_number - idr_requested >= RECOVERY_FRAMES) {
+      fprintf(stderr, "No IDR frame since corrupt frame %d, requesting it again\n", corrupt_frame);
+      idr_requested = frame_number;
+      return DR_NEED_IDR;
+    }
+
+    return 0;
   }
 
-  return err < 0 ? err : 0;
+  return got_pic && !failed ? 1 : 0;
 }
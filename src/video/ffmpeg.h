@@ -17,6 +17,8 @@
  * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "frame.h"
+
 #include <libavcodec/avcodec.h>
 
 // Disables the deblocking filter at the cost of image quality
@@ -34,9 +36,10 @@
 // Uses hardware acceleration
 #define HARDWARE_ACCELERATION 0x40
 
+int ffmpeg_threads(int videoFormat, int width, int height, int fps);
 int ffmpeg_init(int videoFormat, int width, int height, int perf_lvl, int thread_count);
 void ffmpeg_destroy(void);
 
 int ffmpeg_draw_frame(AVFrame *pict);
 AVFrame* ffmpeg_get_frame();
-int ffmpeg_decode(unsigned char* indata, int inlen);
+int ffmpeg_decode(unsigned char* indata, int inlen, PFRAME_INFO frame);
@@ -0,0 +1,656 @@
+/*
+ * This file is part of Moonlight Embedded.
+ *
+ * Copyright (C) 2016 Iwan Timmer
+ *
+ * Moonlight is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Moonlight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Moonlight; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../video.h"
+#include "../platform.h"
+#include "../startup.h"
+#include "../pacer.h"
+#include "ffmpeg.h"
+
+#include "sps.h"
+#include <Limelight.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DECODER_BUFFER_SIZE 92*1024
+// Room for the rewritten VPS and SPS growing beyond the received length
+#define DECODER_BUFFER_HEADROOM 2*GS_SPS_MAX_LENGTH
+#define KMS_CARD "/dev/dri/card%d"
+#define KMS_MAX_CARDS 8
+// One buffer on screen, one waiting for the page flip and one to decode into
+#define KMS_BUFFERS 3
+#define KMS_EVENT_TIMEOUT 100
+
+struct kms_buffer {
+  uint32_t handle, fb, pitch;
+  uint64_t size;
+  uint8_t* map;
+};
+
+static char* ffmpeg_buffer;
+static bool hevc, decoded, presented;
+static int threads, prepared_format, prepared_width, prepared_height, prepared_fps;
+
+static int card = -1, fd = -1;
+static uint32_t connector_id, crtc_id, primary_id, video_plane_id, video_fb_property;
+static int crtc_index;
+static drmModeModeInfo mode;
+static drmModeCrtcPtr saved_crtc;
+static uint64_t saved_connector_crtc;
+
+// Frames are shown on a YUV plane when available and converted to RGB otherwise
+static bool yuv;
+static int video_width, video_height;
+static struct kms_buffer buffers[KMS_BUFFERS], background;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t event_thread;
+static bool running;
+static int front = -1, queued = -1, next = -1;
+
+static uint32_t kms_get_property(uint32_t object, uint32_t type, const char* name, uint64_t* value) {
+  drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, object, type);
+  uint32_t id = 0;
+  for (uint32_t i = 0; props != NULL && i < props->count_props && id == 0; i++) {
+    drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+    if (prop != NULL && strcmp(prop->name, name) == 0) {
+      id = prop->prop_id;
+      if (value != NULL)
+        *value = props->prop_values[i];
+    }
+    drmModeFreeProperty(prop);
+  }
+  drmModeFreeObjectProperties(props);
+  return id;
+}
+
+static void kms_add_property(drmModeAtomicReqPtr req, uint32_t object, uint32_t type, const char* name, uint64_t value) {
+  uint32_t id = kms_get_property(object, type, name, NULL);
+  if (id != 0)
+    drmModeAtomicAddProperty(req, object, id, value);
+}
+
+static drmModeConnectorPtr kms_find_connector() {
+  drmModeResPtr res = drmModeGetResources(fd);
+  if (res == NULL)
+    return NULL;
+
+  drmModeConnectorPtr connector = NULL;
+  for (int i = 0; i < res->count_connectors && connector == NULL; i++) {
+    connector = drmModeGetConnector(fd, res->connectors[i]);
+    if (connector != NULL && (connector->connection != DRM_MODE_CONNECTED || connector->count_modes == 0)) {
+      drmModeFreeConnector(connector);
+      connector = NULL;
+    }
+  }
+
+  drmModeFreeResources(res);
+  return connector;
+}
+
+static int kms_open(int index) {
+  char path[32];
+  sprintf(path, KMS_CARD, index);
+  int card_fd = open(path, O_RDWR | O_CLOEXEC);
+  if (card_fd >= 0 && (drmSetClientCap(card_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0 || drmSetClientCap(card_fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0)) {
+    close(card_fd);
+    card_fd = -1;
+  }
+  return card_fd;
+}
+
+// Find the first card supporting atomic modesetting with a connected display.
+// The card is only kept open while streaming, so it isn't held when KMS ends
+// up unused.
+bool kms_init() {
+  for (int i = 0; i < KMS_MAX_CARDS; i++) {
+    if ((fd = kms_open(i)) < 0)
+      continue;
+
+    drmModeConnectorPtr connector = kms_find_connector();
+    drmModeFreeConnector(connector);
+    close(fd);
+    fd = -1;
+
+    if (connector != NULL) {
+      card = i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Prefer a mode matching the stream, so no scaling is needed
+static void kms_select_mode(drmModeConnectorPtr connector, int width, int height, int redrawRate) {
+  int best = 0;
+  for (int i = 0; i < connector->count_modes; i++) {
+    drmModeModeInfoPtr info = &connector->modes[i];
+    if (info->hdisplay == width && info->vdisplay == height) {
+      if ((int) info->vrefresh == redrawRate) {
+        best = i;
+        break;
+      } else if (connector->modes[best].hdisplay != width || connector->modes[best].vdisplay != height)
+        best = i;
+    } else if ((info->type & DRM_MODE_TYPE_PREFERRED) && (connector->modes[best].hdisplay != width || connector->modes[best].vdisplay != height))
+      best = i;
+  }
+  mode = connector->modes[best];
+}
+
+static bool kms_select_crtc(drmModeConnectorPtr connector) {
+  drmModeResPtr res = drmModeGetResources(fd);
+  if (res == NULL)
+    return false;
+
+  uint32_t possible_crtcs = 0;
+  crtc_id = 0;
+  drmModeEncoderPtr encoder = drmModeGetEncoder(fd, connector->encoder_id);
+  if (encoder != NULL) {
+    crtc_id = encoder->crtc_id;
+    drmModeFreeEncoder(encoder);
+  }
+
+  for (int i = 0; i < connector->count_encoders; i++) {
+    if ((encoder = drmModeGetEncoder(fd, connector->encoders[i])) != NULL) {
+      possible_crtcs |= encoder->possible_crtcs;
+      drmModeFreeEncoder(encoder);
+    }
+  }
+
+  crtc_index = -1;
+  for (int i = 0; i < res->count_crtcs && crtc_index < 0; i++) {
+    if (res->crtcs[i] == crtc_id || (crtc_id == 0 && possible_crtcs & (1 << i))) {
+      crtc_id = res->crtcs[i];
+      crtc_index = i;
+    }
+  }
+
+  drmModeFreeResources(res);
+  return crtc_index >= 0;
+}
+
+static bool kms_plane_supports(drmModePlanePtr plane, uint32_t format) {
+  for (uint32_t i = 0; i < plane->count_formats; i++) {
+    if (plane->formats[i] == format)
+      return true;
+  }
+  return false;
+}
+
+// Use an overlay plane for YUV when available, with the primary plane
+// only showing a black background
+static bool kms_select_planes() {
+  drmModePlaneResPtr planes = drmModeGetPlaneResources(fd);
+  if (planes == NULL)
+    return false;
+
+  bool primary_yuv = false;
+  primary_id = video_plane_id = 0;
+  for (uint32_t i = 0; i < planes->count_planes; i++) {
+    drmModePlanePtr plane = drmModeGetPlane(fd, planes->planes[i]);
+    if (plane == NULL)
+      continue;
+
+    uint64_t type;
+    if ((plane->possible_crtcs & (1 << crtc_index)) && kms_get_property(plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type) != 0) {
+      if (type == DRM_PLANE_TYPE_PRIMARY && primary_id == 0) {
+        primary_id = plane->plane_id;
+        primary_yuv = kms_plane_supports(plane, DRM_FORMAT_YUV420);
+      } else if (type == DRM_PLANE_TYPE_OVERLAY && video_plane_id == 0 && kms_plane_supports(plane, DRM_FORMAT_YUV420))
+        video_plane_id = plane->plane_id;
+    }
+    drmModeFreePlane(plane);
+  }
+  drmModeFreePlaneResources(planes);
+
+  if (primary_id == 0)
+    return false;
+
+  yuv = video_plane_id != 0 || primary_yuv;
+  if (video_plane_id == 0)
+    video_plane_id = primary_id;
+
+  video_fb_property = kms_get_property(video_plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID", NULL);
+  return video_fb_property != 0;
+}
+
+static bool kms_create_buffer(struct kms_buffer* buffer, int width, int height, uint32_t format) {
+  struct drm_mode_create_dumb create = {0};
+  create.width = width;
+  create.height = format == DRM_FORMAT_YUV420 ? height * 3 / 2 : height;
+  create.bpp = format == DRM_FORMAT_YUV420 ? 8 : 32;
+  if (drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0)
+    return false;
+
+  buffer->handle = create.handle;
+  buffer->pitch = create.pitch;
+  buffer->size = create.size;
+
+  uint32_t handles[4] = { buffer->handle }, pitches[4] = { buffer->pitch }, offsets[4] = { 0 };
+  if (format == DRM_FORMAT_YUV420) {
+    handles[1] = handles[2] = buffer->handle;
+    pitches[1] = pitches[2] = buffer->pitch / 2;
+    offsets[1] = buffer->pitch * height;
+    offsets[2] = offsets[1] + pitches[1] * height / 2;
+  }
+
+  if (drmModeAddFB2(fd, width, height, format, handles, pitches, offsets, &buffer->fb, 0) < 0)
+    return false;
+
+  struct drm_mode_map_dumb map = { .handle = buffer->handle };
+  if (drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0)
+    return false;
+
+  buffer->map = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map.offset);
+  if (buffer->map == MAP_FAILED) {
+    buffer->map = NULL;
+    return false;
+  }
+
+  // Black in either format
+  memset(buffer->map, 0, buffer->size);
+  if (format == DRM_FORMAT_YUV420) {
+    memset(buffer->map, 16, offsets[1]);
+    memset(buffer->map + offsets[1], 128, buffer->size - offsets[1]);
+  }
+
+  return true;
+}
+
+static void kms_destroy_buffer(struct kms_buffer* buffer) {
+  if (buffer->map != NULL)
+    munmap(buffer->map, buffer->size);
+
+  if (buffer->fb != 0)
+    drmModeRmFB(fd, buffer->fb);
+
+  if (buffer->handle != 0) {
+    struct drm_mode_destroy_dumb destroy = { .handle = buffer->handle };
+    drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+  }
+
+  memset(buffer, 0, sizeof(*buffer));
+}
+
+static void kms_add_plane_rect(drmModeAtomicReqPtr req, uint32_t plane, uint32_t fb, int src_x, int src_y, int src_w, int src_h, int x, int y, int w, int h) {
+  kms_add_property(req, plane, DRM_MODE_OBJECT_PLANE, "FB_ID", fb);
+  kms_add_property(req, plane, DRM_MODE_OBJECT_PLANE, "CRTC_ID", fb != 0 ? crtc_id : 0);
+  kms_add_property(req, plane, DRM_MODE_OBJECT_PLANE, "SRC_X", (uint64_t) src_x << 16);
+  kms_add_property(req, plane, DRM_MODE_OBJECT_PLANE, "SRC_Y", (uint64_t) src_y << 16);
+  kms_add_property(req, plane, DRM_MODE_OBJECT_PLANE, "SRC_W", (uint64_t) src_w << 16);
+  kms_add_property(req, plane, DRM_MODE_OBJECT_PLANE, "SRC_H", (uint64_t) src_h << 16);
+  kms_add_property(req, plane, DRM_MODE_OBJECT_PLANE, "CRTC_X", x);
+  kms_add_property(req, plane, DRM_MODE_OBJECT_PLANE, "CRTC_Y", y);
+  kms_add_property(req, plane, DRM_MODE_OBJECT_PLANE, "CRTC_W", w);
+  kms_add_property(req, plane, DRM_MODE_OBJECT_PLANE, "CRTC_H", h);
+}
+
+static void kms_add_plane(drmModeAtomicReqPtr req, uint32_t plane, uint32_t fb, int width, int height, bool scale) {
+  int x = 0, y = 0, w = width, h = height;
+  int src_x = 0, src_y = 0, src_w = width, src_h = height;
+  if (scale) {
+    // Fit to the screen while keeping the aspect ratio
+    w = mode.hdisplay;
+    h = (int) ((long long) height * mode.hdisplay / width);
+    if (h > mode.vdisplay) {
+      h = mode.vdisplay;
+      w = (int) ((long long) width * mode.vdisplay / height);
+    }
+  } else {
+    // Centered and cropped when larger than the screen
+    if (w > mode.hdisplay) {
+      src_x = (w - mode.hdisplay) / 2;
+      src_w = w = mode.hdisplay;
+    }
+    if (h > mode.vdisplay) {
+      src_y = (h - mode.vdisplay) / 2;
+      src_h = h = mode.vdisplay;
+    }
+  }
+  x = (mode.hdisplay - w) / 2;
+  y = (mode.vdisplay - h) / 2;
+
+  kms_add_plane_rect(req, plane, fb, src_x, src_y, src_w, src_h, x, y, w, h);
+}
+
+static int kms_modeset(uint32_t mode_blob, bool scale, uint32_t flags) {
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  kms_add_property(req, connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", crtc_id);
+  kms_add_property(req, crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID", mode_blob);
+  kms_add_property(req, crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", 1);
+  if (video_plane_id != primary_id)
+    kms_add_plane(req, primary_id, background.fb, mode.hdisplay, mode.vdisplay, false);
+
+  kms_add_plane(req, video_plane_id, buffers[0].fb, video_width, video_height, scale);
+
+  int ret = drmModeAtomicCommit(fd, req, flags | DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+  drmModeAtomicFree(req);
+  return ret;
+}
+
+// Show what was on screen before streaming with the video plane disabled,
+// in a single atomic commit like the modeset itself
+static void kms_restore() {
+  uint32_t mode_blob = 0;
+  if (saved_crtc->mode_valid && drmModeCreatePropertyBlob(fd, &saved_crtc->mode, sizeof(saved_crtc->mode), &mode_blob) != 0)
+    mode_blob = 0;
+
+  // A disabled CRTC can't have connectors or planes attached
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  kms_add_property(req, connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", mode_blob != 0 ? saved_connector_crtc : 0);
+  kms_add_property(req, crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID", mode_blob);
+  kms_add_property(req, crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", mode_blob != 0);
+  if (video_plane_id != primary_id)
+    kms_add_plane_rect(req, video_plane_id, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+  if (mode_blob != 0 && saved_crtc->buffer_id != 0)
+    kms_add_plane_rect(req, primary_id, saved_crtc->buffer_id, saved_crtc->x, saved_crtc->y, saved_crtc->mode.hdisplay, saved_crtc->mode.vdisplay, 0, 0, saved_crtc->mode.hdisplay, saved_crtc->mode.vdisplay);
+  else
+    kms_add_plane_rect(req, primary_id, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+  if (drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL) != 0)
+    fprintf(stderr, "KMS: Couldn't restore display\n");
+
+  drmModeAtomicFree(req);
+  if (mode_blob != 0)
+    drmModeDestroyPropertyBlob(fd, mode_blob);
+}
+
+// Must be called with the lock held
+static void kms_commit(int index) {
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  drmModeAtomicAddProperty(req, video_plane_id, video_fb_property, buffers[index].fb);
+  if (drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, NULL) == 0) {
+    queued = index;
+    pacer_begin_present_now();
+  } else
+    fprintf(stderr, "KMS: Couldn't flip to new frame\n");
+
+  drmModeAtomicFree(req);
+}
+
+static void kms_page_flip(int card, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec, void* data) {
+  front = queued;
+  queued = -1;
+
+  // The frame is on screen once the flip completes
+  pacer_end_present(pacer_time_us());
+  if (!presented) {
+    startup_mark("first_frame_presented");
+    presented = true;
+  }
+
+  // Show the newest frame decoded while waiting for the flip
+  if (next >= 0) {
+    int index = next;
+    next = -1;
+    kms_commit(index);
+  }
+}
+
+static void* kms_event_loop(void* data) {
+  drmEventContext context = { .version = 2, .page_flip_handler = kms_page_flip };
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  while (running) {
+    if (poll(&pfd, 1, KMS_EVENT_TIMEOUT) > 0) {
+      pthread_mutex_lock(&lock);
+      drmHandleEvent(fd, &context);
+      pthread_mutex_unlock(&lock);
+    }
+  }
+  return NULL;
+}
+
+// The host encodes a slice for every decoder thread, which has to be
+// known before the stream is started
+void kms_prepare(int videoFormat, int width, int height, int redrawRate, int drFlags) {
+  threads = ffmpeg_threads(videoFormat, width, height, redrawRate);
+  decoder_callbacks_kms.capabilities &= ~CAPABILITY_SLICES_PER_FRAME(0xff);
+  decoder_callbacks_kms.capabilities |= CAPABILITY_SLICES_PER_FRAME(threads);
+
+  prepared_format = videoFormat;
+  prepared_width = width;
+  prepared_height = height;
+  prepared_fps = redrawRate;
+}
+
+static void kms_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  hevc = videoFormat == VIDEO_FORMAT_H265;
+  pacer_init(redrawRate);
+
+  int avc_flags = SLICE_THREADING;
+  if (drFlags & FORCE_HARDWARE_ACCELERATION)
+    avc_flags |= HARDWARE_ACCELERATION;
+
+  // The threads depend on the resolution and frame rate of the stream
+  if (threads <= 0 || videoFormat != prepared_format || width != prepared_width || height != prepared_height || redrawRate != prepared_fps)
+    threads = ffmpeg_threads(videoFormat, width, height, redrawRate);
+
+  if (ffmpeg_init(videoFormat, width, height, avc_flags, threads) < 0) {
+    fprintf(stderr, "Couldn't initialize video decoding\n");
+    exit(1);
+  }
+
+  ffmpeg_buffer = malloc(DECODER_BUFFER_SIZE + DECODER_BUFFER_HEADROOM + FF_INPUT_BUFFER_PADDING_SIZE);
+  if (ffmpeg_buffer == NULL) {
+    fprintf(stderr, "Not enough memory\n");
+    exit(1);
+  }
+
+  if ((fd = kms_open(card)) < 0) {
+    fprintf(stderr, "KMS: Couldn't open display\n");
+    exit(1);
+  }
+
+  drmModeConnectorPtr connector = kms_find_connector();
+  if (connector == NULL || !kms_select_crtc(connector)) {
+    fprintf(stderr, "KMS: Couldn't find a display\n");
+    exit(1);
+  }
+
+  connector_id = connector->connector_id;
+  kms_select_mode(connector, width, height, redrawRate);
+  drmModeFreeConnector(connector);
+  pacer_set_refresh_rate(mode.vrefresh);
+
+  if (!kms_select_planes()) {
+    fprintf(stderr, "KMS: Couldn't find a usable plane\n");
+    exit(1);
+  }
+
+  // YUV 4:2:0 requires even dimensions
+  video_width = yuv ? width & ~1 : width;
+  video_height = yuv ? height & ~1 : height;
+  for (int i = 0; i < KMS_BUFFERS; i++) {
+    if (!kms_create_buffer(&buffers[i], video_width, video_height, yuv ? DRM_FORMAT_YUV420 : DRM_FORMAT_XRGB8888)) {
+      fprintf(stderr, "KMS: Couldn't create frame buffer\n");
+      exit(1);
+    }
+  }
+
+  if (video_plane_id != primary_id && !kms_create_buffer(&background, mode.hdisplay, mode.vdisplay, DRM_FORMAT_XRGB8888)) {
+    fprintf(stderr, "KMS: Couldn't create frame buffer\n");
+    exit(1);
+  }
+
+  uint32_t mode_blob;
+  if (drmModeCreatePropertyBlob(fd, &mode, sizeof(mode), &mode_blob) != 0) {
+    fprintf(stderr, "KMS: Couldn't set display mode\n");
+    exit(1);
+  }
+
+  saved_crtc = drmModeGetCrtc(fd, crtc_id);
+  saved_connector_crtc = 0;
+  kms_get_property(connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", &saved_connector_crtc);
+
+  // Not every plane can scale, fall back to showing the frame unscaled
+  bool scale = kms_modeset(mode_blob, true, DRM_MODE_ATOMIC_TEST_ONLY) == 0;
+  if (kms_modeset(mode_blob, scale, 0) != 0) {
+    fprintf(stderr, "KMS: Couldn't set display mode\n");
+    exit(1);
+  }
+
+  // The CRTC keeps its own reference to the mode
+  drmModeDestroyPropertyBlob(fd, mode_blob);
+
+  printf("KMS: %dx%d@%d on %s plane%s\n", mode.hdisplay, mode.vdisplay, mode.vrefresh, yuv ? "YUV" : "RGB", scale ? ", scaled" : "");
+
+  front = 0;
+  queued = next = -1;
+  running = true;
+  if (pthread_create(&event_thread, NULL, kms_event_loop, NULL) != 0) {
+    fprintf(stderr, "KMS: Couldn't start event thread\n");
+    exit(1);
+  }
+}
+
+static void kms_cleanup() {
+  running = false;
+  pthread_join(event_thread, NULL);
+  pacer_report();
+
+  if (saved_crtc != NULL) {
+    kms_restore();
+    drmModeFreeCrtc(saved_crtc);
+    saved_crtc = NULL;
+  }
+
+  for (int i = 0; i < KMS_BUFFERS; i++)
+    kms_destroy_buffer(&buffers[i]);
+
+  kms_destroy_buffer(&background);
+  close(fd);
+  fd = -1;
+
+  ffmpeg_destroy();
+  free(ffmpeg_buffer);
+  ffmpeg_buffer = NULL;
+}
+
+static void kms_copy_yuv(struct kms_buffer* buffer, AVFrame* frame) {
+  uint8_t* dst = buffer->map;
+  for (int i = 0; i < 3; i++) {
+    int pitch = i == 0 ? buffer->pitch : buffer->pitch / 2;
+    int width = i == 0 ? video_width : video_width / 2;
+    int height = i == 0 ? video_height : video_height / 2;
+    for (int y = 0; y < height; y++)
+      memcpy(dst + y * pitch, frame->data[i] + y * frame->linesize[i], width);
+
+    dst += pitch * height;
+  }
+}
+
+static inline uint8_t kms_clamp(int value) {
+  return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+// BT.601 limited range to RGB for planes without YUV support
+static void kms_copy_rgb(struct kms_buffer* buffer, AVFrame* frame) {
+  for (int y = 0; y < video_height; y++) {
+    uint32_t* dst = (uint32_t*) (buffer->map + y * buffer->pitch);
+    uint8_t* src_y = frame->data[0] + y * frame->linesize[0];
+    uint8_t* src_u = frame->data[1] + y / 2 * frame->linesize[1];
+    uint8_t* src_v = frame->data[2] + y / 2 * frame->linesize[2];
+    for (int x = 0; x < video_width; x++) {
+      int c = 298 * (src_y[x] - 16) + 128;
+      int d = src_u[x / 2] - 128;
+      int e = src_v[x / 2] - 128;
+      dst[x] = kms_clamp((c + 409 * e) >> 8) << 16 | kms_clamp((c - 100 * d - 208 * e) >> 8) << 8 | kms_clamp((c + 516 * d) >> 8);
+    }
+  }
+}
+
+static void kms_present(AVFrame* frame) {
+  pthread_mutex_lock(&lock);
+  int index = next;
+  next = -1;
+  for (int i = 0; i < KMS_BUFFERS && index < 0; i++) {
+    if (i != front && i != queued)
+      index = i;
+  }
+  pthread_mutex_unlock(&lock);
+
+  if (yuv)
+    kms_copy_yuv(&buffers[index], frame);
+  else
+    kms_copy_rgb(&buffers[index], frame);
+
+  pthread_mutex_lock(&lock);
+  if (queued < 0)
+    kms_commit(index);
+  else
+    next = index;
+  pthread_mutex_unlock(&lock);
+}
+
+static int kms_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  if (decodeUnit->fullLength >= DECODER_BUFFER_SIZE) {
+    fprintf(stderr, "Video decode buffer too small\n");
+    exit(1);
+  }
+
+  PLENTRY entry = decodeUnit->bufferList;
+  int length = 0;
+  while (entry != NULL) {
+    // Limit reordering and buffering in the HEVC parameter sets
+    PLENTRY nal = hevc ? gs_sps_fix(entry, GS_SPS_HEVC | GS_SPS_BITSTREAM_FIXUP) : entry;
+    if (length + nal->length > DECODER_BUFFER_SIZE + DECODER_BUFFER_HEADROOM) {
+      // Never decode a truncated frame, request a new IDR instead
+      fprintf(stderr, "Video decode buffer too small for rewritten parameter sets\n");
+      return DR_NEED_IDR;
+    }
+
+    memcpy(ffmpeg_buffer+length, nal->data, nal->length);
+    length += nal->length;
+    entry = entry->next;
+  }
+
+  int ret = ffmpeg_decode(ffmpeg_buffer, length, gs_frame_info(decodeUnit));
+  if (ret == 1) {
+    if (!decoded) {
+      startup_mark("first_frame_decoded");
+      decoded = true;
+    }
+
+    pacer_frame_ready();
+    kms_present(ffmpeg_get_frame());
+  }
+
+  return ret == DR_NEED_IDR ? DR_NEED_IDR : DR_OK;
+}
+
+DECODER_RENDERER_CALLBACKS decoder_callbacks_kms = {
+  .setup = kms_setup,
+  .cleanup = kms_cleanup,
+  .submitDecodeUnit = kms_submit_decode_unit,
+  .capabilities = CAPABILITY_SLICES_PER_FRAME(2) | CAPABILITY_REFERENCE_FRAME_INVALIDATION | CAPABILITY_DIRECT_SUBMIT,
+};
@@ -34,6 +34,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include <ilclient.h>
@@ -53,14 +54,10 @@ static unsigned char *dest;
 static int port_settings_changed;
 static int first_packet;
 
-static void decoder_renderer_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
-  if (videoFormat != VIDEO_FORMAT_H264) {
-    fprintf(stderr, "Video format not supported\n");
-    exit(1);
-  }
+static bool prepared;
 
+static void decoder_renderer_init() {
   bcm_host_init();
-  gs_sps_init(width, height);
 
   OMX_VIDEO_PARAM_PORTFORMATTYPE format;
   OMX_TIME_CONFIG_CLOCKSTATETYPE cstate;
@@ -147,6 +144,30 @@ static void decoder_renderer_setup(int videoFormat, int width, int height, int r
   }
 }
 
+// Create the OMX components while the host is still launching the app.
+// Nothing in the decoder depends on the stream parameters except the format.
+void video_pi_prepare(int videoFormat, int width, int height, int redrawRate, int drFlags) {
+  if (videoFormat != VIDEO_FORMAT_H264)
+    return;
+
+  decoder_renderer_init();
+  prepared = true;
+}
+
+static void decoder_renderer_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  if (videoFormat != VIDEO_FORMAT_H264) {
+    fprintf(stderr, "Video format not supported\n");
+    exit(1);
+  }
+
+  gs_sps_init(width, height);
+
+  if (!prepared)
+    decoder_renderer_init();
+
+  prepared = false;
+}
+
 static void decoder_renderer_cleanup() {
   int status = 0;
 
@@ -201,8 +222,7 @@ static int decoder_renderer_submit_decode_unit(PDECODE_UNIT decodeUnit) {
     first_packet = 0;
   }
 
-  PLENTRY entry = gs_sps_fix(&decodeUnit->bufferList, GS_SPS_BITSTREAM_FIXUP);
-  decodeUnit->bufferList = entry;
+  PLENTRY entry = gs_sps_fix(decodeUnit->bufferList, GS_SPS_BITSTREAM_FIXUP);
   while (entry != NULL) {
     memcpy(dest, entry->data, entry->length);
     buf->nFilledLen += entry->length;
@@ -18,9 +18,13 @@
  */
 
 #include "../video.h"
+#include "../platform.h"
 #include "../sdl.h"
+#include "../startup.h"
+#include "../pacer.h"
 #include "ffmpeg.h"
 
+#include "sps.h"
 #include <Limelight.h>
 
 #include <SDL.h>
@@ -29,51 +33,114 @@
 #include <stdbool.h>
 
 #define DECODER_BUFFER_SIZE 92*1024
+// Room for the rewritten VPS and SPS growing beyond the received length
+#define DECODER_BUFFER_HEADROOM 2*GS_SPS_MAX_LENGTH
 
 static char* ffmpeg_buffer;
+static bool hevc;
 
-static void sdl_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+// Decoder parameters used by sdl_prepare, checked again in sdl_setup
+static bool prepared, decoded;
+static int prepared_format, prepared_width, prepared_height, prepared_fps, prepared_flags, prepared_threads;
+
+static void sdl_decoder_init(int videoFormat, int width, int height, int threads, int drFlags) {
   int avc_flags = SLICE_THREADING;
   if (drFlags & FORCE_HARDWARE_ACCELERATION)
     avc_flags |= HARDWARE_ACCELERATION;
 
-  if (ffmpeg_init(videoFormat, width, height, avc_flags, 2) < 0) {
+  if (ffmpeg_init(videoFormat, width, height, avc_flags, threads) < 0) {
     fprintf(stderr, "Couldn't initialize video decoding\n");
     exit(1);
   }
-  
-  ffmpeg_buffer = malloc(DECODER_BUFFER_SIZE + FF_INPUT_BUFFER_PADDING_SIZE);
+
+  if (ffmpeg_buffer == NULL)
+    ffmpeg_buffer = malloc(DECODER_BUFFER_SIZE + DECODER_BUFFER_HEADROOM + FF_INPUT_BUFFER_PADDING_SIZE);
+
   if (ffmpeg_buffer == NULL) {
     fprintf(stderr, "Not enough memory\n");
     exit(1);
   }
 }
 
+// Open the decoder with the expected stream parameters while the host is still
+// launching the app. sdl_setup only reopens it when the parameters differ.
+void sdl_prepare(int videoFormat, int width, int height, int redrawRate, int drFlags) {
+  // The host encodes a slice for every decoder thread
+  prepared_threads = ffmpeg_threads(videoFormat, width, height, redrawRate);
+  decoder_callbacks_sdl.capabilities &= ~CAPABILITY_SLICES_PER_FRAME(0xff);
+  decoder_callbacks_sdl.capabilities |= CAPABILITY_SLICES_PER_FRAME(prepared_threads);
+  sdl_decoder_init(videoFormat, width, height, prepared_threads, drFlags);
+
+  prepared = true;
+  prepared_format = videoFormat;
+  prepared_width = width;
+  prepared_height = height;
+  prepared_fps = redrawRate;
+  prepared_flags = drFlags;
+}
+
+static void sdl_setup(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags) {
+  hevc = videoFormat == VIDEO_FORMAT_H265;
+  pacer_init(redrawRate);
+  bool matches = videoFormat == prepared_format && width == prepared_width && height == prepared_height && redrawRate == prepared_fps;
+  if (prepared) {
+    prepared = false;
+    if (matches && drFlags == prepared_flags)
+      return;
+
+    ffmpeg_destroy();
+  }
+
+  // The threads depend on the resolution and frame rate of the stream
+  int threads = matches ? prepared_threads : ffmpeg_threads(videoFormat, width, height, redrawRate);
+  sdl_decoder_init(videoFormat, width, height, threads, drFlags);
+}
+
 static void sdl_cleanup() {
   ffmpeg_destroy();
 }
 
 static int sdl_submit_decode_unit(PDECODE_UNIT decodeUnit) {
+  int result = DR_OK;
   if (decodeUnit->fullLength < DECODER_BUFFER_SIZE) {
     PLENTRY entry = decodeUnit->bufferList;
     int length = 0;
     while (entry != NULL) {
-      memcpy(ffmpeg_buffer+length, entry->data, entry->length);
-      length += entry->length;
+      // Limit reordering and buffering in the HEVC parameter sets
+      PLENTRY nal = hevc ? gs_sps_fix(entry, GS_SPS_HEVC | GS_SPS_BITSTREAM_FIXUP) : entry;
+      if (length + nal->length > DECODER_BUFFER_SIZE + DECODER_BUFFER_HEADROOM) {
+        // Never decode a truncated frame, request a new IDR instead
+        fprintf(stderr, "Video decode buffer too small for rewritten parameter sets\n");
+        return DR_NEED_IDR;
+      }
+
+      memcpy(ffmpeg_buffer+length, nal->data, nal->length);
+      length += nal->length;
       entry = entry->next;
     }
 
     if (SDL_LockMutex(mutex) == 0) {
-      int ret = ffmpeg_decode(ffmpeg_buffer, length);
-      if (ret == 1) {
-        AVFrame* frame = ffmpeg_get_frame();
-
-        SDL_Event event;
-        event.type = SDL_USEREVENT;
-        event.user.code = SDL_CODE_FRAME;
-        event.user.data1 = &frame->data;
-        event.user.data2 = &frame->linesize;
-        SDL_PushEvent(&event);
+      int ret = ffmpeg_decode(ffmpeg_buffer, length, gs_frame_info(decodeUnit));
+      if (ret == DR_NEED_IDR)
+        result = DR_NEED_IDR;
+      else if (ret == 1) {
+        if (!decoded) {
+          startup_mark("first_frame_decoded");
+          decoded = true;
+        }
+
+        // Only wake up the presentation thread if it isn't already waiting
+        // to present, a newer frame simply replaces the pending one
+        if (pacer_frame_ready()) {
+          AVFrame* frame = ffmpeg_get_frame();
+
+          SDL_Event event;
+          event.type = SDL_USEREVENT;
+          event.user.code = SDL_CODE_FRAME;
+          event.user.data1 = &frame->data;
+          event.user.data2 = &frame->linesize;
+          SDL_PushEvent(&event);
+        }
       }
 
       SDL_UnlockMutex(mutex);
@@ -84,7 +151,7 @@ static int sdl_submit_decode_unit(PDECODE_UNIT decodeUnit) {
     exit(1);
   }
 
-  return DR_OK;
+  return result;
 }
 
 DECODER_RENDERER_CALLBACKS decoder_callbacks_sdl = {